@@ -234,6 +234,7 @@ struct ast_node* ast_special_geo_create(const enum ast_special_geo_e op,
         .radius = radius,
         .latitude_var = make_attr_var("latitude", NULL),
         .longitude_var = make_attr_var("longitude", NULL) };
+    init_geo_bounds(&geo);
     node->special_expr.type = AST_SPECIAL_GEO;
     node->special_expr.geo = geo;
     return node;
@@ -559,8 +560,7 @@ static bool match_special_expr(
                         return false;
                     }
 
-                    return geo_within_radius(
-                        g->latitude, g->longitude, latitude_var, longitude_var, g->radius);
+                    return geo_within_radius(g, latitude_var, longitude_var);
                 }
                 default: abort();
             }
@@ -1006,21 +1006,13 @@ static bool match_node_inner(const struct betree_variable** preds,
     struct memoize* memoize,
     struct report* report)
 {
-    if(node->memoize_id != INVALID_PRED) {
-        if(test_bit(memoize->pass, node->memoize_id)) {
-            if(report != NULL) {
-                report->memoized++;
-            }
-            return true;
-        }
-        if(test_bit(memoize->fail, node->memoize_id)) {
-            if(report != NULL) {
-                report->memoized++;
-            }
-            return false;
+    bool result;
+    if(node->memoize_id != INVALID_PRED && get_memoize(memoize, node->memoize_id, &result)) {
+        if(report != NULL) {
+            report->memoized++;
         }
+        return result;
     }
-    bool result;
     switch(node->type) {
         case AST_TYPE_IS_NULL_EXPR:
             result = match_is_null_expr(preds, node->is_null_expr);
@@ -1052,12 +1044,7 @@ static bool match_node_inner(const struct betree_variable** preds,
         default: abort();
     }
     if(node->memoize_id != INVALID_PRED) {
-        if(result) {
-            set_bit(memoize->pass, node->memoize_id);
-        }
-        else {
-            set_bit(memoize->fail, node->memoize_id);
-        }
+        set_memoize(memoize, node->memoize_id, result);
     }
     return result;
 }
@@ -2459,6 +2446,223 @@ bool fast_eq_expr(const struct ast_node* a, const struct ast_node* b)
     return a->global_id == b->global_id;
 }
 
+static uint64_t hash_mix(uint64_t value)
+{
+    value ^= value >> 33;
+    value *= 0xff51afd7ed558ccdULL;
+    value ^= value >> 33;
+    value *= 0xc4ceb9fe1a85ec53ULL;
+    value ^= value >> 33;
+    return value;
+}
+
+static uint64_t hash_combine(uint64_t hash, uint64_t value)
+{
+    return hash_mix(hash ^ (value + 0x9e3779b97f4a7c15ULL + (hash << 6) + (hash >> 2)));
+}
+
+static uint64_t hash_float(uint64_t hash, double value)
+{
+    // -0.0 compares equal to 0.0
+    if(!(value < 0.0) && !(value > 0.0)) {
+        value = 0.0;
+    }
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return hash_combine(hash, bits);
+}
+
+static uint64_t hash_string(uint64_t hash, const char* string)
+{
+    uint64_t fnv = 0xcbf29ce484222325ULL;
+    for(const char* c = string; *c != '\0'; c++) {
+        fnv = (fnv ^ (uint8_t)*c) * 0x100000001b3ULL;
+    }
+    return hash_combine(hash, fnv);
+}
+
+static uint64_t hash_integer_list(uint64_t hash, const struct betree_integer_list* list)
+{
+    hash = hash_combine(hash, list->count);
+    for(size_t i = 0; i < list->count; i++) {
+        hash = hash_combine(hash, (uint64_t)list->integers[i]);
+    }
+    return hash;
+}
+
+static uint64_t hash_string_list(uint64_t hash, const struct betree_string_list* list)
+{
+    hash = hash_combine(hash, list->count);
+    for(size_t i = 0; i < list->count; i++) {
+        hash = hash_combine(hash, list->strings[i].str);
+    }
+    return hash;
+}
+
+static uint64_t hash_compare_expr(uint64_t hash, const struct ast_compare_expr* compare_expr)
+{
+    hash = hash_combine(hash, compare_expr->op);
+    hash = hash_combine(hash, compare_expr->attr_var.var);
+    hash = hash_combine(hash, compare_expr->value.value_type);
+    switch(compare_expr->value.value_type) {
+        case AST_COMPARE_VALUE_INTEGER:
+            return hash_combine(hash, (uint64_t)compare_expr->value.integer_value);
+        case AST_COMPARE_VALUE_FLOAT:
+            return hash_float(hash, compare_expr->value.float_value);
+        default: abort();
+    }
+}
+
+static uint64_t hash_equality_expr(uint64_t hash, const struct ast_equality_expr* equality_expr)
+{
+    hash = hash_combine(hash, equality_expr->op);
+    hash = hash_combine(hash, equality_expr->attr_var.var);
+    hash = hash_combine(hash, equality_expr->value.value_type);
+    switch(equality_expr->value.value_type) {
+        case AST_EQUALITY_VALUE_INTEGER:
+            return hash_combine(hash, (uint64_t)equality_expr->value.integer_value);
+        case AST_EQUALITY_VALUE_FLOAT:
+            return hash_float(hash, equality_expr->value.float_value);
+        case AST_EQUALITY_VALUE_STRING:
+            return hash_combine(hash, equality_expr->value.string_value.str);
+        case AST_EQUALITY_VALUE_INTEGER_ENUM:
+            return hash_combine(hash, equality_expr->value.integer_enum_value.ienum);
+        default: abort();
+    }
+}
+
+static uint64_t hash_set_expr(uint64_t hash, const struct ast_set_expr* set_expr)
+{
+    hash = hash_combine(hash, set_expr->op);
+    hash = hash_combine(hash, set_expr->left_value.value_type);
+    switch(set_expr->left_value.value_type) {
+        case AST_SET_LEFT_VALUE_INTEGER:
+            hash = hash_combine(hash, (uint64_t)set_expr->left_value.integer_value);
+            break;
+        case AST_SET_LEFT_VALUE_STRING:
+            hash = hash_combine(hash, set_expr->left_value.string_value.str);
+            break;
+        case AST_SET_LEFT_VALUE_VARIABLE:
+            hash = hash_combine(hash, set_expr->left_value.variable_value.var);
+            break;
+        default: abort();
+    }
+    hash = hash_combine(hash, set_expr->right_value.value_type);
+    switch(set_expr->right_value.value_type) {
+        case AST_SET_RIGHT_VALUE_INTEGER_LIST:
+            return hash_integer_list(hash, set_expr->right_value.integer_list_value);
+        case AST_SET_RIGHT_VALUE_STRING_LIST:
+            return hash_string_list(hash, set_expr->right_value.string_list_value);
+        case AST_SET_RIGHT_VALUE_VARIABLE:
+            return hash_combine(hash, set_expr->right_value.variable_value.var);
+        default: abort();
+    }
+}
+
+static uint64_t hash_list_expr(uint64_t hash, const struct ast_list_expr* list_expr)
+{
+    hash = hash_combine(hash, list_expr->op);
+    hash = hash_combine(hash, list_expr->attr_var.var);
+    hash = hash_combine(hash, list_expr->value.value_type);
+    switch(list_expr->value.value_type) {
+        case AST_LIST_VALUE_INTEGER_LIST:
+            return hash_integer_list(hash, list_expr->value.integer_list_value);
+        case AST_LIST_VALUE_STRING_LIST:
+            return hash_string_list(hash, list_expr->value.string_list_value);
+        default: abort();
+    }
+}
+
+// Only the fields that both eq_expr and expr_cmp look at
+static uint64_t hash_special_expr(uint64_t hash, const struct ast_special_expr* special_expr)
+{
+    hash = hash_combine(hash, special_expr->type);
+    switch(special_expr->type) {
+        case AST_SPECIAL_FREQUENCY:
+            hash = hash_combine(hash, special_expr->frequency.op);
+            hash = hash_combine(hash, special_expr->frequency.attr_var.var);
+            hash = hash_combine(hash, special_expr->frequency.type);
+            hash = hash_combine(hash, special_expr->frequency.ns.str);
+            hash = hash_combine(hash, (uint64_t)special_expr->frequency.value);
+            return hash_combine(hash, special_expr->frequency.length);
+        case AST_SPECIAL_SEGMENT:
+            hash = hash_combine(hash, special_expr->segment.op);
+            hash = hash_combine(hash, special_expr->segment.has_variable);
+            hash = hash_combine(hash, special_expr->segment.attr_var.var);
+            hash = hash_combine(hash, (uint64_t)special_expr->segment.segment_id);
+            return hash_combine(hash, (uint64_t)special_expr->segment.seconds);
+        case AST_SPECIAL_GEO:
+            hash = hash_combine(hash, special_expr->geo.op);
+            hash = hash_combine(hash, special_expr->geo.has_radius);
+            hash = hash_float(hash, special_expr->geo.latitude);
+            hash = hash_float(hash, special_expr->geo.longitude);
+            return hash_float(hash, special_expr->geo.radius);
+        case AST_SPECIAL_STRING:
+            hash = hash_combine(hash, special_expr->string.op);
+            hash = hash_combine(hash, special_expr->string.attr_var.var);
+            return hash_string(hash, special_expr->string.pattern);
+        default: abort();
+    }
+}
+
+uint64_t hash_expr_node(const struct ast_node* node, uint64_t lhs_hash, uint64_t rhs_hash)
+{
+    uint64_t hash = hash_mix(node->type + 1);
+    switch(node->type) {
+        case AST_TYPE_IS_NULL_EXPR:
+            // eq_expr does not look at the null check type
+            return hash_combine(hash, node->is_null_expr.attr_var.var);
+        case AST_TYPE_COMPARE_EXPR:
+            return hash_compare_expr(hash, &node->compare_expr);
+        case AST_TYPE_EQUALITY_EXPR:
+            return hash_equality_expr(hash, &node->equality_expr);
+        case AST_TYPE_BOOL_EXPR:
+            hash = hash_combine(hash, node->bool_expr.op);
+            switch(node->bool_expr.op) {
+                case AST_BOOL_OR:
+                case AST_BOOL_AND:
+                    return hash_combine(hash_combine(hash, lhs_hash), rhs_hash);
+                case AST_BOOL_NOT:
+                    return hash_combine(hash, lhs_hash);
+                case AST_BOOL_VARIABLE:
+                    return hash_combine(hash, node->bool_expr.variable.var);
+                case AST_BOOL_LITERAL:
+                    return hash_combine(hash, node->bool_expr.literal);
+                default: abort();
+            }
+        case AST_TYPE_SET_EXPR:
+            return hash_set_expr(hash, &node->set_expr);
+        case AST_TYPE_LIST_EXPR:
+            return hash_list_expr(hash, &node->list_expr);
+        case AST_TYPE_SPECIAL_EXPR:
+            return hash_special_expr(hash, &node->special_expr);
+        default: abort();
+    }
+}
+
+uint64_t hash_expr(const struct ast_node* node)
+{
+    uint64_t lhs_hash = 0;
+    uint64_t rhs_hash = 0;
+    if(node->type == AST_TYPE_BOOL_EXPR) {
+        switch(node->bool_expr.op) {
+            case AST_BOOL_OR:
+            case AST_BOOL_AND:
+                lhs_hash = hash_expr(node->bool_expr.binary.lhs);
+                rhs_hash = hash_expr(node->bool_expr.binary.rhs);
+                break;
+            case AST_BOOL_NOT:
+                lhs_hash = hash_expr(node->bool_expr.unary.expr);
+                break;
+            case AST_BOOL_VARIABLE:
+            case AST_BOOL_LITERAL:
+                break;
+            default: abort();
+        }
+    }
+    return hash_expr_node(node, lhs_hash, rhs_hash);
+}
+
 void assign_pred_id(struct config* config, struct ast_node* node)
 {
     assign_pred(config->pred_map, node);
@@ -2685,25 +2889,18 @@ static size_t get_attr_string_bound(const struct config* config, const char* att
     return SIZE_MAX;
 }
 
-static struct string_map* get_string_map_for_attr(const struct config* config, const char* attr)
+static const struct string_map* get_string_map_for_attr(const struct config* config, const char* attr)
 {
-    for(size_t i = 0; i < config->string_map_count; i++) {
-        struct string_map* string_map = &config->string_maps[i];
-        if(strcmp(attr, string_map->attr_var.attr) == 0) {
-            return string_map;
-        }
-    }
-    return NULL;
+    return get_string_map(config, try_get_id_for_attr(config, attr));
 }
 
 static bool str_valid(const struct config* config, const char* attr, const char* string)
 {
     size_t bound = get_attr_string_bound(config, attr);
-    struct string_map* string_map = get_string_map_for_attr(config, attr);
+    const struct string_map* string_map = get_string_map_for_attr(config, attr);
     size_t space_left = string_map == NULL ? bound : bound - string_map->string_value_count;
     if(string_map != NULL) {
-        betree_str_t* str = map_get(&string_map->m, string);
-        if(str != NULL) {
+        if(try_get_id_for_string(config, string_map->attr_var, string) != INVALID_STR) {
             return true;
         }
     }
@@ -2725,14 +2922,13 @@ static bool strs_valid(
     if(bound == SIZE_MAX) {
         return true;
     }
-    struct string_map* string_map = get_string_map_for_attr(config, attr);
+    const struct string_map* string_map = get_string_map_for_attr(config, attr);
     size_t space_left = string_map == NULL ? bound : bound - string_map->string_value_count;
     size_t found = 0;
     if(string_map != NULL) {
         for(size_t i = 0; i < strings->count; i++) {
             const char* string = strings->strings[i].string;
-            betree_str_t* str = map_get(&string_map->m, string);
-            if(str != NULL) {
+            if(try_get_id_for_string(config, string_map->attr_var, string) != INVALID_STR) {
                 found++;
             }
         }
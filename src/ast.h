@@ -217,6 +217,15 @@ struct ast_special_geo {
     double radius;
     struct attr_var latitude_var;
     struct attr_var longitude_var;
+    // Filled by init_geo_bounds, the terms of the distance that only depend
+    // on the center and a box, in degrees, around the circle
+    double sin_latitude;
+    double cos_latitude;
+    double min_latitude;
+    double max_latitude;
+    // Largest longitude distance from the center, infinite when the box
+    // spans every longitude
+    double longitude_delta;
 };
 
 enum ast_special_string_e {
@@ -338,6 +347,13 @@ void sort_lists(struct ast_node* node);
 const char* frequency_type_to_string(enum frequency_type_e type);
 bool eq_expr(const struct ast_node* a, const struct ast_node* b);
 bool fast_eq_expr(const struct ast_node* a, const struct ast_node* b);
+// Structural hash, nodes that are eq_expr or equal under expr_cmp hash the
+// same. Floats hash exactly, so values within DBL_EPSILON of each other
+// that eq_expr accepts can still differ
+uint64_t hash_expr(const struct ast_node* node);
+// Same hash when the hashes of the and/or/not children are already known,
+// lhs_hash is the child of a not
+uint64_t hash_expr_node(const struct ast_node* node, uint64_t lhs_hash, uint64_t rhs_hash);
 
 bool all_variables_in_config(const struct config* config, const struct ast_node* node);
 bool all_bounded_strings_valid(const struct config* config, const struct ast_node* node);
@@ -13,17 +13,15 @@
 #include "betree.h"
 #include "error.h"
 #include "hashmap.h"
+#include "pattern.h"
 #include "tree.h"
 #include "utils.h"
 #include "value.h"
 
-/*bool betree_delete(struct betree* betree, betree_sub_t id)*/
-/*{*/
-    /*struct betree_sub* sub = find_sub_id(id, betree->cnode);*/
-    /*bool found = betree_delete_inner(betree->config->attr_domain_count, (const struct attr_domain**)betree->config->attr_domains, sub, betree->cnode);*/
-    /*free_sub(sub);*/
-    /*return found;*/
-/*}*/
+bool betree_delete(struct betree* betree, betree_sub_t id)
+{
+    return betree_delete_inner(betree->config, id, betree->cnode);
+}
 
 int parse(const char* text, struct ast_node** node);
 int event_parse(const char* text, struct betree_event** event);
@@ -43,34 +41,6 @@ static bool is_valid(const struct config* config, const struct ast_node* node)
     return true;
 }
 
-/*
-bool betree_insert_all(struct betree* tree, size_t count, const char** exprs)
-{
-    // Hackish a bit for now, insert all except the last manually, then insert the last one legit
-    struct sub** subs = bcalloc(count - 1, sizeof(*subs));
-    for(size_t i = 0; i < count - 1; i++) {
-        const char* expr = exprs[i];
-        struct ast_node* node;
-        if(parse(expr, &node) != 0) {
-            fprintf(stderr, "Failed to parse id %" PRIu64 ": %s\n", i, expr);
-            abort();
-        }
-        if(!is_valid(tree->config, node)) {
-            return false;
-        }
-        assign_variable_id(tree->config, node);
-        assign_str_id(tree->config, node);
-        sort_lists(node);
-        assign_pred_id(tree->config, node);
-        struct sub* sub = make_sub(tree->config, i, node);
-        subs[i] = sub;
-    }
-    tree->cnode->lnode->sub_count = count - 1;
-    tree->cnode->lnode->subs = subs;
-    return betree_insert(tree, count - 1, exprs[count - 1]);
-}
-*/
-
 static void fix_float_with_no_fractions(struct config* config, struct ast_node* node)
 {
     switch(node->type) {
@@ -372,6 +342,27 @@ static bool get_simple_variable_bound(betree_var_t var, const struct ast_node* n
     return false;
 }
 
+static bool is_same_bound(const struct value_bound* a, const struct value_bound* b)
+{
+    switch(a->value_type) {
+        case BETREE_BOOLEAN:
+            return a->bmin == b->bmin && a->bmax == b->bmax;
+        case BETREE_INTEGER:
+        case BETREE_INTEGER_LIST:
+            return a->imin == b->imin && a->imax == b->imax;
+        case BETREE_FLOAT:
+            return feq(a->fmin, b->fmin) && feq(a->fmax, b->fmax);
+        case BETREE_STRING:
+        case BETREE_STRING_LIST:
+        case BETREE_INTEGER_ENUM:
+            return a->smin == b->smin && a->smax == b->smax;
+        case BETREE_SEGMENTS:
+        case BETREE_FREQUENCY_CAPS:
+            return true;
+        default: abort();
+    }
+}
+
 static void change_boundaries(struct config* config, const struct ast_node* node) 
 {
     // Use function to extract boundaries, THEN apply them to the config
@@ -385,6 +376,7 @@ static void change_boundaries(struct config* config, const struct ast_node* node
         if(!will_affect) {
             continue;
         }
+        struct value_bound previous = attr_domain->bound;
         switch(attr_domain->bound.value_type) {
             case BETREE_BOOLEAN:
                 attr_domain->bound.bmin = bound.bmin < attr_domain->bound.bmin ? bound.bmin : attr_domain->bound.bmin;
@@ -421,28 +413,26 @@ static void change_boundaries(struct config* config, const struct ast_node* node
                 break;
             case BETREE_STRING:
             case BETREE_STRING_LIST:
-                for(size_t j = 0; j < config->string_map_count; j++) {
-                    if(config->string_maps[j].attr_var.var == attr_domain->attr_var.var) {
-                        size_t smax = config->string_maps[j].string_value_count - 1;
-                        if(attr_domain->bound.smax < SIZE_MAX - 1) {
-                            attr_domain->bound.smax = smax > attr_domain->bound.smax ? smax : attr_domain->bound.smax;
-                        }
-                        else {
-                            attr_domain->bound.smax = smax;
-                        }
+                if(attr_domain->attr_var.var < config->string_map_count
+                    && config->string_maps[attr_domain->attr_var.var].attr_var.var != INVALID_VAR) {
+                    size_t smax = config->string_maps[attr_domain->attr_var.var].string_value_count - 1;
+                    if(attr_domain->bound.smax < SIZE_MAX - 1) {
+                        attr_domain->bound.smax = smax > attr_domain->bound.smax ? smax : attr_domain->bound.smax;
+                    }
+                    else {
+                        attr_domain->bound.smax = smax;
                     }
                 }
                 break;
             case BETREE_INTEGER_ENUM:
-                for(size_t j = 0; j < config->integer_map_count; j++) {
-                    if(config->integer_maps[j].attr_var.var == attr_domain->attr_var.var) {
-                        size_t smax = config->integer_maps[j].integer_value_count - 1;
-                        if(attr_domain->bound.smax < SIZE_MAX - 1) {
-                            attr_domain->bound.smax = smax > attr_domain->bound.smax ? smax : attr_domain->bound.smax;
-                        }
-                        else {
-                            attr_domain->bound.smax = smax;
-                        }
+                if(attr_domain->attr_var.var < config->integer_map_count
+                    && config->integer_maps[attr_domain->attr_var.var].attr_var.var != INVALID_VAR) {
+                    size_t smax = config->integer_maps[attr_domain->attr_var.var].integer_value_count - 1;
+                    if(attr_domain->bound.smax < SIZE_MAX - 1) {
+                        attr_domain->bound.smax = smax > attr_domain->bound.smax ? smax : attr_domain->bound.smax;
+                    }
+                    else {
+                        attr_domain->bound.smax = smax;
                     }
                 }
                 break;
@@ -453,6 +443,10 @@ static void change_boundaries(struct config* config, const struct ast_node* node
             default:
                 break;
         }
+        // Cached sub bounds on this attribute are now stale
+        if(!is_same_bound(&previous, &attr_domain->bound)) {
+            attr_domain->bound_version++;
+        }
     }
 }
 
@@ -472,6 +466,21 @@ bool betree_change_boundaries(struct betree* tree, const char* expr)
     return true;
 }
 
+void betree_use_bytecode(struct betree* tree, bool enabled)
+{
+    tree->config->use_bytecode = enabled;
+}
+
+void betree_use_epoch_memoize(struct betree* tree, bool enabled)
+{
+    tree->config->use_epoch_memoize = enabled;
+}
+
+void betree_use_eq_index(struct betree* tree, bool enabled)
+{
+    tree->config->use_eq_index = enabled;
+}
+
 bool betree_insert_with_constants(struct betree* tree,
     betree_sub_t id,
     size_t constant_count,
@@ -540,6 +549,19 @@ bool betree_insert_sub(struct betree* tree, const struct betree_sub* sub)
     return insert_be_tree(tree->config, sub, tree->cnode, NULL);
 }
 
+bool betree_bulk_load(struct betree* tree, size_t count, const struct betree_sub** subs)
+{
+    bool result = bulk_load_be_tree(tree->config, count, subs, tree->cnode);
+    compile_patterns(tree->config->pred_map);
+    return result;
+}
+
+void betree_freeze(struct betree* tree)
+{
+    freeze_be_tree(tree->cnode);
+    compile_patterns(tree->config->pred_map);
+}
+
 bool betree_insert(struct betree* tree, betree_sub_t id, const char* expr)
 {
     return betree_insert_with_constants(tree, id, 0, NULL, expr);
@@ -603,6 +625,96 @@ bool betree_search_with_event(const struct betree* betree, struct betree_event*
     return betree_search_with_event_filled(betree, event, report);
 }
 
+bool betree_search_batch(const struct betree* betree, struct betree_event** events, size_t count, struct report** reports)
+{
+    const struct betree_variable*** preds = bcalloc(count * sizeof(*preds));
+    if(preds == NULL) {
+        fprintf(stderr, "%s bcalloc failed\n", __func__);
+        abort();
+    }
+    bool result = true;
+    for(size_t i = 0; i < count; i++) {
+        fill_event(betree->config, events[i]);
+        sort_event_lists(events[i]);
+        preds[i] = make_environment(betree->config->attr_domain_count, events[i]);
+        if(validate_variables(betree->config, preds[i]) == false) {
+            fprintf(stderr, "Failed to validate event\n");
+            result = false;
+            break;
+        }
+    }
+    if(result) {
+        result = betree_search_batch_with_preds(betree->config, count, preds, betree->cnode, reports);
+    }
+    for(size_t i = 0; i < count; i++) {
+        bfree(preds[i]);
+    }
+    bfree(preds);
+    return result;
+}
+
+struct betree_search_context* betree_make_search_context(const struct betree* betree)
+{
+    return make_search_context(betree->config);
+}
+
+void betree_free_search_context(struct betree_search_context* context)
+{
+    free_search_context(context);
+}
+
+static void fill_context_environment(const struct betree* betree, const struct betree_event* event, struct betree_search_context* context)
+{
+    prepare_search_context(betree->config, context);
+    for(size_t i = 0; i < event->variable_count; i++) {
+        if(event->variables[i] != NULL) {
+            context->preds[event->variables[i]->attr_var.var] = event->variables[i];
+        }
+    }
+}
+
+bool betree_search_with_context(const struct betree* betree, struct betree_event* event, struct betree_search_context* context, struct report* report)
+{
+    fill_event(betree->config, event);
+    sort_event_lists(event);
+    fill_context_environment(betree, event, context);
+    if(validate_variables(betree->config, context->preds) == false) {
+        fprintf(stderr, "Failed to validate event\n");
+        return false;
+    }
+    return betree_search_with_context_preds(betree->config, betree->cnode, context, report);
+}
+
+bool betree_exists_with_context(const struct betree* betree, struct betree_event* event, struct betree_search_context* context)
+{
+    fill_event(betree->config, event);
+    sort_event_lists(event);
+    fill_context_environment(betree, event, context);
+    return betree_exists_with_context_preds(betree->config, betree->cnode, context);
+}
+
+struct betree_search_pool* betree_make_search_pool(const struct betree* betree, size_t thread_count, size_t threshold)
+{
+    return make_search_pool(betree->config, thread_count, threshold);
+}
+
+void betree_free_search_pool(struct betree_search_pool* pool)
+{
+    free_search_pool(pool);
+}
+
+bool betree_search_with_pool(const struct betree* betree, struct betree_event* event, struct betree_search_pool* pool, struct report* report)
+{
+    fill_event(betree->config, event);
+    sort_event_lists(event);
+    fill_context_environment(betree, event, pool->context);
+    if(validate_variables(betree->config, pool->context->preds) == false) {
+        fprintf(stderr, "Failed to validate event\n");
+        return false;
+    }
+    return betree_search_with_pool_preds(betree->config, betree->cnode, pool, report);
+}
+
 struct report* make_report()
 {
     struct report* report = bcalloc(sizeof(*report));
@@ -615,12 +727,35 @@ struct report* make_report()
     report->memoized = 0;
     report->shorted = 0;
     report->subs = NULL;
+    report->capacity = 0;
+    report->external = false;
+    report->dropped = 0;
     return report;
 }
 
+struct report* make_report_with_buffer(size_t capacity, betree_sub_t* subs)
+{
+    struct report* report = make_report();
+    report->subs = subs;
+    report->capacity = capacity;
+    report->external = true;
+    return report;
+}
+
+void betree_report_reset(struct report* report)
+{
+    report->evaluated = 0;
+    report->matched = 0;
+    report->memoized = 0;
+    report->shorted = 0;
+    report->dropped = 0;
+}
+
 void free_report(struct report* report)
 {
-    bfree(report->subs);
+    if(!report->external) {
+        bfree(report->subs);
+    }
     bfree(report);
 }
 
@@ -20,9 +20,16 @@ struct report {
     size_t memoized;
     size_t shorted;
     betree_sub_t* subs;
+    size_t capacity;
+    // When the buffer is supplied by the caller it is never grown, matches
+    // that do not fit are counted in dropped instead
+    bool external;
+    size_t dropped;
 };
 
 struct betree_sub;
+struct betree_search_context;
+struct betree_search_pool;
 struct betree_constant;
 struct betree_variable;
 
@@ -91,14 +98,36 @@ void betree_add_segments_variable(struct betree* betree, const char* name, bool
 void betree_add_frequency_caps_variable(struct betree* betree, const char* name, bool allow_undefined);
 
 bool betree_change_boundaries(struct betree* tree, const char* expr);
+// Subs made after this call are compiled to bytecode instead of walking the
+// AST at search time
+void betree_use_bytecode(struct betree* tree, bool enabled);
+// Search contexts and pools stamp memoize slots with an epoch instead of
+// clearing bitmaps before every search
+void betree_use_epoch_memoize(struct betree* tree, bool enabled);
+// Subs inserted after this call with a single equality, 'in' or 'one of' on
+// an integer, string, integer enum or list variable, alone or as a term of a
+// top level 'and', are kept in a hash index looked up with the event values
+// instead of in the tree
+void betree_use_eq_index(struct betree* tree, bool enabled);
 
 const struct betree_sub* betree_make_sub(struct betree* tree, betree_sub_t id, size_t constant_count, const struct betree_constant** constants, const char* expr);
 bool betree_insert_sub(struct betree* tree, const struct betree_sub* sub);
+// Builds the tree in one pass from every sub, falls back to inserting them
+// one by one when the tree is not empty. Compiles the string patterns like
+// betree_freeze
+bool betree_bulk_load(struct betree* tree, size_t count, const struct betree_sub** subs);
+// Compiles every cdir tree into a flat array searched instead of the linked
+// cdirs. Bulk loads do it on their own, a cdir added or removed afterwards
+// sends its partition back to the linked cdirs until the next call.
+// Also compiles the contains, starts_with and ends_with patterns of each
+// string attribute into a single matcher run once per event. Patterns added
+// afterwards are evaluated one by one, and removing one turns its matcher off
+// until the next call
+void betree_freeze(struct betree* tree);
 
 /*
  * Runtime
  */
-//bool betree_insert_all(struct betree* tree, size_t count, const char** exprs);
 struct betree_variable_definition betree_get_variable_definition(struct betree* betree, size_t index);
 
 struct betree_constant* betree_make_integer_constant(const char* name, int64_t integer_value);
@@ -124,9 +153,26 @@ bool betree_search_with_event(const struct betree* betree, struct betree_event*
 bool betree_exists(const struct betree* tree, const char* event_str);
 bool betree_exists_with_event(const struct betree* betree, struct betree_event* event);
 
-//bool betree_delete(struct betree* betree, betree_sub_t id);
+// Walks the tree once for every event, each sub of an lnode is evaluated for
+// all the events reaching it in a row
+bool betree_search_batch(const struct betree* betree, struct betree_event** events, size_t count, struct report** reports);
+
+struct betree_search_context* betree_make_search_context(const struct betree* betree);
+void betree_free_search_context(struct betree_search_context* context);
+bool betree_search_with_context(const struct betree* betree, struct betree_event* event, struct betree_search_context* context, struct report* report);
+bool betree_exists_with_context(const struct betree* betree, struct betree_event* event, struct betree_search_context* context);
+
+// A search pool runs one search at a time, spreading the candidate
+// evaluation over thread_count threads once there are threshold candidates
+struct betree_search_pool* betree_make_search_pool(const struct betree* betree, size_t thread_count, size_t threshold);
+void betree_free_search_pool(struct betree_search_pool* pool);
+bool betree_search_with_pool(const struct betree* betree, struct betree_event* event, struct betree_search_pool* pool, struct report* report);
+
+bool betree_delete(struct betree* betree, betree_sub_t id);
 
 struct report* make_report();
+struct report* make_report_with_buffer(size_t capacity, betree_sub_t* subs);
+void betree_report_reset(struct report* report);
 void free_report(struct report* report);
 
 /*
@@ -0,0 +1,390 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "alloc.h"
+#include "ast.h"
+#include "bytecode.h"
+#include "hashmap.h"
+#include "utils.h"
+#include "var.h"
+
+static size_t count_instructions(const struct ast_node* node)
+{
+    if(node->type != AST_TYPE_BOOL_EXPR) {
+        return 1;
+    }
+    switch(node->bool_expr.op) {
+        case AST_BOOL_LITERAL:
+        case AST_BOOL_VARIABLE:
+            return 1;
+        case AST_BOOL_NOT:
+            // MEMO_TEST, NOT, MEMO_SET
+            return 3 + count_instructions(node->bool_expr.unary.expr);
+        case AST_BOOL_AND:
+        case AST_BOOL_OR:
+            // MEMO_TEST, JUMP, MEMO_SET
+            return 3 + count_instructions(node->bool_expr.binary.lhs)
+                + count_instructions(node->bool_expr.binary.rhs);
+        default: abort();
+    }
+}
+
+struct bytecode_builder {
+    struct pred_map* pred_map;
+    struct bytecode* bytecode;
+};
+
+// Only leaves and MEMO_TEST carry a memoize id, pass NULL for the others
+static size_t emit(struct bytecode_builder* builder, enum bytecode_op_e op, const struct ast_node* memoized)
+{
+    struct bytecode* bytecode = builder->bytecode;
+    size_t index = bytecode->instruction_count;
+    struct bytecode_instruction* instruction = &bytecode->instructions[index];
+    instruction->op = op;
+    instruction->memoize_id = memoized == NULL ? INVALID_PRED : memoized->memoize_id;
+    instruction->var = INVALID_VAR;
+    instruction->jump = 0;
+    bytecode->instruction_count++;
+    // A pred only gets a memoize id once a second sub shares it, the map
+    // patches the compiled copy of the first node when that happens
+    struct pred_map* pred_map = builder->pred_map;
+    if(pred_map != NULL && memoized != NULL && memoized->memoize_id == INVALID_PRED
+        && memoized->global_id < pred_map->entry_capacity
+        && pred_map->entries[memoized->global_id].first == memoized) {
+        pred_map->entries[memoized->global_id].first_memoize_id = &instruction->memoize_id;
+    }
+    return index;
+}
+
+static enum bytecode_op_e compare_op(const struct ast_compare_expr* compare_expr)
+{
+    bool is_integer = compare_expr->value.value_type == AST_COMPARE_VALUE_INTEGER;
+    switch(compare_expr->op) {
+        case AST_COMPARE_LT:
+            return is_integer ? BYTECODE_INT_LT : BYTECODE_FLOAT_LT;
+        case AST_COMPARE_LE:
+            return is_integer ? BYTECODE_INT_LE : BYTECODE_FLOAT_LE;
+        case AST_COMPARE_GT:
+            return is_integer ? BYTECODE_INT_GT : BYTECODE_FLOAT_GT;
+        case AST_COMPARE_GE:
+            return is_integer ? BYTECODE_INT_GE : BYTECODE_FLOAT_GE;
+        default: abort();
+    }
+}
+
+static void compile_compare(struct bytecode_builder* builder, const struct ast_node* node)
+{
+    const struct ast_compare_expr* compare_expr = &node->compare_expr;
+    size_t index = emit(builder, compare_op(compare_expr), node);
+    struct bytecode_instruction* instruction = &builder->bytecode->instructions[index];
+    instruction->var = compare_expr->attr_var.var;
+    switch(compare_expr->value.value_type) {
+        case AST_COMPARE_VALUE_INTEGER:
+            instruction->integer_value = compare_expr->value.integer_value;
+            break;
+        case AST_COMPARE_VALUE_FLOAT:
+            instruction->float_value = compare_expr->value.float_value;
+            break;
+        default: abort();
+    }
+}
+
+static void compile_equality(struct bytecode_builder* builder, const struct ast_node* node)
+{
+    const struct ast_equality_expr* equality_expr = &node->equality_expr;
+    bool eq = equality_expr->op == AST_EQUALITY_EQ;
+    enum bytecode_op_e op;
+    switch(equality_expr->value.value_type) {
+        case AST_EQUALITY_VALUE_INTEGER:
+            op = eq ? BYTECODE_INT_EQ : BYTECODE_INT_NE;
+            break;
+        case AST_EQUALITY_VALUE_FLOAT:
+            op = eq ? BYTECODE_FLOAT_EQ : BYTECODE_FLOAT_NE;
+            break;
+        case AST_EQUALITY_VALUE_STRING:
+            op = eq ? BYTECODE_STR_EQ : BYTECODE_STR_NE;
+            break;
+        case AST_EQUALITY_VALUE_INTEGER_ENUM:
+            op = eq ? BYTECODE_IENUM_EQ : BYTECODE_IENUM_NE;
+            break;
+        default: abort();
+    }
+    size_t index = emit(builder, op, node);
+    struct bytecode_instruction* instruction = &builder->bytecode->instructions[index];
+    instruction->var = equality_expr->attr_var.var;
+    switch(equality_expr->value.value_type) {
+        case AST_EQUALITY_VALUE_INTEGER:
+            instruction->integer_value = equality_expr->value.integer_value;
+            break;
+        case AST_EQUALITY_VALUE_FLOAT:
+            instruction->float_value = equality_expr->value.float_value;
+            break;
+        case AST_EQUALITY_VALUE_STRING:
+            instruction->str = equality_expr->value.string_value.str;
+            break;
+        case AST_EQUALITY_VALUE_INTEGER_ENUM:
+            instruction->ienum = equality_expr->value.integer_enum_value.ienum;
+            break;
+        default: abort();
+    }
+}
+
+static void compile_node(struct bytecode_builder* builder, const struct ast_node* node);
+
+// MEMO_TEST jumps past MEMO_SET on a hit, the short-circuit jumps land on
+// MEMO_SET so the result of the whole node is stored under the MEMO_TEST id
+static void compile_bool(struct bytecode_builder* builder, const struct ast_node* node)
+{
+    const struct ast_bool_expr* bool_expr = &node->bool_expr;
+    struct bytecode_instruction* instructions = builder->bytecode->instructions;
+    switch(bool_expr->op) {
+        case AST_BOOL_LITERAL: {
+            size_t index = emit(builder, BYTECODE_LITERAL, node);
+            instructions[index].literal = bool_expr->literal;
+            return;
+        }
+        case AST_BOOL_VARIABLE: {
+            size_t index = emit(builder, BYTECODE_BOOL_VAR, node);
+            instructions[index].var = bool_expr->variable.var;
+            return;
+        }
+        case AST_BOOL_NOT: {
+            size_t test_index = emit(builder, BYTECODE_MEMO_TEST, node);
+            compile_node(builder, bool_expr->unary.expr);
+            emit(builder, BYTECODE_NOT, NULL);
+            size_t set_index = emit(builder, BYTECODE_MEMO_SET, NULL);
+            instructions[set_index].jump = test_index;
+            instructions[test_index].jump = set_index + 1;
+            return;
+        }
+        case AST_BOOL_AND:
+        case AST_BOOL_OR: {
+            size_t test_index = emit(builder, BYTECODE_MEMO_TEST, node);
+            compile_node(builder, bool_expr->binary.lhs);
+            size_t jump_index = emit(builder,
+                bool_expr->op == AST_BOOL_AND ? BYTECODE_JUMP_IF_FALSE : BYTECODE_JUMP_IF_TRUE,
+                NULL);
+            compile_node(builder, bool_expr->binary.rhs);
+            size_t set_index = emit(builder, BYTECODE_MEMO_SET, NULL);
+            instructions[set_index].jump = test_index;
+            instructions[jump_index].jump = set_index;
+            instructions[test_index].jump = set_index + 1;
+            return;
+        }
+        default: abort();
+    }
+}
+
+static void compile_node(struct bytecode_builder* builder, const struct ast_node* node)
+{
+    switch(node->type) {
+        case AST_TYPE_COMPARE_EXPR:
+            compile_compare(builder, node);
+            return;
+        case AST_TYPE_EQUALITY_EXPR:
+            compile_equality(builder, node);
+            return;
+        case AST_TYPE_BOOL_EXPR:
+            compile_bool(builder, node);
+            return;
+        case AST_TYPE_SET_EXPR:
+        case AST_TYPE_LIST_EXPR:
+        case AST_TYPE_SPECIAL_EXPR:
+        case AST_TYPE_IS_NULL_EXPR: {
+            // match_node memoizes the node itself
+            size_t index = emit(builder, BYTECODE_NODE, NULL);
+            builder->bytecode->instructions[index].node = node;
+            return;
+        }
+        default: abort();
+    }
+}
+
+struct bytecode* compile_bytecode(struct pred_map* pred_map, const struct ast_node* node)
+{
+    struct bytecode* bytecode = bcalloc(sizeof(*bytecode));
+    if(bytecode == NULL) {
+        fprintf(stderr, "%s bcalloc failed\n", __func__);
+        abort();
+    }
+    // Sized up front, the pred map keeps pointers into the instructions
+    size_t count = count_instructions(node);
+    bytecode->instruction_count = 0;
+    bytecode->instructions = bcalloc(count * sizeof(*bytecode->instructions));
+    if(bytecode->instructions == NULL) {
+        fprintf(stderr, "%s bcalloc failed\n", __func__);
+        abort();
+    }
+    struct bytecode_builder builder = { .pred_map = pred_map, .bytecode = bytecode };
+    compile_node(&builder, node);
+    return bytecode;
+}
+
+void free_bytecode(struct bytecode* bytecode)
+{
+    if(bytecode == NULL) {
+        return;
+    }
+    bfree(bytecode->instructions);
+    bfree(bytecode);
+}
+
+static bool test_memoize(betree_pred_t memoize_id, const struct memoize* memoize, struct report* report, bool* result)
+{
+    if(memoize_id == INVALID_PRED || !get_memoize(memoize, memoize_id, result)) {
+        return false;
+    }
+    if(report != NULL) {
+        report->memoized++;
+    }
+    return true;
+}
+
+static void store_memoize(betree_pred_t memoize_id, struct memoize* memoize, bool result)
+{
+    if(memoize_id != INVALID_PRED) {
+        set_memoize(memoize, memoize_id, result);
+    }
+}
+
+static bool match_leaf(const struct bytecode_instruction* instruction, const struct betree_variable** preds)
+{
+    int64_t integer_value;
+    double float_value;
+    struct string_value string_value;
+    struct integer_enum_value integer_enum_value;
+    bool bool_value;
+    switch(instruction->op) {
+        case BYTECODE_INT_LT:
+            return get_integer_var(instruction->var, preds, &integer_value)
+                && integer_value < instruction->integer_value;
+        case BYTECODE_INT_LE:
+            return get_integer_var(instruction->var, preds, &integer_value)
+                && integer_value <= instruction->integer_value;
+        case BYTECODE_INT_GT:
+            return get_integer_var(instruction->var, preds, &integer_value)
+                && integer_value > instruction->integer_value;
+        case BYTECODE_INT_GE:
+            return get_integer_var(instruction->var, preds, &integer_value)
+                && integer_value >= instruction->integer_value;
+        case BYTECODE_INT_EQ:
+            return get_integer_var(instruction->var, preds, &integer_value)
+                && integer_value == instruction->integer_value;
+        case BYTECODE_INT_NE:
+            return get_integer_var(instruction->var, preds, &integer_value)
+                && integer_value != instruction->integer_value;
+        case BYTECODE_FLOAT_LT:
+            return get_float_var(instruction->var, preds, &float_value)
+                && float_value < instruction->float_value;
+        case BYTECODE_FLOAT_LE:
+            return get_float_var(instruction->var, preds, &float_value)
+                && float_value <= instruction->float_value;
+        case BYTECODE_FLOAT_GT:
+            return get_float_var(instruction->var, preds, &float_value)
+                && float_value > instruction->float_value;
+        case BYTECODE_FLOAT_GE:
+            return get_float_var(instruction->var, preds, &float_value)
+                && float_value >= instruction->float_value;
+        case BYTECODE_FLOAT_EQ:
+            return get_float_var(instruction->var, preds, &float_value)
+                && feq(float_value, instruction->float_value);
+        case BYTECODE_FLOAT_NE:
+            return get_float_var(instruction->var, preds, &float_value)
+                && fne(float_value, instruction->float_value);
+        case BYTECODE_STR_EQ:
+            return get_string_var(instruction->var, preds, &string_value)
+                && string_value.str == instruction->str;
+        case BYTECODE_STR_NE:
+            return get_string_var(instruction->var, preds, &string_value)
+                && string_value.str != instruction->str;
+        case BYTECODE_IENUM_EQ:
+            return get_integer_enum_var(instruction->var, preds, &integer_enum_value)
+                && integer_enum_value.ienum == instruction->ienum;
+        case BYTECODE_IENUM_NE:
+            return get_integer_enum_var(instruction->var, preds, &integer_enum_value)
+                && integer_enum_value.ienum != instruction->ienum;
+        case BYTECODE_BOOL_VAR:
+            return get_bool_var(instruction->var, preds, &bool_value) && bool_value;
+        case BYTECODE_LITERAL:
+            return instruction->literal;
+        case BYTECODE_NODE:
+        case BYTECODE_NOT:
+        case BYTECODE_JUMP_IF_FALSE:
+        case BYTECODE_JUMP_IF_TRUE:
+        case BYTECODE_MEMO_TEST:
+        case BYTECODE_MEMO_SET:
+        default: abort();
+    }
+}
+
+bool match_bytecode(const struct betree_variable** preds,
+    const struct bytecode* bytecode,
+    struct memoize* memoize,
+    struct report* report)
+{
+    const struct bytecode_instruction* instructions = bytecode->instructions;
+    size_t count = bytecode->instruction_count;
+    bool result = false;
+    size_t pc = 0;
+    while(pc < count) {
+        const struct bytecode_instruction* instruction = &instructions[pc];
+        switch(instruction->op) {
+            case BYTECODE_JUMP_IF_FALSE:
+                if(!result) {
+                    pc = instruction->jump;
+                    continue;
+                }
+                break;
+            case BYTECODE_JUMP_IF_TRUE:
+                if(result) {
+                    pc = instruction->jump;
+                    continue;
+                }
+                break;
+            case BYTECODE_NOT:
+                result = !result;
+                break;
+            case BYTECODE_MEMO_TEST:
+                if(test_memoize(instruction->memoize_id, memoize, report, &result)) {
+                    pc = instruction->jump;
+                    continue;
+                }
+                break;
+            case BYTECODE_MEMO_SET:
+                store_memoize(instructions[instruction->jump].memoize_id, memoize, result);
+                break;
+            case BYTECODE_NODE:
+                result = match_node(preds, instruction->node, memoize, report);
+                break;
+            case BYTECODE_INT_LT:
+            case BYTECODE_INT_LE:
+            case BYTECODE_INT_GT:
+            case BYTECODE_INT_GE:
+            case BYTECODE_INT_EQ:
+            case BYTECODE_INT_NE:
+            case BYTECODE_FLOAT_LT:
+            case BYTECODE_FLOAT_LE:
+            case BYTECODE_FLOAT_GT:
+            case BYTECODE_FLOAT_GE:
+            case BYTECODE_FLOAT_EQ:
+            case BYTECODE_FLOAT_NE:
+            case BYTECODE_STR_EQ:
+            case BYTECODE_STR_NE:
+            case BYTECODE_IENUM_EQ:
+            case BYTECODE_IENUM_NE:
+            case BYTECODE_BOOL_VAR:
+            case BYTECODE_LITERAL:
+                if(!test_memoize(instruction->memoize_id, memoize, report, &result)) {
+                    result = match_leaf(instruction, preds);
+                    store_memoize(instruction->memoize_id, memoize, result);
+                }
+                break;
+            default: abort();
+        }
+        pc++;
+    }
+    return result;
+}
+
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "betree.h"
+#include "memoize.h"
+#include "value.h"
+
+// Typed opcodes for the common leaves, everything else is handed back to
+// match_node. The result of the last instruction is kept in a single
+// register that the jumps test.
+enum bytecode_op_e {
+    BYTECODE_INT_LT,
+    BYTECODE_INT_LE,
+    BYTECODE_INT_GT,
+    BYTECODE_INT_GE,
+    BYTECODE_INT_EQ,
+    BYTECODE_INT_NE,
+    BYTECODE_FLOAT_LT,
+    BYTECODE_FLOAT_LE,
+    BYTECODE_FLOAT_GT,
+    BYTECODE_FLOAT_GE,
+    BYTECODE_FLOAT_EQ,
+    BYTECODE_FLOAT_NE,
+    BYTECODE_STR_EQ,
+    BYTECODE_STR_NE,
+    BYTECODE_IENUM_EQ,
+    BYTECODE_IENUM_NE,
+    BYTECODE_BOOL_VAR,
+    BYTECODE_LITERAL,
+    BYTECODE_NODE,
+    BYTECODE_NOT,
+    BYTECODE_JUMP_IF_FALSE,
+    BYTECODE_JUMP_IF_TRUE,
+    BYTECODE_MEMO_TEST,
+    BYTECODE_MEMO_SET,
+};
+
+struct ast_node;
+struct betree_variable;
+struct pred_map;
+
+struct bytecode_instruction {
+    enum bytecode_op_e op;
+    // Patched by the pred map when the pred becomes shared
+    betree_pred_t memoize_id;
+    betree_var_t var;
+    union {
+        int64_t integer_value;
+        double float_value;
+        betree_str_t str;
+        betree_ienum_t ienum;
+        bool literal;
+        // MEMO_SET points back to its MEMO_TEST
+        size_t jump;
+        const struct ast_node* node;
+    };
+};
+
+struct bytecode {
+    size_t instruction_count;
+    struct bytecode_instruction* instructions;
+};
+
+struct bytecode* compile_bytecode(struct pred_map* pred_map, const struct ast_node* node);
+void free_bytecode(struct bytecode* bytecode);
+
+bool match_bytecode(const struct betree_variable** preds,
+    const struct bytecode* bytecode,
+    struct memoize* memoize,
+    struct report* report);
+
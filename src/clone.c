@@ -3,6 +3,7 @@
 #include "alloc.h"
 #include "ast.h"
 #include "clone.h"
+#include "special.h"
 #include "utils.h"
 
 static struct attr_var clone_attr_var(struct attr_var orig)
@@ -236,6 +237,7 @@ static struct ast_node* clone_special(betree_pred_t global_id, betree_pred_t mem
             clone->special_expr.geo.longitude = orig.geo.longitude;
             clone->special_expr.geo.op = orig.geo.op;
             clone->special_expr.geo.radius = orig.geo.radius;
+            init_geo_bounds(&clone->special_expr.geo);
             break;
         case AST_SPECIAL_STRING:
             clone->special_expr.string.attr_var = clone_attr_var(orig.string.attr_var);
@@ -1,3 +1,4 @@
+#include <ctype.h>
 #include <float.h>
 #include <stdio.h>
 #include <string.h>
@@ -18,12 +19,17 @@ struct config* make_config(uint8_t lnode_max_cap, uint8_t partition_min_size)
     }
     config->attr_domain_count = 0;
     config->attr_domains = NULL;
+    config->attr_slot_count = 0;
+    config->attr_slots = NULL;
     config->lnode_max_cap = lnode_max_cap;
     config->partition_min_size = partition_min_size;
     config->max_domain_for_split = 1000;
     config->string_map_count = 0;
     config->string_maps = NULL;
     config->pred_map = make_pred_map();
+    config->use_bytecode = false;
+    config->use_epoch_memoize = false;
+    config->use_eq_index = false;
     return config;
 }
 
@@ -45,18 +51,26 @@ void free_config(struct config* config)
         bfree(config->attr_domains);
         config->attr_domains = NULL;
     }
+    bfree(config->attr_slots);
+    config->attr_slots = NULL;
     if(config->integer_maps != NULL) {
         for(size_t i = 0; i < config->integer_map_count; i++) {
             bfree((char*)config->integer_maps[i].attr_var.attr);
             bfree(config->integer_maps[i].integer_values);
+            bfree(config->integer_maps[i].slots);
         }
         bfree(config->integer_maps);
         config->integer_maps = NULL;
     }
     if(config->string_maps != NULL) {
         for(size_t i = 0; i < config->string_map_count; i++) {
-            bfree((char*)config->string_maps[i].attr_var.attr);
-            map_deinit(&config->string_maps[i].m);
+            struct string_map* string_map = &config->string_maps[i];
+            bfree((char*)string_map->attr_var.attr);
+            for(size_t j = 0; j < string_map->string_value_count; j++) {
+                bfree(string_map->string_values[j]);
+            }
+            bfree(string_map->string_values);
+            bfree(string_map->slots);
         }
         bfree(config->string_maps);
         config->string_maps = NULL;
@@ -79,10 +93,100 @@ static struct attr_domain* make_attr_domain(
     attr_domain->attr_var.attr = bstrdup(attr);
     attr_domain->attr_var.var = variable_id;
     attr_domain->bound = bound;
+    attr_domain->bound_version = 1;
     attr_domain->allow_undefined = allow_undefined;
     return attr_domain;
 }
 
+static uint64_t hash_attr(const char* attr)
+{
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for(const char* c = attr; *c != '\0'; c++) {
+        hash = (hash ^ (uint8_t)tolower((unsigned char)*c)) * 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+// Stored names are compared as is, the looked up name is folded
+static bool attr_equal(const char* stored, const char* attr)
+{
+    for(; *attr != '\0'; stored++, attr++) {
+        if(*stored != (char)tolower((unsigned char)*attr)) {
+            return false;
+        }
+    }
+    return *stored == '\0';
+}
+
+static void insert_attr_slot(betree_var_t* slots, size_t slot_count, uint64_t hash, betree_var_t variable_id)
+{
+    size_t mask = slot_count - 1;
+    size_t slot = hash & mask;
+    while(slots[slot] != INVALID_VAR) {
+        slot = (slot + 1) & mask;
+    }
+    slots[slot] = variable_id;
+}
+
+static void grow_attr_slots(struct config* config)
+{
+    size_t slot_count = config->attr_slot_count == 0 ? 64 : config->attr_slot_count * 2;
+    betree_var_t* slots = bmalloc(sizeof(*slots) * slot_count);
+    if(slots == NULL) {
+        fprintf(stderr, "%s bmalloc failed\n", __func__);
+        abort();
+    }
+    for(size_t i = 0; i < slot_count; i++) {
+        slots[i] = INVALID_VAR;
+    }
+    for(size_t i = 0; i < config->attr_slot_count; i++) {
+        betree_var_t variable_id = config->attr_slots[i];
+        if(variable_id != INVALID_VAR) {
+            uint64_t hash = hash_attr(config->attr_domains[variable_id]->attr_var.attr);
+            insert_attr_slot(slots, slot_count, hash, variable_id);
+        }
+    }
+    bfree(config->attr_slots);
+    config->attr_slots = slots;
+    config->attr_slot_count = slot_count;
+}
+
+static betree_var_t find_attr(const struct config* config, uint64_t hash, const char* attr)
+{
+    if(config->attr_slot_count == 0) {
+        return INVALID_VAR;
+    }
+    size_t mask = config->attr_slot_count - 1;
+    size_t slot = hash & mask;
+    while(config->attr_slots[slot] != INVALID_VAR) {
+        betree_var_t variable_id = config->attr_slots[slot];
+        if(attr_equal(config->attr_domains[variable_id]->attr_var.attr, attr)) {
+            return variable_id;
+        }
+        slot = (slot + 1) & mask;
+    }
+    return INVALID_VAR;
+}
+
+static void index_attr(struct config* config, betree_var_t variable_id)
+{
+    const char* attr = config->attr_domains[variable_id]->attr_var.attr;
+    uint64_t hash = hash_attr(attr);
+    // A duplicated name keeps resolving to its first domain
+    if(find_attr(config, hash, attr) != INVALID_VAR) {
+        return;
+    }
+    if(config->attr_domain_count * 2 > config->attr_slot_count) {
+        grow_attr_slots(config);
+    }
+    insert_attr_slot(config->attr_slots, config->attr_slot_count, hash, variable_id);
+}
+
+betree_var_t try_get_id_for_attr(const struct config* config, const char* attr)
+{
+    return find_attr(config, hash_attr(attr), attr);
+}
+
 static void add_attr_domain(
     struct config* config, const char* attr, struct value_bound bound, bool allow_undefined)
 {
@@ -106,6 +210,7 @@ static void add_attr_domain(
     }
     config->attr_domains[config->attr_domain_count] = attr_domain;
     config->attr_domain_count++;
+    index_attr(config, variable_id);
 }
 
 void add_attr_domain_bounded_i(
@@ -204,53 +309,193 @@ const struct attr_domain* get_attr_domain(
     return attr_domains[variable_id];
 }
 
-static void add_integer_map(struct attr_var attr_var, struct config* config)
+static struct integer_map* add_integer_map(struct attr_var attr_var, struct config* config)
 {
-    if(config->integer_map_count == 0) {
-        config->integer_maps = bcalloc(sizeof(*config->integer_maps));
-        if(config->integer_maps == NULL) {
-            fprintf(stderr, "%s bcalloc failed\n", __func__);
-            abort();
-        }
-    }
-    else {
+    if(attr_var.var >= config->integer_map_count) {
+        size_t integer_map_count = attr_var.var + 1;
         struct integer_map* integer_maps
-            = brealloc(config->integer_maps, sizeof(*integer_maps) * (config->integer_map_count + 1));
+            = brealloc(config->integer_maps, sizeof(*integer_maps) * integer_map_count);
         if(integer_maps == NULL) {
             fprintf(stderr, "%s brealloc failed\n", __func__);
             abort();
         }
+        for(size_t i = config->integer_map_count; i < integer_map_count; i++) {
+            integer_maps[i].attr_var.attr = NULL;
+            integer_maps[i].attr_var.var = INVALID_VAR;
+            integer_maps[i].integer_value_count = 0;
+            integer_maps[i].integer_values = NULL;
+            integer_maps[i].slot_count = 0;
+            integer_maps[i].slots = NULL;
+        }
         config->integer_maps = integer_maps;
+        config->integer_map_count = integer_map_count;
     }
-    config->integer_maps[config->integer_map_count].attr_var.attr = bstrdup(attr_var.attr);
-    config->integer_maps[config->integer_map_count].attr_var.var = attr_var.var;
-    config->integer_maps[config->integer_map_count].integer_value_count = 0;
-    config->integer_maps[config->integer_map_count].integer_values = 0;
-    config->integer_map_count++;
+    struct integer_map* integer_map = &config->integer_maps[attr_var.var];
+    integer_map->attr_var.attr = bstrdup(attr_var.attr);
+    integer_map->attr_var.var = attr_var.var;
+    return integer_map;
 }
 
-static void add_string_map(struct attr_var attr_var, struct config* config)
+static struct integer_map* get_integer_map(const struct config* config, betree_var_t variable_id)
 {
-    if(config->string_map_count == 0) {
-        config->string_maps = bcalloc(sizeof(*config->string_maps));
-        if(config->string_maps == NULL) {
-            fprintf(stderr, "%s bcalloc failed\n", __func__);
-            abort();
+    if(variable_id >= config->integer_map_count) {
+        return NULL;
+    }
+    struct integer_map* integer_map = &config->integer_maps[variable_id];
+    return integer_map->attr_var.var == INVALID_VAR ? NULL : integer_map;
+}
+
+static uint64_t mix_hash(uint64_t hash)
+{
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdULL;
+    hash ^= hash >> 33;
+    hash *= 0xc4ceb9fe1a85ec53ULL;
+    hash ^= hash >> 33;
+    return hash;
+}
+
+static void insert_integer_slot(betree_ienum_t* slots, size_t slot_count, int64_t integer, betree_ienum_t ienum)
+{
+    size_t mask = slot_count - 1;
+    size_t slot = mix_hash((uint64_t)integer) & mask;
+    while(slots[slot] != INVALID_IENUM) {
+        slot = (slot + 1) & mask;
+    }
+    slots[slot] = ienum;
+}
+
+static void grow_integer_slots(struct integer_map* integer_map)
+{
+    size_t slot_count = integer_map->slot_count == 0 ? 16 : integer_map->slot_count * 2;
+    betree_ienum_t* slots = bmalloc(sizeof(*slots) * slot_count);
+    if(slots == NULL) {
+        fprintf(stderr, "%s bmalloc failed\n", __func__);
+        abort();
+    }
+    for(size_t i = 0; i < slot_count; i++) {
+        slots[i] = INVALID_IENUM;
+    }
+    for(size_t i = 0; i < integer_map->integer_value_count; i++) {
+        insert_integer_slot(slots, slot_count, integer_map->integer_values[i], i);
+    }
+    bfree(integer_map->slots);
+    integer_map->slots = slots;
+    integer_map->slot_count = slot_count;
+}
+
+static betree_ienum_t find_integer(const struct integer_map* integer_map, int64_t integer)
+{
+    if(integer_map->slot_count == 0) {
+        return INVALID_IENUM;
+    }
+    size_t mask = integer_map->slot_count - 1;
+    size_t slot = mix_hash((uint64_t)integer) & mask;
+    while(integer_map->slots[slot] != INVALID_IENUM) {
+        betree_ienum_t ienum = integer_map->slots[slot];
+        if(integer_map->integer_values[ienum] == integer) {
+            return ienum;
         }
+        slot = (slot + 1) & mask;
     }
-    else {
+    return INVALID_IENUM;
+}
+
+static struct string_map* add_string_map(struct attr_var attr_var, struct config* config)
+{
+    if(attr_var.var >= config->string_map_count) {
+        size_t string_map_count = attr_var.var + 1;
         struct string_map* string_maps
-            = brealloc(config->string_maps, sizeof(*string_maps) * (config->string_map_count + 1));
+            = brealloc(config->string_maps, sizeof(*string_maps) * string_map_count);
         if(string_maps == NULL) {
             fprintf(stderr, "%s brealloc failed\n", __func__);
             abort();
         }
+        for(size_t i = config->string_map_count; i < string_map_count; i++) {
+            string_maps[i].attr_var.attr = NULL;
+            string_maps[i].attr_var.var = INVALID_VAR;
+            string_maps[i].string_value_count = 0;
+            string_maps[i].string_values = NULL;
+            string_maps[i].slot_count = 0;
+            string_maps[i].slots = NULL;
+        }
         config->string_maps = string_maps;
+        config->string_map_count = string_map_count;
+    }
+    struct string_map* string_map = &config->string_maps[attr_var.var];
+    string_map->attr_var.attr = bstrdup(attr_var.attr);
+    string_map->attr_var.var = attr_var.var;
+    return string_map;
+}
+
+const struct string_map* get_string_map(const struct config* config, betree_var_t variable_id)
+{
+    if(variable_id >= config->string_map_count) {
+        return NULL;
+    }
+    const struct string_map* string_map = &config->string_maps[variable_id];
+    return string_map->attr_var.var == INVALID_VAR ? NULL : string_map;
+}
+
+static uint64_t hash_string(const char* string)
+{
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for(const char* c = string; *c != '\0'; c++) {
+        hash = (hash ^ (uint8_t)*c) * 0x100000001b3ULL;
+    }
+    return mix_hash(hash);
+}
+
+static void insert_string_slot(struct string_slot* slots, size_t slot_count, uint64_t hash, betree_str_t str)
+{
+    size_t mask = slot_count - 1;
+    size_t slot = hash & mask;
+    while(slots[slot].str != INVALID_STR) {
+        slot = (slot + 1) & mask;
+    }
+    slots[slot].hash = hash;
+    slots[slot].str = str;
+}
+
+static void grow_string_slots(struct string_map* string_map)
+{
+    size_t slot_count = string_map->slot_count == 0 ? 16 : string_map->slot_count * 2;
+    struct string_slot* slots = bmalloc(sizeof(*slots) * slot_count);
+    if(slots == NULL) {
+        fprintf(stderr, "%s bmalloc failed\n", __func__);
+        abort();
     }
-    config->string_maps[config->string_map_count].attr_var.attr = bstrdup(attr_var.attr);
-    config->string_maps[config->string_map_count].attr_var.var = attr_var.var;
-    config->string_maps[config->string_map_count].string_value_count = 0;
-    config->string_map_count++;
+    for(size_t i = 0; i < slot_count; i++) {
+        slots[i].hash = 0;
+        slots[i].str = INVALID_STR;
+    }
+    for(size_t i = 0; i < string_map->slot_count; i++) {
+        if(string_map->slots[i].str != INVALID_STR) {
+            insert_string_slot(slots, slot_count, string_map->slots[i].hash, string_map->slots[i].str);
+        }
+    }
+    bfree(string_map->slots);
+    string_map->slots = slots;
+    string_map->slot_count = slot_count;
+}
+
+static betree_str_t find_string(const struct string_map* string_map, uint64_t hash, const char* string)
+{
+    if(string_map->slot_count == 0) {
+        return INVALID_STR;
+    }
+    size_t mask = string_map->slot_count - 1;
+    size_t slot = hash & mask;
+    while(string_map->slots[slot].str != INVALID_STR) {
+        if(string_map->slots[slot].hash == hash) {
+            betree_str_t str = string_map->slots[slot].str;
+            if(strcmp(string_map->string_values[str], string) == 0) {
+                return str;
+            }
+        }
+        slot = (slot + 1) & mask;
+    }
+    return INVALID_STR;
 }
 
 static void add_to_integer_map(struct integer_map* integer_map, int64_t integer)
@@ -273,67 +518,66 @@ static void add_to_integer_map(struct integer_map* integer_map, int64_t integer)
     }
     integer_map->integer_values[integer_map->integer_value_count] = integer;
     integer_map->integer_value_count++;
+    if(integer_map->integer_value_count * 2 > integer_map->slot_count) {
+        grow_integer_slots(integer_map);
+    }
+    else {
+        insert_integer_slot(integer_map->slots,
+            integer_map->slot_count,
+            integer,
+            integer_map->integer_value_count - 1);
+    }
 }
 
-static void add_to_string_map(struct string_map* string_map, const char* string)
+static void add_to_string_map(struct string_map* string_map, uint64_t hash, const char* string)
 {
-    if(string_map->string_value_count == 0) {
-        map_init(&string_map->m);
+    char** string_values = brealloc(string_map->string_values,
+        sizeof(*string_values) * (string_map->string_value_count + 1));
+    if(string_values == NULL) {
+        fprintf(stderr, "%s brealloc failed\n", __func__);
+        abort();
     }
-    map_set(&string_map->m, string, string_map->string_value_count);
+    string_map->string_values = string_values;
+    string_map->string_values[string_map->string_value_count] = bstrdup(string);
     string_map->string_value_count++;
+    if(string_map->string_value_count * 2 > string_map->slot_count) {
+        grow_string_slots(string_map);
+    }
+    insert_string_slot(
+        string_map->slots, string_map->slot_count, hash, string_map->string_value_count - 1);
 }
 
 betree_ienum_t try_get_id_for_ienum(
     const struct config* config, struct attr_var attr_var, int64_t integer)
 {
-    for(size_t i = 0; i < config->integer_map_count; i++) {
-        if(config->integer_maps[i].attr_var.var == attr_var.var) {
-            struct integer_map* integer_map = integer_map = &config->integer_maps[i];
-            for(size_t j = 0; j < integer_map->integer_value_count; j++) {
-                if(integer_map->integer_values[j] == integer) {
-                    return j;
-                }
-            }
-            break;
-        }
+    const struct integer_map* integer_map = get_integer_map(config, attr_var.var);
+    if(integer_map == NULL) {
+        return INVALID_IENUM;
     }
-    return INVALID_IENUM;
+    return find_integer(integer_map, integer);
 }
 
 betree_str_t try_get_id_for_string(
     const struct config* config, struct attr_var attr_var, const char* string)
 {
-    for(size_t i = 0; i < config->string_map_count; i++) {
-        if(config->string_maps[i].attr_var.var == attr_var.var) {
-            struct string_map* string_map = string_map = &config->string_maps[i];
-            betree_str_t* str = map_get(&string_map->m, string);
-            if(str != NULL) {
-                return *str;
-            }
-            break;
-        }
+    const struct string_map* string_map = get_string_map(config, attr_var.var);
+    if(string_map == NULL) {
+        return INVALID_STR;
     }
-    return INVALID_STR;
+    return find_string(string_map, hash_string(string), string);
 }
 
 betree_ienum_t get_id_for_ienum(struct config* config, struct attr_var attr_var, int64_t integer, bool always_assign)
 {
-    struct integer_map* integer_map = NULL;
-    for(size_t i = 0; i < config->integer_map_count; i++) {
-        if(config->integer_maps[i].attr_var.var == attr_var.var) {
-            integer_map = &config->integer_maps[i];
-            for(size_t j = 0; j < integer_map->integer_value_count; j++) {
-                if(integer_map->integer_values[j] == integer) {
-                    return j;
-                }
-            }
-            break;
-        }
-    }
+    struct integer_map* integer_map = get_integer_map(config, attr_var.var);
     if(integer_map == NULL) {
-        add_integer_map(attr_var, config);
-        integer_map = &config->integer_maps[config->integer_map_count - 1];
+        integer_map = add_integer_map(attr_var, config);
+    }
+    else {
+        betree_ienum_t ienum = find_integer(integer_map, integer);
+        if(ienum != INVALID_IENUM) {
+            return ienum;
+        }
     }
     const struct attr_domain* attr_domain
         = get_attr_domain((const struct attr_domain**)config->attr_domains, attr_var.var);
@@ -346,27 +590,23 @@ betree_ienum_t get_id_for_ienum(struct config* config, struct attr_var attr_var,
 
 betree_str_t get_id_for_string(struct config* config, struct attr_var attr_var, const char* string, bool always_assign)
 {
-    struct string_map* string_map = NULL;
-    for(size_t i = 0; i < config->string_map_count; i++) {
-        if(config->string_maps[i].attr_var.var == attr_var.var) {
-            string_map = &config->string_maps[i];
-            betree_str_t* str = map_get(&string_map->m, string);
-            if(str != NULL) {
-                return *str;
-            }
-            break;
-        }
-    }
+    uint64_t hash = hash_string(string);
+    struct string_map* string_map = (struct string_map*)get_string_map(config, attr_var.var);
     if(string_map == NULL) {
-        add_string_map(attr_var, config);
-        string_map = &config->string_maps[config->string_map_count - 1];
+        string_map = add_string_map(attr_var, config);
+    }
+    else {
+        betree_str_t str = find_string(string_map, hash, string);
+        if(str != INVALID_STR) {
+            return str;
+        }
     }
     const struct attr_domain* attr_domain
         = get_attr_domain((const struct attr_domain**)config->attr_domains, attr_var.var);
     if(!always_assign && attr_domain->bound.smax + 1 == string_map->string_value_count) {
         return INVALID_STR;
     }
-    add_to_string_map(string_map, string);
+    add_to_string_map(string_map, hash, string);
     return string_map->string_value_count - 1;
 }
 
@@ -5,32 +5,50 @@
 #include <stddef.h>
 
 #include "config.h"
-#include "map.h"
 #include "var.h"
 
 struct attr_domain {
     struct attr_var attr_var;
     struct value_bound bound;
+    // Bumped every time bound changes, starts at 1
+    uint64_t bound_version;
     bool allow_undefined;
 };
 
 struct ast_node;
 struct pred_map;
 
-typedef map_t(betree_str_t) str_map_t;
+struct string_slot {
+    uint64_t hash;
+    betree_str_t str;
+};
 
+// attr_var.var is INVALID_VAR until the variable gets its first value
 struct string_map {
     struct attr_var attr_var;
-    size_t string_value_count;
-    str_map_t m;
+    struct {
+        size_t string_value_count;
+        char** string_values;
+    };
+    // Open addressing index from string to its id, hashes are kept in the slots
+    struct {
+        size_t slot_count;
+        struct string_slot* slots;
+    };
 };
 
+// attr_var.var is INVALID_VAR until the variable gets its first value
 struct integer_map {
     struct attr_var attr_var;
     struct {
         size_t integer_value_count;
         int64_t* integer_values;
     };
+    // Open addressing index from integer to its position in integer_values
+    struct {
+        size_t slot_count;
+        betree_ienum_t* slots;
+    };
 };
 
 struct config* make_config(uint8_t lnode_max_cap, uint8_t partition_min_size);
@@ -45,15 +63,28 @@ struct config {
         size_t attr_domain_count;
         struct attr_domain** attr_domains;
     };
+    // Open addressing index from case folded attribute name to variable id
+    struct {
+        size_t attr_slot_count;
+        betree_var_t* attr_slots;
+    };
+    // Indexed by variable id
     struct {
         size_t string_map_count;
         struct string_map* string_maps;
     };
+    // Indexed by variable id
     struct {
         size_t integer_map_count;
         struct integer_map* integer_maps;
     };
     struct pred_map* pred_map;
+    // Compile sub expressions to bytecode when they are made
+    bool use_bytecode;
+    // Search contexts and pools clear memoize by bumping an epoch
+    bool use_epoch_memoize;
+    // Subs with an equality, 'in' or 'one of' term go to the index of the root
+    bool use_eq_index;
 };
 
 void add_attr_domain_i(struct config* config, const char* attr, bool allow_undefined);
@@ -81,6 +112,7 @@ betree_ienum_t try_get_id_for_ienum(const struct config* config, struct attr_var
 betree_str_t try_get_id_for_string(const struct config* config, struct attr_var attr_var, const char* string);
 betree_ienum_t get_id_for_ienum(struct config* config, struct attr_var attr_var, int64_t integer, bool always_assign);
 betree_str_t get_id_for_string(struct config* config, struct attr_var attr_var, const char* string, bool always_assign);
+const struct string_map* get_string_map(const struct config* config, betree_var_t variable_id);
 
 struct attr_var make_attr_var(const char* attr, struct config* config);
 struct attr_var copy_attr_var(struct attr_var attr_var);
@@ -0,0 +1,622 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "alloc.h"
+#include "ast.h"
+#include "config.h"
+#include "eq_index.h"
+#include "tree.h"
+
+static const size_t EMPTY_SLOT = SIZE_MAX;
+
+static bool is_domain_type(const struct config* config, betree_var_t variable_id, enum betree_value_type_e type)
+{
+    return variable_id < config->attr_domain_count && config->attr_domains[variable_id]->bound.value_type == type;
+}
+
+static bool is_string_list_indexable(const struct betree_string_list* list)
+{
+    for(size_t i = 0; i < list->count; i++) {
+        if(list->strings[i].str == INVALID_STR) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool is_equality_indexable(const struct config* config, const struct ast_equality_expr* expr)
+{
+    if(expr->op != AST_EQUALITY_EQ) {
+        return false;
+    }
+    betree_var_t variable_id = expr->attr_var.var;
+    switch(expr->value.value_type) {
+        case AST_EQUALITY_VALUE_INTEGER:
+            return is_domain_type(config, variable_id, BETREE_INTEGER);
+        case AST_EQUALITY_VALUE_FLOAT:
+            return false;
+        case AST_EQUALITY_VALUE_STRING:
+            return is_domain_type(config, variable_id, BETREE_STRING)
+                && expr->value.string_value.str != INVALID_STR;
+        case AST_EQUALITY_VALUE_INTEGER_ENUM:
+            return is_domain_type(config, variable_id, BETREE_INTEGER_ENUM)
+                && expr->value.integer_enum_value.ienum != INVALID_IENUM;
+        default: abort();
+    }
+}
+
+static bool is_set_indexable(const struct config* config, const struct ast_set_expr* expr)
+{
+    if(expr->op != AST_SET_IN) {
+        return false;
+    }
+    const struct set_left_value* left = &expr->left_value;
+    const struct set_right_value* right = &expr->right_value;
+    switch(left->value_type) {
+        case AST_SET_LEFT_VALUE_INTEGER:
+            return right->value_type == AST_SET_RIGHT_VALUE_VARIABLE
+                && is_domain_type(config, right->variable_value.var, BETREE_INTEGER_LIST);
+        case AST_SET_LEFT_VALUE_STRING:
+            return right->value_type == AST_SET_RIGHT_VALUE_VARIABLE
+                && is_domain_type(config, right->variable_value.var, BETREE_STRING_LIST)
+                && left->string_value.str != INVALID_STR;
+        case AST_SET_LEFT_VALUE_VARIABLE:
+            switch(right->value_type) {
+                case AST_SET_RIGHT_VALUE_INTEGER_LIST:
+                    return is_domain_type(config, left->variable_value.var, BETREE_INTEGER);
+                case AST_SET_RIGHT_VALUE_STRING_LIST:
+                    return is_domain_type(config, left->variable_value.var, BETREE_STRING)
+                        && is_string_list_indexable(right->string_list_value);
+                case AST_SET_RIGHT_VALUE_VARIABLE:
+                    return false;
+                default: abort();
+            }
+        default: abort();
+    }
+}
+
+static bool is_list_indexable(const struct config* config, const struct ast_list_expr* expr)
+{
+    if(expr->op != AST_LIST_ONE_OF) {
+        return false;
+    }
+    betree_var_t variable_id = expr->attr_var.var;
+    switch(expr->value.value_type) {
+        case AST_LIST_VALUE_INTEGER_LIST:
+            return is_domain_type(config, variable_id, BETREE_INTEGER_LIST);
+        case AST_LIST_VALUE_STRING_LIST:
+            return is_domain_type(config, variable_id, BETREE_STRING_LIST)
+                && is_string_list_indexable(expr->value.string_list_value);
+        default: abort();
+    }
+}
+
+static bool is_node_indexable(const struct config* config, const struct ast_node* node)
+{
+    switch(node->type) {
+        case AST_TYPE_EQUALITY_EXPR:
+            return is_equality_indexable(config, &node->equality_expr);
+        case AST_TYPE_SET_EXPR:
+            return is_set_indexable(config, &node->set_expr);
+        case AST_TYPE_LIST_EXPR:
+            return is_list_indexable(config, &node->list_expr);
+        case AST_TYPE_COMPARE_EXPR:
+        case AST_TYPE_BOOL_EXPR:
+        case AST_TYPE_SPECIAL_EXPR:
+        case AST_TYPE_IS_NULL_EXPR:
+            return false;
+        default: abort();
+    }
+}
+
+static betree_var_t get_node_var(const struct ast_node* node)
+{
+    switch(node->type) {
+        case AST_TYPE_EQUALITY_EXPR:
+            return node->equality_expr.attr_var.var;
+        case AST_TYPE_SET_EXPR:
+            if(node->set_expr.left_value.value_type == AST_SET_LEFT_VALUE_VARIABLE) {
+                return node->set_expr.left_value.variable_value.var;
+            }
+            return node->set_expr.right_value.variable_value.var;
+        case AST_TYPE_LIST_EXPR:
+            return node->list_expr.attr_var.var;
+        case AST_TYPE_COMPARE_EXPR:
+        case AST_TYPE_BOOL_EXPR:
+        case AST_TYPE_SPECIAL_EXPR:
+        case AST_TYPE_IS_NULL_EXPR:
+        default: abort();
+    }
+}
+
+static size_t get_node_value_count(const struct ast_node* node)
+{
+    switch(node->type) {
+        case AST_TYPE_EQUALITY_EXPR:
+            return 1;
+        case AST_TYPE_SET_EXPR: {
+            const struct set_right_value* right = &node->set_expr.right_value;
+            switch(right->value_type) {
+                case AST_SET_RIGHT_VALUE_INTEGER_LIST:
+                    return right->integer_list_value->count;
+                case AST_SET_RIGHT_VALUE_STRING_LIST:
+                    return right->string_list_value->count;
+                case AST_SET_RIGHT_VALUE_VARIABLE:
+                    return 1;
+                default: abort();
+            }
+        }
+        case AST_TYPE_LIST_EXPR: {
+            const struct list_value* value = &node->list_expr.value;
+            switch(value->value_type) {
+                case AST_LIST_VALUE_INTEGER_LIST:
+                    return value->integer_list_value->count;
+                case AST_LIST_VALUE_STRING_LIST:
+                    return value->string_list_value->count;
+                default: abort();
+            }
+        }
+        case AST_TYPE_COMPARE_EXPR:
+        case AST_TYPE_BOOL_EXPR:
+        case AST_TYPE_SPECIAL_EXPR:
+        case AST_TYPE_IS_NULL_EXPR:
+        default: abort();
+    }
+}
+
+static uint64_t get_node_value(const struct ast_node* node, size_t index)
+{
+    switch(node->type) {
+        case AST_TYPE_EQUALITY_EXPR: {
+            const struct equality_value* value = &node->equality_expr.value;
+            switch(value->value_type) {
+                case AST_EQUALITY_VALUE_INTEGER:
+                    return (uint64_t)value->integer_value;
+                case AST_EQUALITY_VALUE_STRING:
+                    return value->string_value.str;
+                case AST_EQUALITY_VALUE_INTEGER_ENUM:
+                    return value->integer_enum_value.ienum;
+                case AST_EQUALITY_VALUE_FLOAT:
+                default: abort();
+            }
+        }
+        case AST_TYPE_SET_EXPR: {
+            const struct set_left_value* left = &node->set_expr.left_value;
+            const struct set_right_value* right = &node->set_expr.right_value;
+            switch(right->value_type) {
+                case AST_SET_RIGHT_VALUE_INTEGER_LIST:
+                    return (uint64_t)right->integer_list_value->integers[index];
+                case AST_SET_RIGHT_VALUE_STRING_LIST:
+                    return right->string_list_value->strings[index].str;
+                case AST_SET_RIGHT_VALUE_VARIABLE:
+                    switch(left->value_type) {
+                        case AST_SET_LEFT_VALUE_INTEGER:
+                            return (uint64_t)left->integer_value;
+                        case AST_SET_LEFT_VALUE_STRING:
+                            return left->string_value.str;
+                        case AST_SET_LEFT_VALUE_VARIABLE:
+                        default: abort();
+                    }
+                default: abort();
+            }
+        }
+        case AST_TYPE_LIST_EXPR: {
+            const struct list_value* value = &node->list_expr.value;
+            switch(value->value_type) {
+                case AST_LIST_VALUE_INTEGER_LIST:
+                    return (uint64_t)value->integer_list_value->integers[index];
+                case AST_LIST_VALUE_STRING_LIST:
+                    return value->string_list_value->strings[index].str;
+                default: abort();
+            }
+        }
+        case AST_TYPE_COMPARE_EXPR:
+        case AST_TYPE_BOOL_EXPR:
+        case AST_TYPE_SPECIAL_EXPR:
+        case AST_TYPE_IS_NULL_EXPR:
+        default: abort();
+    }
+}
+
+// Indexable term every match of node requires, the one with the fewest
+// values when an 'and' has several
+static const struct ast_node* find_required_node(const struct config* config, const struct ast_node* node)
+{
+    if(is_node_indexable(config, node)) {
+        return node;
+    }
+    if(node->type != AST_TYPE_BOOL_EXPR || node->bool_expr.op != AST_BOOL_AND) {
+        return NULL;
+    }
+    const struct ast_node* lhs = find_required_node(config, node->bool_expr.binary.lhs);
+    const struct ast_node* rhs = find_required_node(config, node->bool_expr.binary.rhs);
+    if(lhs == NULL) {
+        return rhs;
+    }
+    if(rhs == NULL) {
+        return lhs;
+    }
+    return get_node_value_count(rhs) < get_node_value_count(lhs) ? rhs : lhs;
+}
+
+bool is_eq_indexable(const struct config* config, const struct betree_sub* sub)
+{
+    return find_required_node(config, sub->expr) != NULL;
+}
+
+size_t get_pred_value_count(const struct betree_variable* pred)
+{
+    switch(pred->value.value_type) {
+        case BETREE_INTEGER:
+        case BETREE_STRING:
+        case BETREE_INTEGER_ENUM:
+            return 1;
+        case BETREE_INTEGER_LIST:
+            return pred->value.integer_list_value->count;
+        case BETREE_STRING_LIST:
+            return pred->value.string_list_value->count;
+        case BETREE_BOOLEAN:
+        case BETREE_FLOAT:
+        case BETREE_SEGMENTS:
+        case BETREE_FREQUENCY_CAPS:
+            return 0;
+        default: abort();
+    }
+}
+
+bool get_pred_value(const struct betree_variable* pred, size_t index, uint64_t* value)
+{
+    switch(pred->value.value_type) {
+        case BETREE_INTEGER:
+            *value = (uint64_t)pred->value.integer_value;
+            return true;
+        case BETREE_STRING:
+            *value = pred->value.string_value.str;
+            return pred->value.string_value.str != INVALID_STR;
+        case BETREE_INTEGER_ENUM:
+            *value = pred->value.integer_enum_value.ienum;
+            return pred->value.integer_enum_value.ienum != INVALID_IENUM;
+        case BETREE_INTEGER_LIST:
+            *value = (uint64_t)pred->value.integer_list_value->integers[index];
+            return true;
+        case BETREE_STRING_LIST:
+            *value = pred->value.string_list_value->strings[index].str;
+            return pred->value.string_list_value->strings[index].str != INVALID_STR;
+        case BETREE_BOOLEAN:
+        case BETREE_FLOAT:
+        case BETREE_SEGMENTS:
+        case BETREE_FREQUENCY_CAPS:
+            return false;
+        default: abort();
+    }
+}
+
+static uint64_t mix_hash(uint64_t hash)
+{
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdULL;
+    hash ^= hash >> 33;
+    hash *= 0xc4ceb9fe1a85ec53ULL;
+    hash ^= hash >> 33;
+    return hash;
+}
+
+static uint64_t hash_key(betree_var_t variable_id, uint64_t value)
+{
+    return mix_hash(value ^ mix_hash(variable_id));
+}
+
+struct eq_index* make_eq_index()
+{
+    struct eq_index* index = bcalloc(sizeof(*index));
+    if(index == NULL) {
+        fprintf(stderr, "%s bcalloc failed\n", __func__);
+        abort();
+    }
+    return index;
+}
+
+void free_eq_index(struct eq_index* index)
+{
+    if(index == NULL) {
+        return;
+    }
+    for(size_t i = 0; i < index->sub_count; i++) {
+        free_sub(index->subs[i]);
+    }
+    for(size_t i = 0; i < index->posting_count; i++) {
+        bfree(index->postings[i].matched.subs);
+        bfree(index->postings[i].checked.subs);
+    }
+    bfree(index->slots);
+    bfree(index->postings);
+    bfree(index->var_postings);
+    bfree(index->subs);
+    bfree(index->sub_slots);
+    bfree(index);
+}
+
+static size_t find_slot(const struct eq_index* index, betree_var_t variable_id, uint64_t value)
+{
+    size_t mask = index->slot_count - 1;
+    size_t slot = hash_key(variable_id, value) & mask;
+    while(index->slots[slot] != EMPTY_SLOT) {
+        const struct eq_posting* posting = &index->postings[index->slots[slot]];
+        if(posting->var == variable_id && posting->value == value) {
+            return slot;
+        }
+        slot = (slot + 1) & mask;
+    }
+    return slot;
+}
+
+static struct eq_posting* find_posting(const struct eq_index* index, betree_var_t variable_id, uint64_t value)
+{
+    if(index->slot_count == 0) {
+        return NULL;
+    }
+    size_t slot = find_slot(index, variable_id, value);
+    if(index->slots[slot] == EMPTY_SLOT) {
+        return NULL;
+    }
+    return &index->postings[index->slots[slot]];
+}
+
+// Keeps the slots at most half full
+static void grow_slots(struct eq_index* index)
+{
+    size_t slot_count = index->slot_count == 0 ? 16 : index->slot_count * 2;
+    size_t* slots = bmalloc(sizeof(*slots) * slot_count);
+    if(slots == NULL) {
+        fprintf(stderr, "%s bmalloc failed\n", __func__);
+        abort();
+    }
+    for(size_t i = 0; i < slot_count; i++) {
+        slots[i] = EMPTY_SLOT;
+    }
+    bfree(index->slots);
+    index->slots = slots;
+    index->slot_count = slot_count;
+    for(size_t i = 0; i < index->posting_count; i++) {
+        const struct eq_posting* posting = &index->postings[i];
+        index->slots[find_slot(index, posting->var, posting->value)] = i;
+    }
+}
+
+static void count_var_posting(struct eq_index* index, betree_var_t variable_id)
+{
+    if(variable_id >= index->var_count) {
+        size_t var_count = variable_id + 1;
+        size_t* var_postings = brealloc(index->var_postings, sizeof(*var_postings) * var_count);
+        if(var_postings == NULL) {
+            fprintf(stderr, "%s brealloc failed\n", __func__);
+            abort();
+        }
+        memset(var_postings + index->var_count, 0, sizeof(*var_postings) * (var_count - index->var_count));
+        index->var_postings = var_postings;
+        index->var_count = var_count;
+    }
+    index->var_postings[variable_id]++;
+}
+
+static struct eq_posting* add_posting(struct eq_index* index, betree_var_t variable_id, uint64_t value)
+{
+    if((index->posting_count + 1) * 2 > index->slot_count) {
+        grow_slots(index);
+    }
+    size_t slot = find_slot(index, variable_id, value);
+    if(index->slots[slot] != EMPTY_SLOT) {
+        return &index->postings[index->slots[slot]];
+    }
+    if(index->posting_count == index->posting_capacity) {
+        size_t capacity = index->posting_capacity == 0 ? 16 : index->posting_capacity * 2;
+        struct eq_posting* postings = brealloc(index->postings, sizeof(*postings) * capacity);
+        if(postings == NULL) {
+            fprintf(stderr, "%s brealloc failed\n", __func__);
+            abort();
+        }
+        index->postings = postings;
+        index->posting_capacity = capacity;
+    }
+    struct eq_posting* posting = &index->postings[index->posting_count];
+    posting->var = variable_id;
+    posting->value = value;
+    posting->matched = (struct eq_sub_list){ .count = 0, .capacity = 0, .subs = NULL };
+    posting->checked = (struct eq_sub_list){ .count = 0, .capacity = 0, .subs = NULL };
+    index->slots[slot] = index->posting_count;
+    index->posting_count++;
+    count_var_posting(index, variable_id);
+    return posting;
+}
+
+static void add_list_sub(struct eq_sub_list* list, struct betree_sub* sub)
+{
+    // A value listed twice must not report the sub twice
+    if(list->count != 0 && list->subs[list->count - 1] == sub) {
+        return;
+    }
+    if(list->count == list->capacity) {
+        size_t capacity = list->capacity == 0 ? 4 : list->capacity * 2;
+        struct betree_sub** subs = brealloc(list->subs, sizeof(*subs) * capacity);
+        if(subs == NULL) {
+            fprintf(stderr, "%s brealloc failed\n", __func__);
+            abort();
+        }
+        list->subs = subs;
+        list->capacity = capacity;
+    }
+    list->subs[list->count] = sub;
+    list->count++;
+}
+
+static void remove_list_sub(struct eq_sub_list* list, const struct betree_sub* sub)
+{
+    for(size_t i = 0; i < list->count; i++) {
+        if(list->subs[i] == sub) {
+            memmove(&list->subs[i], &list->subs[i + 1], sizeof(*list->subs) * (list->count - i - 1));
+            list->count--;
+            return;
+        }
+    }
+}
+
+static struct eq_sub_list* get_posting_list(struct eq_posting* posting, const struct betree_sub* sub, const struct ast_node* node)
+{
+    return node == sub->expr ? &posting->matched : &posting->checked;
+}
+
+static void place_sub(struct eq_index* index, size_t position)
+{
+    size_t mask = index->sub_slot_count - 1;
+    size_t slot = mix_hash(index->subs[position]->id) & mask;
+    while(index->sub_slots[slot] != EMPTY_SLOT) {
+        slot = (slot + 1) & mask;
+    }
+    index->sub_slots[slot] = position;
+}
+
+// Keeps the sub slots at most half full
+static void grow_sub_slots(struct eq_index* index)
+{
+    size_t slot_count = index->sub_slot_count == 0 ? 16 : index->sub_slot_count * 2;
+    size_t* slots = bmalloc(sizeof(*slots) * slot_count);
+    if(slots == NULL) {
+        fprintf(stderr, "%s bmalloc failed\n", __func__);
+        abort();
+    }
+    for(size_t i = 0; i < slot_count; i++) {
+        slots[i] = EMPTY_SLOT;
+    }
+    bfree(index->sub_slots);
+    index->sub_slots = slots;
+    index->sub_slot_count = slot_count;
+    for(size_t i = 0; i < index->sub_count; i++) {
+        place_sub(index, i);
+    }
+}
+
+static size_t find_sub_slot(const struct eq_index* index, size_t position)
+{
+    size_t mask = index->sub_slot_count - 1;
+    size_t slot = mix_hash(index->subs[position]->id) & mask;
+    while(index->sub_slots[slot] != position) {
+        slot = (slot + 1) & mask;
+    }
+    return slot;
+}
+
+// Backward shift deletion, keeps every probe sequence free of holes
+static void erase_sub_slot(struct eq_index* index, size_t position)
+{
+    size_t mask = index->sub_slot_count - 1;
+    size_t slot = find_sub_slot(index, position);
+    size_t next = slot;
+    while(true) {
+        next = (next + 1) & mask;
+        size_t next_position = index->sub_slots[next];
+        if(next_position == EMPTY_SLOT) {
+            break;
+        }
+        size_t home = mix_hash(index->subs[next_position]->id) & mask;
+        // The sub can move back unless its home is cyclically in (slot, next]
+        bool in_range = slot <= next ? (slot < home && home <= next) : (slot < home || home <= next);
+        if(!in_range) {
+            index->sub_slots[slot] = next_position;
+            slot = next;
+        }
+    }
+    index->sub_slots[slot] = EMPTY_SLOT;
+}
+
+void eq_index_insert(const struct config* config, struct eq_index* index, struct betree_sub* sub)
+{
+    if(index->sub_count == index->sub_capacity) {
+        size_t capacity = index->sub_capacity == 0 ? 16 : index->sub_capacity * 2;
+        struct betree_sub** subs = brealloc(index->subs, sizeof(*subs) * capacity);
+        if(subs == NULL) {
+            fprintf(stderr, "%s brealloc failed\n", __func__);
+            abort();
+        }
+        index->subs = subs;
+        index->sub_capacity = capacity;
+    }
+    if((index->sub_count + 1) * 2 > index->sub_slot_count) {
+        grow_sub_slots(index);
+    }
+    index->subs[index->sub_count] = sub;
+    place_sub(index, index->sub_count);
+    index->sub_count++;
+    const struct ast_node* node = find_required_node(config, sub->expr);
+    betree_var_t variable_id = get_node_var(node);
+    size_t value_count = get_node_value_count(node);
+    for(size_t i = 0; i < value_count; i++) {
+        struct eq_posting* posting = add_posting(index, variable_id, get_node_value(node, i));
+        add_list_sub(get_posting_list(posting, sub, node), sub);
+    }
+}
+
+static size_t find_sub_position(const struct eq_index* index, betree_sub_t id)
+{
+    if(index->sub_slot_count == 0) {
+        return index->sub_count;
+    }
+    size_t mask = index->sub_slot_count - 1;
+    size_t slot = mix_hash(id) & mask;
+    while(index->sub_slots[slot] != EMPTY_SLOT) {
+        size_t position = index->sub_slots[slot];
+        if(index->subs[position]->id == id) {
+            return position;
+        }
+        slot = (slot + 1) & mask;
+    }
+    return index->sub_count;
+}
+
+struct betree_sub* eq_index_find(const struct eq_index* index, betree_sub_t id)
+{
+    size_t position = find_sub_position(index, id);
+    return position == index->sub_count ? NULL : index->subs[position];
+}
+
+// The config only changes by growing, the sub is found under the same term
+// it was inserted with
+struct betree_sub* eq_index_remove(const struct config* config, struct eq_index* index, betree_sub_t id)
+{
+    size_t position = find_sub_position(index, id);
+    if(position == index->sub_count) {
+        return NULL;
+    }
+    struct betree_sub* sub = index->subs[position];
+    const struct ast_node* node = find_required_node(config, sub->expr);
+    betree_var_t variable_id = get_node_var(node);
+    size_t value_count = get_node_value_count(node);
+    for(size_t i = 0; i < value_count; i++) {
+        struct eq_posting* posting = find_posting(index, variable_id, get_node_value(node, i));
+        if(posting != NULL) {
+            remove_list_sub(get_posting_list(posting, sub, node), sub);
+        }
+    }
+    erase_sub_slot(index, position);
+    size_t last = index->sub_count - 1;
+    if(position != last) {
+        index->sub_slots[find_sub_slot(index, last)] = position;
+        index->subs[position] = index->subs[last];
+    }
+    index->sub_count--;
+    return sub;
+}
+
+bool is_eq_indexed_var(const struct eq_index* index, betree_var_t variable_id)
+{
+    return variable_id < index->var_count && index->var_postings[variable_id] != 0;
+}
+
+const struct eq_posting* eq_index_probe(const struct eq_index* index, betree_var_t variable_id, uint64_t value)
+{
+    const struct eq_posting* posting = find_posting(index, variable_id, value);
+    if(posting == NULL || (posting->matched.count == 0 && posting->checked.count == 0)) {
+        return NULL;
+    }
+    return posting;
+}
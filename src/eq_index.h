@@ -0,0 +1,85 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "betree.h"
+#include "value.h"
+
+struct config;
+struct betree_sub;
+struct betree_variable;
+
+struct eq_sub_list {
+    size_t count;
+    size_t capacity;
+    struct betree_sub** subs;
+};
+
+// Subs listing a variable value, the value is the integer, string id or
+// integer enum id
+struct eq_posting {
+    betree_var_t var;
+    uint64_t value;
+    // Subs matched by the value alone
+    struct eq_sub_list matched;
+    // Subs the value is only required by, evaluated when it is found
+    struct eq_sub_list checked;
+};
+
+// Side index of the subs keyed on the values of a single equality, 'in' or
+// 'one of' on an integer, string, integer enum or list variable. A sub whose
+// whole expression is that predicate is matched by the lookup alone, one
+// where it is a term of a top level 'and' is only evaluated when the lookup
+// finds it. A search looks up the values of each event variable instead of
+// walking the tree
+struct eq_index {
+    // Open addressing on the variable and value, a slot holds the position
+    // of a posting, SIZE_MAX when empty
+    struct {
+        size_t slot_count;
+        size_t* slots;
+    };
+    struct {
+        size_t posting_count;
+        size_t posting_capacity;
+        struct eq_posting* postings;
+    };
+    // Postings on each variable id, variables without any are not looked up
+    struct {
+        size_t var_count;
+        size_t* var_postings;
+    };
+    // Subs owned by the index, the last one takes the place of a removed one
+    struct {
+        size_t sub_count;
+        size_t sub_capacity;
+        struct betree_sub** subs;
+    };
+    // Open addressing on the sub id, a slot holds the position of a sub,
+    // SIZE_MAX when empty. Ids can repeat, every sub gets its own slot
+    struct {
+        size_t sub_slot_count;
+        size_t* sub_slots;
+    };
+};
+
+bool is_eq_indexable(const struct config* config, const struct betree_sub* sub);
+
+struct eq_index* make_eq_index();
+// Frees the subs of the index as well
+void free_eq_index(struct eq_index* index);
+
+void eq_index_insert(const struct config* config, struct eq_index* index, struct betree_sub* sub);
+// Takes the sub out of the index and hands it back, NULL when absent
+struct betree_sub* eq_index_remove(const struct config* config, struct eq_index* index, betree_sub_t id);
+struct betree_sub* eq_index_find(const struct eq_index* index, betree_sub_t id);
+
+bool is_eq_indexed_var(const struct eq_index* index, betree_var_t variable_id);
+// Values of an event variable the index is keyed on, every element of a list
+size_t get_pred_value_count(const struct betree_variable* pred);
+// False for a string or integer enum unknown to the config
+bool get_pred_value(const struct betree_variable* pred, size_t index, uint64_t* value);
+// Posting of the variable value, NULL when there is none
+const struct eq_posting* eq_index_probe(const struct eq_index* index, betree_var_t variable_id, uint64_t value);
@@ -1,55 +1,282 @@
 #include <stdio.h>
+#include <string.h>
 
 #include "alloc.h"
 #include "ast.h"
 #include "ast_compare.h"
 #include "clone.h"
 #include "hashmap.h"
-#include "jsw_rbtree.h"
 #include "map.h"
+#include "pattern.h"
 #include "printer.h"
 #include "utils.h"
 
-void assign_pred(struct pred_map* pred_map, struct ast_node* node)
+static betree_pred_t pop_id(size_t* count, betree_pred_t* ids, betree_pred_t* next)
+{
+    if(*count != 0) {
+        (*count)--;
+        return ids[*count];
+    }
+    betree_pred_t id = *next;
+    (*next)++;
+    return id;
+}
+
+static void push_id(size_t* count, size_t* capacity, betree_pred_t** ids, betree_pred_t id)
+{
+    if(*count == *capacity) {
+        size_t new_capacity = *capacity == 0 ? 16 : *capacity * 2;
+        betree_pred_t* new_ids = brealloc(*ids, sizeof(*new_ids) * new_capacity);
+        if(new_ids == NULL) {
+            fprintf(stderr, "%s brealloc failed\n", __func__);
+            abort();
+        }
+        *ids = new_ids;
+        *capacity = new_capacity;
+    }
+    (*ids)[*count] = id;
+    (*count)++;
+}
+
+static struct pred_entry* get_entry(struct pred_map* pred_map, betree_pred_t global_id)
+{
+    if(global_id >= pred_map->entry_capacity) {
+        size_t capacity = pred_map->entry_capacity == 0 ? 64 : pred_map->entry_capacity;
+        while(capacity <= global_id) {
+            capacity *= 2;
+        }
+        struct pred_entry* entries = brealloc(pred_map->entries, sizeof(*entries) * capacity);
+        if(entries == NULL) {
+            fprintf(stderr, "%s brealloc failed\n", __func__);
+            abort();
+        }
+        memset(entries + pred_map->entry_capacity, 0, sizeof(*entries) * (capacity - pred_map->entry_capacity));
+        pred_map->entries = entries;
+        pred_map->entry_capacity = capacity;
+    }
+    return &pred_map->entries[global_id];
+}
+
+static bool is_bool_operator(const struct ast_node* node)
+{
+    return node->type == AST_TYPE_BOOL_EXPR
+        && (node->bool_expr.op == AST_BOOL_AND || node->bool_expr.op == AST_BOOL_OR || node->bool_expr.op == AST_BOOL_NOT);
+}
+
+static struct ast_node* copy_pred(const struct pred_map* pred_map, const struct ast_node* node)
+{
+    struct ast_node* copy;
+    if(is_bool_operator(node)) {
+        copy = ast_node_create();
+        copy->global_id = node->global_id;
+        copy->type = AST_TYPE_BOOL_EXPR;
+        copy->bool_expr.op = node->bool_expr.op;
+        if(node->bool_expr.op == AST_BOOL_NOT) {
+            copy->bool_expr.unary.expr = pred_map->entries[node->bool_expr.unary.expr->global_id].node;
+        }
+        else {
+            copy->bool_expr.binary.lhs = pred_map->entries[node->bool_expr.binary.lhs->global_id].node;
+            copy->bool_expr.binary.rhs = pred_map->entries[node->bool_expr.binary.rhs->global_id].node;
+        }
+    }
+    else {
+        copy = clone_node(node);
+    }
+    copy->memoize_id = INVALID_PRED;
+    return copy;
+}
+
+static void free_pred_copy(struct ast_node* node)
+{
+    if(is_bool_operator(node)) {
+        bfree(node);
+    }
+    else {
+        free_ast_node(node);
+    }
+}
+
+static void fill_slots(betree_pred_t* slots, size_t slot_count)
+{
+    for(size_t i = 0; i < slot_count; i++) {
+        slots[i] = INVALID_PRED;
+    }
+}
+
+static void grow_slots(struct pred_map* pred_map)
+{
+    size_t slot_count = pred_map->slot_count * 2;
+    betree_pred_t* slots = bmalloc(slot_count * sizeof(*slots));
+    if(slots == NULL) {
+        fprintf(stderr, "%s bmalloc failed\n", __func__);
+        abort();
+    }
+    fill_slots(slots, slot_count);
+    size_t mask = slot_count - 1;
+    for(size_t i = 0; i < pred_map->slot_count; i++) {
+        betree_pred_t global_id = pred_map->slots[i];
+        if(global_id == INVALID_PRED) {
+            continue;
+        }
+        size_t slot = pred_map->entries[global_id].hash & mask;
+        while(slots[slot] != INVALID_PRED) {
+            slot = (slot + 1) & mask;
+        }
+        slots[slot] = global_id;
+    }
+    bfree(pred_map->slots);
+    pred_map->slots = slots;
+    pred_map->slot_count = slot_count;
+}
+
+// Slot of the equal pred, or the empty slot it would go in
+static size_t find_slot(const struct pred_map* pred_map, const struct ast_node* node, uint64_t hash)
+{
+    size_t mask = pred_map->slot_count - 1;
+    size_t slot = hash & mask;
+    while(pred_map->slots[slot] != INVALID_PRED) {
+        const struct pred_entry* entry = &pred_map->entries[pred_map->slots[slot]];
+        if(entry->hash == hash && expr_cmp(entry->node, node) == 0) {
+            break;
+        }
+        slot = (slot + 1) & mask;
+    }
+    return slot;
+}
+
+// Backward shift deletion, keeps every probe sequence free of holes
+static void erase_slot(struct pred_map* pred_map, betree_pred_t global_id)
+{
+    size_t mask = pred_map->slot_count - 1;
+    size_t slot = pred_map->entries[global_id].hash & mask;
+    while(pred_map->slots[slot] != global_id) {
+        slot = (slot + 1) & mask;
+    }
+    size_t next = slot;
+    while(true) {
+        next = (next + 1) & mask;
+        betree_pred_t next_id = pred_map->slots[next];
+        if(next_id == INVALID_PRED) {
+            break;
+        }
+        size_t home = pred_map->entries[next_id].hash & mask;
+        // The entry can move back unless its home is cyclically in (slot, next]
+        bool in_range = slot <= next ? (slot < home && home <= next) : (slot < home || home <= next);
+        if(!in_range) {
+            pred_map->slots[slot] = next_id;
+            slot = next;
+        }
+    }
+    pred_map->slots[slot] = INVALID_PRED;
+}
+
+void assign_memoize_id(struct pred_map* pred_map, betree_pred_t global_id)
+{
+    struct pred_entry* entry = &pred_map->entries[global_id];
+    if(entry->node->memoize_id != INVALID_PRED) {
+        return;
+    }
+    betree_pred_t memoize_id
+        = pop_id(&pred_map->free_memoize_count, pred_map->free_memoizes, &pred_map->memoize_count);
+    entry->node->memoize_id = memoize_id;
+    if(entry->first != NULL) {
+        entry->first->memoize_id = memoize_id;
+    }
+    if(entry->first_memoize_id != NULL) {
+        *entry->first_memoize_id = memoize_id;
+    }
+}
+
+static uint64_t assign_pred_hash(struct pred_map* pred_map, struct ast_node* node)
 {
+    uint64_t lhs_hash = 0;
+    uint64_t rhs_hash = 0;
     if(node->type == AST_TYPE_BOOL_EXPR && node->bool_expr.op == AST_BOOL_NOT) {
-        assign_pred(pred_map, node->bool_expr.unary.expr);
+        lhs_hash = assign_pred_hash(pred_map, node->bool_expr.unary.expr);
     }
     else if (node->type == AST_TYPE_BOOL_EXPR && node->bool_expr.op == AST_BOOL_OR) {
-        assign_pred(pred_map, node->bool_expr.binary.lhs);
-        assign_pred(pred_map, node->bool_expr.binary.rhs);
+        lhs_hash = assign_pred_hash(pred_map, node->bool_expr.binary.lhs);
+        rhs_hash = assign_pred_hash(pred_map, node->bool_expr.binary.rhs);
     }
     else if (node->type == AST_TYPE_BOOL_EXPR && node->bool_expr.op == AST_BOOL_AND) {
-        assign_pred(pred_map, node->bool_expr.binary.lhs);
-        assign_pred(pred_map, node->bool_expr.binary.rhs);
+        lhs_hash = assign_pred_hash(pred_map, node->bool_expr.binary.lhs);
+        rhs_hash = assign_pred_hash(pred_map, node->bool_expr.binary.rhs);
     }
-    struct ast_node* find = jsw_rbfind(pred_map->m, node);
-    if(find == NULL) {
-        betree_pred_t global_id = pred_map->pred_count;
-        pred_map->pred_count++;
-        node->global_id = global_id;
-        int ret = jsw_rbinsert(pred_map->m, node);
-        if(ret == 0) {
-            abort();
+    uint64_t hash = hash_expr_node(node, lhs_hash, rhs_hash);
+    size_t slot = find_slot(pred_map, node, hash);
+    if(pred_map->slots[slot] == INVALID_PRED) {
+        size_t live_count = pred_map->pred_count - pred_map->free_pred_count;
+        if((live_count + 1) * 2 > pred_map->slot_count) {
+            grow_slots(pred_map);
+            slot = find_slot(pred_map, node, hash);
         }
+        betree_pred_t global_id
+            = pop_id(&pred_map->free_pred_count, pred_map->free_preds, &pred_map->pred_count);
+        node->global_id = global_id;
+        struct pred_entry* entry = get_entry(pred_map, global_id);
+        entry->node = copy_pred(pred_map, node);
+        entry->first = node;
+        entry->first_memoize_id = NULL;
+        entry->ref_count = 1;
+        entry->hash = hash;
+        pred_map->slots[slot] = global_id;
     }
     else {
+        struct pred_entry* entry = &pred_map->entries[pred_map->slots[slot]];
+        struct ast_node* find = entry->node;
         node->global_id = find->global_id;
-        if(find->memoize_id == INVALID_PRED) {
-            betree_pred_t memoize_id = pred_map->memoize_count;
-            pred_map->memoize_count++;
-            find->memoize_id = memoize_id;
-        }
+        assign_memoize_id(pred_map, find->global_id);
         node->memoize_id = find->memoize_id;
+        entry->ref_count++;
     }
+    return hash;
 }
 
-static struct jsw_rbtree* exprmap_new()
+void assign_pred(struct pred_map* pred_map, struct ast_node* node)
 {
-    struct jsw_rbtree* rbtree;
-    rbtree = jsw_rbnew(expr_cmp);
+    assign_pred_hash(pred_map, node);
+}
 
-    return rbtree;
+void release_pred(struct pred_map* pred_map, const struct ast_node* node)
+{
+    // Parents go first, the map copy of a parent points to its children copies
+    if(node->global_id < pred_map->entry_capacity) {
+        struct pred_entry* entry = &pred_map->entries[node->global_id];
+        if(entry->node != NULL && expr_cmp(entry->node, node) == 0) {
+            if(entry->first == node) {
+                entry->first = NULL;
+                entry->first_memoize_id = NULL;
+            }
+            entry->ref_count--;
+            if(entry->ref_count == 0) {
+                erase_slot(pred_map, node->global_id);
+                forget_pattern(pred_map, entry->node);
+                if(entry->node->memoize_id != INVALID_PRED) {
+                    push_id(&pred_map->free_memoize_count,
+                        &pred_map->free_memoize_capacity,
+                        &pred_map->free_memoizes,
+                        entry->node->memoize_id);
+                }
+                push_id(&pred_map->free_pred_count,
+                    &pred_map->free_pred_capacity,
+                    &pred_map->free_preds,
+                    node->global_id);
+                free_pred_copy(entry->node);
+                entry->node = NULL;
+            }
+        }
+    }
+    if(node->type == AST_TYPE_BOOL_EXPR && node->bool_expr.op == AST_BOOL_NOT) {
+        release_pred(pred_map, node->bool_expr.unary.expr);
+    }
+    else if (node->type == AST_TYPE_BOOL_EXPR && node->bool_expr.op == AST_BOOL_OR) {
+        release_pred(pred_map, node->bool_expr.binary.lhs);
+        release_pred(pred_map, node->bool_expr.binary.rhs);
+    }
+    else if (node->type == AST_TYPE_BOOL_EXPR && node->bool_expr.op == AST_BOOL_AND) {
+        release_pred(pred_map, node->bool_expr.binary.lhs);
+        release_pred(pred_map, node->bool_expr.binary.rhs);
+    }
 }
 
 struct pred_map* make_pred_map()
@@ -60,13 +287,39 @@ struct pred_map* make_pred_map()
         abort();
     }
     pred_map->pred_count = 0;
-    pred_map->m = exprmap_new();
+    pred_map->memoize_count = 0;
+    pred_map->slot_count = 64;
+    pred_map->slots = bmalloc(pred_map->slot_count * sizeof(*pred_map->slots));
+    if(pred_map->slots == NULL) {
+        fprintf(stderr, "%s bmalloc failed\n", __func__);
+        abort();
+    }
+    fill_slots(pred_map->slots, pred_map->slot_count);
+    pred_map->entry_capacity = 0;
+    pred_map->entries = NULL;
+    pred_map->free_pred_count = 0;
+    pred_map->free_pred_capacity = 0;
+    pred_map->free_preds = NULL;
+    pred_map->free_memoize_count = 0;
+    pred_map->free_memoize_capacity = 0;
+    pred_map->free_memoizes = NULL;
+    pred_map->pattern_matcher_count = 0;
+    pred_map->pattern_matchers = NULL;
     return pred_map;
 }
 
 void free_pred_map(struct pred_map* pred_map)
 {
-    jsw_rbdelete(pred_map->m);
+    bfree(pred_map->slots);
+    for(size_t i = 0; i < pred_map->entry_capacity; i++) {
+        if(pred_map->entries[i].node != NULL) {
+            free_pred_copy(pred_map->entries[i].node);
+        }
+    }
+    bfree(pred_map->entries);
+    bfree(pred_map->free_preds);
+    bfree(pred_map->free_memoizes);
+    free_patterns(pred_map);
     bfree(pred_map);
 }
 
@@ -1,19 +1,59 @@
 #pragma once
 
 #include <stddef.h>
+#include <stdint.h>
 
-#include "jsw_rbtree.h"
 #include "memoize.h"
 
 struct ast_node;
+struct pattern_matcher;
+
+// The map owns a copy of every distinct pred, the children of a copied
+// and/or/not point to the copies of their own children
+struct pred_entry {
+    struct ast_node* node;
+    // Sub node the pred was first seen on, it gets the memoize id once
+    // the pred is shared
+    struct ast_node* first;
+    // Compiled copy of the first node memoize id, see bytecode.c
+    betree_pred_t* first_memoize_id;
+    size_t ref_count;
+    uint64_t hash;
+};
 
 struct pred_map {
     betree_pred_t pred_count;
     betree_pred_t memoize_count;
-    struct jsw_rbtree* m;
+    // Open addressing on hash_expr, a slot holds the global id of an entry
+    struct {
+        size_t slot_count;
+        betree_pred_t* slots;
+    };
+    struct {
+        size_t entry_capacity;
+        struct pred_entry* entries;
+    };
+    struct {
+        size_t free_pred_count;
+        size_t free_pred_capacity;
+        betree_pred_t* free_preds;
+    };
+    struct {
+        size_t free_memoize_count;
+        size_t free_memoize_capacity;
+        betree_pred_t* free_memoizes;
+    };
+    // Compiled string patterns, see pattern.h
+    struct {
+        size_t pattern_matcher_count;
+        struct pattern_matcher* pattern_matchers;
+    };
 };
 
 void assign_pred(struct pred_map* pred_map, struct ast_node* node);
+void release_pred(struct pred_map* pred_map, const struct ast_node* node);
+// Memoizes the pred even when a single sub uses it
+void assign_memoize_id(struct pred_map* pred_map, betree_pred_t global_id);
 struct pred_map* make_pred_map();
 void free_pred_map(struct pred_map* pred_map);
 
@@ -1,4 +1,5 @@
 #include <stdint.h>
+#include <stdlib.h>
 
 #include "memoize.h"
 
@@ -17,3 +18,38 @@ bool test_bit(const uint64_t A[], uint64_t k)
     return ((A[k / 64ULL] & (1ULL << (k % 64ULL))) != 0ULL);
 }
 
+bool get_memoize(const struct memoize* memoize, betree_pred_t memoize_id, bool* result)
+{
+    if(memoize->epochs != NULL) {
+        uint32_t slot = memoize->epochs[memoize_id];
+        if((slot >> 1) != memoize->epoch) {
+            return false;
+        }
+        *result = (slot & 1) != 0;
+        return true;
+    }
+    if(test_bit(memoize->pass, memoize_id)) {
+        *result = true;
+        return true;
+    }
+    if(test_bit(memoize->fail, memoize_id)) {
+        *result = false;
+        return true;
+    }
+    return false;
+}
+
+void set_memoize(struct memoize* memoize, betree_pred_t memoize_id, bool result)
+{
+    if(memoize->epochs != NULL) {
+        memoize->epochs[memoize_id] = (memoize->epoch << 1) | (result ? 1 : 0);
+        return;
+    }
+    if(result) {
+        set_bit(memoize->pass, memoize_id);
+    }
+    else {
+        set_bit(memoize->fail, memoize_id);
+    }
+}
+
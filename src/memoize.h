@@ -9,9 +9,19 @@ static const betree_pred_t INVALID_PRED = UINT64_MAX;
 struct memoize {
     uint64_t* pass;
     uint64_t* fail;
+    // Epoch store, used instead of the bitmaps when not NULL. A slot holds
+    // the epoch it was written in, shifted left once, and the result in the
+    // low bit, so a new search only bumps the epoch
+    uint32_t* epochs;
+    uint32_t epoch;
 };
 
+static const uint32_t MAX_MEMOIZE_EPOCH = UINT32_MAX >> 1;
+
 void set_bit(uint64_t A[], uint64_t k);
 void clear_bit(uint64_t A[], uint64_t k);
 bool test_bit(const uint64_t A[], uint64_t k);
 
+bool get_memoize(const struct memoize* memoize, betree_pred_t memoize_id, bool* result);
+void set_memoize(struct memoize* memoize, betree_pred_t memoize_id, bool result);
+
@@ -0,0 +1,398 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "alloc.h"
+#include "ast.h"
+#include "hashmap.h"
+#include "pattern.h"
+#include "tree.h"
+
+static const size_t NO_NODE = SIZE_MAX;
+
+struct build_node {
+    size_t first_child;
+    size_t next_sibling;
+    betree_pred_t memoize_id;
+    unsigned char byte;
+};
+
+struct trie_builder {
+    size_t node_count;
+    size_t node_capacity;
+    struct build_node* nodes;
+};
+
+static size_t add_build_node(struct trie_builder* builder, unsigned char byte)
+{
+    if(builder->node_count == builder->node_capacity) {
+        size_t capacity = builder->node_capacity == 0 ? 64 : builder->node_capacity * 2;
+        struct build_node* nodes = brealloc(builder->nodes, sizeof(*nodes) * capacity);
+        if(nodes == NULL) {
+            fprintf(stderr, "%s brealloc failed\n", __func__);
+            abort();
+        }
+        builder->nodes = nodes;
+        builder->node_capacity = capacity;
+    }
+    struct build_node* node = &builder->nodes[builder->node_count];
+    node->first_child = NO_NODE;
+    node->next_sibling = NO_NODE;
+    node->memoize_id = INVALID_PRED;
+    node->byte = byte;
+    return builder->node_count++;
+}
+
+// Siblings are kept sorted by byte
+static size_t get_build_child(struct trie_builder* builder, size_t parent, unsigned char byte)
+{
+    size_t previous = NO_NODE;
+    size_t next = builder->nodes[parent].first_child;
+    while(next != NO_NODE && builder->nodes[next].byte < byte) {
+        previous = next;
+        next = builder->nodes[next].next_sibling;
+    }
+    if(next != NO_NODE && builder->nodes[next].byte == byte) {
+        return next;
+    }
+    size_t child = add_build_node(builder, byte);
+    builder->nodes[child].next_sibling = next;
+    if(previous == NO_NODE) {
+        builder->nodes[parent].first_child = child;
+    }
+    else {
+        builder->nodes[previous].next_sibling = child;
+    }
+    return child;
+}
+
+static void add_pattern(struct trie_builder* builder, const char* pattern, bool reversed, betree_pred_t memoize_id)
+{
+    size_t length = strlen(pattern);
+    size_t node = 0;
+    for(size_t i = 0; i < length; i++) {
+        unsigned char byte = (unsigned char)pattern[reversed ? length - 1 - i : i];
+        node = get_build_child(builder, node, byte);
+    }
+    builder->nodes[node].memoize_id = memoize_id;
+}
+
+static size_t find_child(const struct pattern_trie* trie, size_t node, unsigned char byte)
+{
+    size_t low = trie->nodes[node].child;
+    size_t high = low + trie->nodes[node].child_count;
+    while(low < high) {
+        size_t middle = low + (high - low) / 2;
+        if(trie->nodes[middle].byte < byte) {
+            low = middle + 1;
+        }
+        else {
+            high = middle;
+        }
+    }
+    if(low < trie->nodes[node].child + trie->nodes[node].child_count && trie->nodes[low].byte == byte) {
+        return low;
+    }
+    return NO_NODE;
+}
+
+static void link_failures(struct pattern_trie* trie, const size_t* parents)
+{
+    struct pattern_node* nodes = trie->nodes;
+    // Breadth first, the fail link of a node is shallower than the node
+    for(size_t node = 1; node < trie->node_count; node++) {
+        size_t fail = 0;
+        if(parents[node] != 0) {
+            size_t suffix = nodes[parents[node]].fail;
+            while(true) {
+                size_t child = find_child(trie, suffix, nodes[node].byte);
+                if(child != NO_NODE) {
+                    fail = child;
+                    break;
+                }
+                if(suffix == 0) {
+                    break;
+                }
+                suffix = nodes[suffix].fail;
+            }
+        }
+        nodes[node].fail = fail;
+        nodes[node].output = nodes[node].memoize_id != INVALID_PRED ? node : nodes[fail].output;
+    }
+}
+
+static struct pattern_trie flatten_trie(const struct trie_builder* builder, bool link)
+{
+    struct pattern_trie trie = { .node_count = builder->node_count };
+    trie.nodes = bmalloc(sizeof(*trie.nodes) * builder->node_count);
+    size_t* order = bmalloc(sizeof(*order) * builder->node_count);
+    size_t* parents = bmalloc(sizeof(*parents) * builder->node_count);
+    if(trie.nodes == NULL || order == NULL || parents == NULL) {
+        fprintf(stderr, "%s bmalloc failed\n", __func__);
+        abort();
+    }
+    order[0] = 0;
+    parents[0] = 0;
+    size_t tail = 1;
+    for(size_t node = 0; node < builder->node_count; node++) {
+        const struct build_node* build = &builder->nodes[order[node]];
+        trie.nodes[node].child = tail;
+        trie.nodes[node].child_count = 0;
+        trie.nodes[node].fail = 0;
+        trie.nodes[node].output = build->memoize_id != INVALID_PRED ? node : NO_NODE;
+        trie.nodes[node].memoize_id = build->memoize_id;
+        trie.nodes[node].byte = build->byte;
+        for(size_t child = build->first_child; child != NO_NODE; child = builder->nodes[child].next_sibling) {
+            order[tail] = child;
+            parents[tail] = node;
+            tail++;
+            trie.nodes[node].child_count++;
+        }
+    }
+    if(link) {
+        link_failures(&trie, parents);
+    }
+    bfree(parents);
+    bfree(order);
+    return trie;
+}
+
+static void free_trie(struct pattern_trie* trie)
+{
+    bfree(trie->nodes);
+    trie->nodes = NULL;
+    trie->node_count = 0;
+}
+
+static const struct ast_special_string* get_special_string(const struct ast_node* node)
+{
+    if(node == NULL || node->type != AST_TYPE_SPECIAL_EXPR || node->special_expr.type != AST_SPECIAL_STRING) {
+        return NULL;
+    }
+    return &node->special_expr.string;
+}
+
+static struct pattern_matcher* find_matcher(const struct pred_map* pred_map, betree_var_t variable_id)
+{
+    for(size_t i = 0; i < pred_map->pattern_matcher_count; i++) {
+        if(pred_map->pattern_matchers[i].var == variable_id) {
+            return &pred_map->pattern_matchers[i];
+        }
+    }
+    return NULL;
+}
+
+static void add_matcher_memoize_id(struct pattern_matcher* matcher, betree_pred_t memoize_id)
+{
+    betree_pred_t* memoize_ids
+        = brealloc(matcher->memoize_ids, sizeof(*memoize_ids) * (matcher->memoize_id_count + 1));
+    if(memoize_ids == NULL) {
+        fprintf(stderr, "%s brealloc failed\n", __func__);
+        abort();
+    }
+    memoize_ids[matcher->memoize_id_count] = memoize_id;
+    matcher->memoize_ids = memoize_ids;
+    matcher->memoize_id_count++;
+    size_t word_count = memoize_id / 64 + 1;
+    if(word_count > matcher->fail_word_count) {
+        uint64_t* fail_mask = brealloc(matcher->fail_mask, sizeof(*fail_mask) * word_count);
+        if(fail_mask == NULL) {
+            fprintf(stderr, "%s brealloc failed\n", __func__);
+            abort();
+        }
+        memset(fail_mask + matcher->fail_word_count, 0, sizeof(*fail_mask) * (word_count - matcher->fail_word_count));
+        matcher->fail_mask = fail_mask;
+        matcher->fail_word_count = word_count;
+    }
+    set_bit(matcher->fail_mask, memoize_id);
+}
+
+static void compile_matcher(struct pred_map* pred_map, struct pattern_matcher* matcher)
+{
+    struct trie_builder builders[3] = { { 0 }, { 0 }, { 0 } };
+    for(size_t i = 0; i < 3; i++) {
+        add_build_node(&builders[i], 0);
+    }
+    for(size_t global_id = 0; global_id < pred_map->pred_count && global_id < pred_map->entry_capacity; global_id++) {
+        const struct ast_special_string* string = get_special_string(pred_map->entries[global_id].node);
+        if(string == NULL || string->attr_var.var != matcher->var) {
+            continue;
+        }
+        assign_memoize_id(pred_map, global_id);
+        betree_pred_t memoize_id = pred_map->entries[global_id].node->memoize_id;
+        add_matcher_memoize_id(matcher, memoize_id);
+        switch(string->op) {
+            case AST_SPECIAL_CONTAINS:
+                add_pattern(&builders[0], string->pattern, false, memoize_id);
+                break;
+            case AST_SPECIAL_STARTSWITH:
+                add_pattern(&builders[1], string->pattern, false, memoize_id);
+                break;
+            case AST_SPECIAL_ENDSWITH:
+                add_pattern(&builders[2], string->pattern, true, memoize_id);
+                break;
+            default: abort();
+        }
+    }
+    matcher->contains = flatten_trie(&builders[0], true);
+    matcher->prefixes = flatten_trie(&builders[1], false);
+    matcher->suffixes = flatten_trie(&builders[2], false);
+    for(size_t i = 0; i < 3; i++) {
+        bfree(builders[i].nodes);
+    }
+}
+
+void free_patterns(struct pred_map* pred_map)
+{
+    for(size_t i = 0; i < pred_map->pattern_matcher_count; i++) {
+        struct pattern_matcher* matcher = &pred_map->pattern_matchers[i];
+        free_trie(&matcher->contains);
+        free_trie(&matcher->prefixes);
+        free_trie(&matcher->suffixes);
+        bfree(matcher->memoize_ids);
+        bfree(matcher->fail_mask);
+    }
+    bfree(pred_map->pattern_matchers);
+    pred_map->pattern_matchers = NULL;
+    pred_map->pattern_matcher_count = 0;
+}
+
+void compile_patterns(struct pred_map* pred_map)
+{
+    free_patterns(pred_map);
+    for(size_t global_id = 0; global_id < pred_map->pred_count && global_id < pred_map->entry_capacity; global_id++) {
+        const struct ast_special_string* string = get_special_string(pred_map->entries[global_id].node);
+        if(string == NULL || find_matcher(pred_map, string->attr_var.var) != NULL) {
+            continue;
+        }
+        struct pattern_matcher* matchers = brealloc(
+            pred_map->pattern_matchers, sizeof(*matchers) * (pred_map->pattern_matcher_count + 1));
+        if(matchers == NULL) {
+            fprintf(stderr, "%s brealloc failed\n", __func__);
+            abort();
+        }
+        pred_map->pattern_matchers = matchers;
+        struct pattern_matcher* matcher = &matchers[pred_map->pattern_matcher_count];
+        memset(matcher, 0, sizeof(*matcher));
+        matcher->var = string->attr_var.var;
+        pred_map->pattern_matcher_count++;
+    }
+    for(size_t i = 0; i < pred_map->pattern_matcher_count; i++) {
+        compile_matcher(pred_map, &pred_map->pattern_matchers[i]);
+    }
+}
+
+void forget_pattern(struct pred_map* pred_map, const struct ast_node* node)
+{
+    const struct ast_special_string* string = get_special_string(node);
+    if(string == NULL) {
+        return;
+    }
+    struct pattern_matcher* matcher = find_matcher(pred_map, string->attr_var.var);
+    if(matcher != NULL) {
+        matcher->stale = true;
+    }
+}
+
+static void publish_outputs(const struct pattern_trie* trie, size_t output, struct memoize* memoize)
+{
+    while(output != NO_NODE) {
+        set_memoize(memoize, trie->nodes[output].memoize_id, true);
+        output = output == 0 ? NO_NODE : trie->nodes[trie->nodes[output].fail].output;
+    }
+}
+
+static void scan_contains(const struct pattern_trie* trie, const char* value, size_t length, struct memoize* memoize)
+{
+    size_t node = 0;
+    publish_outputs(trie, trie->nodes[0].output, memoize);
+    for(size_t i = 0; i < length; i++) {
+        unsigned char byte = (unsigned char)value[i];
+        while(true) {
+            size_t child = find_child(trie, node, byte);
+            if(child != NO_NODE) {
+                node = child;
+                break;
+            }
+            if(node == 0) {
+                break;
+            }
+            node = trie->nodes[node].fail;
+        }
+        publish_outputs(trie, trie->nodes[node].output, memoize);
+    }
+}
+
+// Walks the string from one end, every pattern on the path is a prefix or,
+// reversed, a suffix
+static void scan_affixes(const struct pattern_trie* trie, const char* value, size_t length, bool reversed, struct memoize* memoize)
+{
+    size_t node = 0;
+    for(size_t i = 0; node != NO_NODE; i++) {
+        if(trie->nodes[node].memoize_id != INVALID_PRED) {
+            set_memoize(memoize, trie->nodes[node].memoize_id, true);
+        }
+        if(i == length) {
+            break;
+        }
+        node = find_child(trie, node, (unsigned char)value[reversed ? length - 1 - i : i]);
+    }
+}
+
+static void publish_misses(const struct pattern_matcher* matcher, struct memoize* memoize)
+{
+    if(memoize->epochs != NULL) {
+        for(size_t i = 0; i < matcher->memoize_id_count; i++) {
+            set_memoize(memoize, matcher->memoize_ids[i], false);
+        }
+        return;
+    }
+    for(size_t i = 0; i < matcher->fail_word_count; i++) {
+        memoize->fail[i] |= matcher->fail_mask[i];
+    }
+}
+
+void publish_patterns(const struct pred_map* pred_map, const struct betree_variable** preds, struct memoize* memoize)
+{
+    for(size_t i = 0; i < pred_map->pattern_matcher_count; i++) {
+        const struct pattern_matcher* matcher = &pred_map->pattern_matchers[i];
+        const struct betree_variable* pred = preds[matcher->var];
+        if(matcher->stale || pred == NULL || pred->value.value_type != BETREE_STRING) {
+            continue;
+        }
+        const char* value = pred->value.string_value.string;
+        size_t length = strlen(value);
+        // A hit takes precedence over the miss of the same pred
+        publish_misses(matcher, memoize);
+        scan_contains(&matcher->contains, value, length, memoize);
+        scan_affixes(&matcher->prefixes, value, length, false, memoize);
+        scan_affixes(&matcher->suffixes, value, length, true, memoize);
+    }
+}
+
+void copy_patterns(const struct pred_map* pred_map,
+    const struct betree_variable** preds,
+    const struct memoize* from,
+    struct memoize* to)
+{
+    for(size_t i = 0; i < pred_map->pattern_matcher_count; i++) {
+        const struct pattern_matcher* matcher = &pred_map->pattern_matchers[i];
+        const struct betree_variable* pred = preds[matcher->var];
+        if(matcher->stale || pred == NULL || pred->value.value_type != BETREE_STRING) {
+            continue;
+        }
+        if(to->epochs != NULL) {
+            for(size_t j = 0; j < matcher->memoize_id_count; j++) {
+                bool result;
+                if(get_memoize(from, matcher->memoize_ids[j], &result)) {
+                    set_memoize(to, matcher->memoize_ids[j], result);
+                }
+            }
+            continue;
+        }
+        for(size_t w = 0; w < matcher->fail_word_count; w++) {
+            to->pass[w] |= from->pass[w] & matcher->fail_mask[w];
+            to->fail[w] |= from->fail[w] & matcher->fail_mask[w];
+        }
+    }
+}
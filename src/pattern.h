@@ -0,0 +1,69 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "memoize.h"
+#include "value.h"
+
+struct ast_node;
+struct betree_variable;
+struct pred_map;
+
+struct pattern_node {
+    // Children are contiguous and sorted by byte
+    size_t child;
+    size_t child_count;
+    // Aho-Corasick only, node of the longest proper suffix in the trie
+    size_t fail;
+    // Closest node along the fail links, this one included, ending a
+    // pattern, SIZE_MAX when there is none
+    size_t output;
+    // Pred of the pattern ending here, INVALID_PRED when there is none
+    betree_pred_t memoize_id;
+    unsigned char byte;
+};
+
+// Trie in breadth first order, the root first
+struct pattern_trie {
+    size_t node_count;
+    struct pattern_node* nodes;
+};
+
+// Every contains, starts_with and ends_with pattern of a string attribute,
+// the suffixes are reversed
+struct pattern_matcher {
+    betree_var_t var;
+    // One of its preds is gone and its memoize id can be handed to another
+    // pred, the matcher is skipped until the next compile
+    bool stale;
+    struct pattern_trie contains;
+    struct pattern_trie prefixes;
+    struct pattern_trie suffixes;
+    // Memoize ids of every pred of the matcher, as a list and as a bitmap
+    struct {
+        size_t memoize_id_count;
+        betree_pred_t* memoize_ids;
+    };
+    struct {
+        size_t fail_word_count;
+        uint64_t* fail_mask;
+    };
+};
+
+// Builds the matchers from the string preds of the map, giving each of them
+// a memoize id
+void compile_patterns(struct pred_map* pred_map);
+void free_patterns(struct pred_map* pred_map);
+// Called when the last sub using a pred releases it
+void forget_pattern(struct pred_map* pred_map, const struct ast_node* node);
+// Runs the matchers once over each string of the event and stores the result
+// of every one of their preds in memoize
+void publish_patterns(const struct pred_map* pred_map, const struct betree_variable** preds, struct memoize* memoize);
+// Copies the results publish_patterns stored in from over to another memoize
+// of the same search, without running the matchers again
+void copy_patterns(const struct pred_map* pred_map,
+    const struct betree_variable** preds,
+    const struct memoize* from,
+    struct memoize* to);
@@ -0,0 +1,132 @@
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "alloc.h"
+#include "pool.h"
+
+struct worker {
+    struct thread_pool* pool;
+    size_t index;
+    pthread_t thread;
+};
+
+struct thread_pool {
+    size_t thread_count;
+    struct worker* workers;
+    pthread_mutex_t mutex;
+    pthread_cond_t start;
+    pthread_cond_t done;
+    uint64_t generation;
+    size_t running;
+    bool stop;
+    thread_job_t job;
+    void* data;
+};
+
+static void* worker_loop(void* arg)
+{
+    struct worker* worker = arg;
+    struct thread_pool* pool = worker->pool;
+    uint64_t seen = 0;
+    pthread_mutex_lock(&pool->mutex);
+    while(true) {
+        while(!pool->stop && pool->generation == seen) {
+            pthread_cond_wait(&pool->start, &pool->mutex);
+        }
+        if(pool->stop) {
+            break;
+        }
+        seen = pool->generation;
+        thread_job_t job = pool->job;
+        void* data = pool->data;
+        pthread_mutex_unlock(&pool->mutex);
+        job(data, worker->index);
+        pthread_mutex_lock(&pool->mutex);
+        pool->running--;
+        if(pool->running == 0) {
+            pthread_cond_signal(&pool->done);
+        }
+    }
+    pthread_mutex_unlock(&pool->mutex);
+    return NULL;
+}
+
+struct thread_pool* make_thread_pool(size_t thread_count)
+{
+    struct thread_pool* pool = bcalloc(sizeof(*pool));
+    if(pool == NULL) {
+        fprintf(stderr, "%s bcalloc failed\n", __func__);
+        abort();
+    }
+    pool->thread_count = thread_count == 0 ? 1 : thread_count;
+    pool->workers = bcalloc(pool->thread_count * sizeof(*pool->workers));
+    if(pool->workers == NULL) {
+        fprintf(stderr, "%s bcalloc failed\n", __func__);
+        abort();
+    }
+    pthread_mutex_init(&pool->mutex, NULL);
+    pthread_cond_init(&pool->start, NULL);
+    pthread_cond_init(&pool->done, NULL);
+    pool->generation = 0;
+    pool->running = 0;
+    pool->stop = false;
+    pool->job = NULL;
+    pool->data = NULL;
+    // Worker 0 is whoever calls run_thread_pool
+    for(size_t i = 0; i < pool->thread_count; i++) {
+        pool->workers[i].pool = pool;
+        pool->workers[i].index = i;
+        if(i != 0 && pthread_create(&pool->workers[i].thread, NULL, worker_loop, &pool->workers[i]) != 0) {
+            fprintf(stderr, "%s pthread_create failed\n", __func__);
+            abort();
+        }
+    }
+    return pool;
+}
+
+void free_thread_pool(struct thread_pool* pool)
+{
+    if(pool == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&pool->mutex);
+    pool->stop = true;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->mutex);
+    for(size_t i = 1; i < pool->thread_count; i++) {
+        pthread_join(pool->workers[i].thread, NULL);
+    }
+    pthread_cond_destroy(&pool->done);
+    pthread_cond_destroy(&pool->start);
+    pthread_mutex_destroy(&pool->mutex);
+    bfree(pool->workers);
+    bfree(pool);
+}
+
+size_t thread_pool_size(const struct thread_pool* pool)
+{
+    return pool->thread_count;
+}
+
+void run_thread_pool(struct thread_pool* pool, thread_job_t job, void* data)
+{
+    pthread_mutex_lock(&pool->mutex);
+    pool->job = job;
+    pool->data = data;
+    pool->running = pool->thread_count - 1;
+    pool->generation++;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->mutex);
+
+    job(data, 0);
+
+    pthread_mutex_lock(&pool->mutex);
+    while(pool->running != 0) {
+        pthread_cond_wait(&pool->done, &pool->mutex);
+    }
+    pthread_mutex_unlock(&pool->mutex);
+}
+
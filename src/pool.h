@@ -0,0 +1,14 @@
+#pragma once
+
+#include <stddef.h>
+
+// job is called once per worker, worker 0 being the calling thread
+typedef void (*thread_job_t)(void* data, size_t worker);
+
+struct thread_pool;
+
+struct thread_pool* make_thread_pool(size_t thread_count);
+void free_thread_pool(struct thread_pool* pool);
+size_t thread_pool_size(const struct thread_pool* pool);
+void run_thread_pool(struct thread_pool* pool, thread_job_t job, void* data);
+
@@ -0,0 +1,271 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "prefilter.h"
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+// Both outputs are written and only kept when counted, so the compaction
+// does not branch on the result
+static inline void prefilter_one(struct betree_sub* sub,
+    bool is_passed,
+    bool is_failed,
+    struct betree_sub** survivors,
+    struct betree_sub** passed,
+    struct prefilter_result* result)
+{
+    survivors[result->survivor_count] = sub;
+    passed[result->passed_count] = sub;
+    result->failed_count += is_failed;
+    result->passed_count += !is_failed && is_passed;
+    result->survivor_count += !is_failed && !is_passed;
+}
+
+static void prefilter_scalar(size_t from,
+    size_t count,
+    size_t word_count,
+    struct betree_sub* const* subs,
+    const uint64_t* pass,
+    const uint64_t* fail,
+    const uint64_t* undefined,
+    struct betree_sub** survivors,
+    struct betree_sub** passed,
+    struct prefilter_result* result)
+{
+    for(size_t i = from; i < count; i++) {
+        const uint64_t* sub_pass = pass + i * word_count;
+        const uint64_t* sub_fail = fail + i * word_count;
+        uint64_t is_passed = 0, is_failed = 0;
+        for(size_t w = 0; w < word_count; w++) {
+            is_passed |= sub_pass[w] & undefined[w];
+            is_failed |= sub_fail[w] & undefined[w];
+        }
+        prefilter_one(subs[i], is_passed != 0, is_failed != 0, survivors, passed, result);
+    }
+}
+
+#if defined(__x86_64__)
+
+__attribute__((target("sse2"))) static inline __m128i load_sse2(
+    const uint64_t* masks, size_t i, size_t word_count, size_t w)
+{
+    if(word_count == 1) {
+        return _mm_loadu_si128((const __m128i*)(masks + i));
+    }
+    return _mm_set_epi64x(masks[(i + 1) * word_count + w], masks[i * word_count + w]);
+}
+
+// SSE2 has no 64 bit compare, a lane is zero when both its halves are
+__attribute__((target("sse2"))) static inline unsigned nonzero_lanes_sse2(__m128i x)
+{
+    __m128i zero = _mm_cmpeq_epi32(x, _mm_setzero_si128());
+    zero = _mm_and_si128(zero, _mm_shuffle_epi32(zero, _MM_SHUFFLE(2, 3, 0, 1)));
+    return ~(unsigned)_mm_movemask_pd(_mm_castsi128_pd(zero)) & 0x3;
+}
+
+__attribute__((target("sse2"))) static void prefilter_sse2(size_t count,
+    size_t word_count,
+    struct betree_sub* const* subs,
+    const uint64_t* pass,
+    const uint64_t* fail,
+    const uint64_t* undefined,
+    struct betree_sub** survivors,
+    struct betree_sub** passed,
+    struct prefilter_result* result)
+{
+    size_t i = 0;
+    for(; i + 2 <= count; i += 2) {
+        __m128i is_passed = _mm_setzero_si128();
+        __m128i is_failed = _mm_setzero_si128();
+        for(size_t w = 0; w < word_count; w++) {
+            __m128i u = _mm_set1_epi64x(undefined[w]);
+            is_passed = _mm_or_si128(is_passed, _mm_and_si128(load_sse2(pass, i, word_count, w), u));
+            is_failed = _mm_or_si128(is_failed, _mm_and_si128(load_sse2(fail, i, word_count, w), u));
+        }
+        unsigned passed_lanes = nonzero_lanes_sse2(is_passed);
+        unsigned failed_lanes = nonzero_lanes_sse2(is_failed);
+        for(size_t j = 0; j < 2; j++) {
+            prefilter_one(subs[i + j],
+                (passed_lanes >> j) & 1,
+                (failed_lanes >> j) & 1,
+                survivors,
+                passed,
+                result);
+        }
+    }
+    prefilter_scalar(i, count, word_count, subs, pass, fail, undefined, survivors, passed, result);
+}
+
+__attribute__((target("avx2"))) static inline __m256i load_avx2(
+    const uint64_t* masks, size_t i, size_t word_count, size_t w)
+{
+    if(word_count == 1) {
+        return _mm256_loadu_si256((const __m256i*)(masks + i));
+    }
+    return _mm256_set_epi64x(masks[(i + 3) * word_count + w],
+        masks[(i + 2) * word_count + w],
+        masks[(i + 1) * word_count + w],
+        masks[i * word_count + w]);
+}
+
+__attribute__((target("avx2"))) static inline unsigned nonzero_lanes_avx2(__m256i x)
+{
+    __m256i zero = _mm256_cmpeq_epi64(x, _mm256_setzero_si256());
+    return ~(unsigned)_mm256_movemask_pd(_mm256_castsi256_pd(zero)) & 0xF;
+}
+
+__attribute__((target("avx2"))) static void prefilter_avx2(size_t count,
+    size_t word_count,
+    struct betree_sub* const* subs,
+    const uint64_t* pass,
+    const uint64_t* fail,
+    const uint64_t* undefined,
+    struct betree_sub** survivors,
+    struct betree_sub** passed,
+    struct prefilter_result* result)
+{
+    size_t i = 0;
+    for(; i + 4 <= count; i += 4) {
+        __m256i is_passed = _mm256_setzero_si256();
+        __m256i is_failed = _mm256_setzero_si256();
+        for(size_t w = 0; w < word_count; w++) {
+            __m256i u = _mm256_set1_epi64x(undefined[w]);
+            is_passed = _mm256_or_si256(is_passed, _mm256_and_si256(load_avx2(pass, i, word_count, w), u));
+            is_failed = _mm256_or_si256(is_failed, _mm256_and_si256(load_avx2(fail, i, word_count, w), u));
+        }
+        unsigned passed_lanes = nonzero_lanes_avx2(is_passed);
+        unsigned failed_lanes = nonzero_lanes_avx2(is_failed);
+        // All four failing is the common case
+        if(failed_lanes == 0xF) {
+            result->failed_count += 4;
+            continue;
+        }
+        for(size_t j = 0; j < 4; j++) {
+            prefilter_one(subs[i + j],
+                (passed_lanes >> j) & 1,
+                (failed_lanes >> j) & 1,
+                survivors,
+                passed,
+                result);
+        }
+    }
+    prefilter_scalar(i, count, word_count, subs, pass, fail, undefined, survivors, passed, result);
+}
+
+#endif
+
+bool is_prefilter_supported(enum prefilter_e prefilter)
+{
+    switch(prefilter) {
+        case PREFILTER_SCALAR:
+            return true;
+        case PREFILTER_SSE2:
+#if defined(__x86_64__)
+            return true;
+#else
+            return false;
+#endif
+        case PREFILTER_AVX2:
+#if defined(__x86_64__)
+            return __builtin_cpu_supports("avx2");
+#else
+            return false;
+#endif
+        default: abort();
+    }
+}
+
+enum prefilter_e best_prefilter()
+{
+    if(is_prefilter_supported(PREFILTER_AVX2)) {
+        return PREFILTER_AVX2;
+    }
+    if(is_prefilter_supported(PREFILTER_SSE2)) {
+        return PREFILTER_SSE2;
+    }
+    return PREFILTER_SCALAR;
+}
+
+typedef void (*prefilter_fn)(size_t count,
+    size_t word_count,
+    struct betree_sub* const* subs,
+    const uint64_t* pass,
+    const uint64_t* fail,
+    const uint64_t* undefined,
+    struct betree_sub** survivors,
+    struct betree_sub** passed,
+    struct prefilter_result* result);
+
+static void prefilter_scalar_all(size_t count,
+    size_t word_count,
+    struct betree_sub* const* subs,
+    const uint64_t* pass,
+    const uint64_t* fail,
+    const uint64_t* undefined,
+    struct betree_sub** survivors,
+    struct betree_sub** passed,
+    struct prefilter_result* result)
+{
+    prefilter_scalar(0, count, word_count, subs, pass, fail, undefined, survivors, passed, result);
+}
+
+static prefilter_fn get_prefilter_fn(enum prefilter_e prefilter)
+{
+    switch(prefilter) {
+        case PREFILTER_SCALAR:
+            return prefilter_scalar_all;
+#if defined(__x86_64__)
+        case PREFILTER_SSE2:
+            return prefilter_sse2;
+        case PREFILTER_AVX2:
+            return prefilter_avx2;
+#else
+        case PREFILTER_SSE2:
+        case PREFILTER_AVX2:
+#endif
+        default: abort();
+    }
+}
+
+// Picked by the first search, every thread that races on it picks the same
+static prefilter_fn selected_prefilter = NULL;
+
+struct prefilter_result prefilter_short_circuit_with(enum prefilter_e prefilter,
+    size_t count,
+    size_t word_count,
+    struct betree_sub* const* subs,
+    const uint64_t* pass,
+    const uint64_t* fail,
+    const uint64_t* undefined,
+    struct betree_sub** survivors,
+    struct betree_sub** passed)
+{
+    struct prefilter_result result = { .survivor_count = 0, .passed_count = 0, .failed_count = 0 };
+    if(!is_prefilter_supported(prefilter)) {
+        fprintf(stderr, "%s prefilter %d is not supported\n", __func__, prefilter);
+        abort();
+    }
+    get_prefilter_fn(prefilter)(count, word_count, subs, pass, fail, undefined, survivors, passed, &result);
+    return result;
+}
+
+struct prefilter_result prefilter_short_circuit(size_t count,
+    size_t word_count,
+    struct betree_sub* const* subs,
+    const uint64_t* pass,
+    const uint64_t* fail,
+    const uint64_t* undefined,
+    struct betree_sub** survivors,
+    struct betree_sub** passed)
+{
+    prefilter_fn prefilter = __atomic_load_n(&selected_prefilter, __ATOMIC_RELAXED);
+    if(prefilter == NULL) {
+        prefilter = get_prefilter_fn(best_prefilter());
+        __atomic_store_n(&selected_prefilter, prefilter, __ATOMIC_RELAXED);
+    }
+    struct prefilter_result result = { .survivor_count = 0, .passed_count = 0, .failed_count = 0 };
+    prefilter(count, word_count, subs, pass, fail, undefined, survivors, passed, &result);
+    return result;
+}
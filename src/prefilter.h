@@ -0,0 +1,44 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+struct betree_sub;
+
+enum prefilter_e { PREFILTER_SCALAR, PREFILTER_SSE2, PREFILTER_AVX2 };
+
+struct prefilter_result {
+    size_t survivor_count;
+    size_t passed_count;
+    size_t failed_count;
+};
+
+// Short circuit stage of a search. The pass and fail masks of count subs are
+// packed word_count words per sub and tested against the undefined bitmap.
+// Subs forced to pass are compacted into passed, subs not decided into
+// survivors, both need room for count subs. The fastest implementation the
+// CPU supports is picked once, on the first call
+struct prefilter_result prefilter_short_circuit(size_t count,
+    size_t word_count,
+    struct betree_sub* const* subs,
+    const uint64_t* pass,
+    const uint64_t* fail,
+    const uint64_t* undefined,
+    struct betree_sub** survivors,
+    struct betree_sub** passed);
+
+// Same, forcing an implementation and checking the CPU supports it, for
+// tests and benchmarks only
+struct prefilter_result prefilter_short_circuit_with(enum prefilter_e prefilter,
+    size_t count,
+    size_t word_count,
+    struct betree_sub* const* subs,
+    const uint64_t* pass,
+    const uint64_t* fail,
+    const uint64_t* undefined,
+    struct betree_sub** survivors,
+    struct betree_sub** passed);
+
+bool is_prefilter_supported(enum prefilter_e prefilter);
+enum prefilter_e best_prefilter();
@@ -3,6 +3,7 @@
 #include <stdint.h>
 #include <string.h>
 
+#include "ast.h"
 #include "betree.h"
 #include "error.h"
 #include "special.h"
@@ -72,17 +73,63 @@ bool segment_before(
 #define EARTH_RADIUS 6372.8
 #define TO_RAD (3.1415926536 / 180)
 
-bool geo_within_radius(double lat1, double lon1, double lat2, double lon2, double distance)
+// Widens the box past the rounding of the exact distance
+#define GEO_BOUNDS_MARGIN 1e-6
+
+void init_geo_bounds(struct ast_special_geo* geo)
+{
+    double latitude = geo->latitude * TO_RAD;
+    geo->sin_latitude = sin(latitude);
+    geo->cos_latitude = cos(latitude);
+    geo->min_latitude = -INFINITY;
+    geo->max_latitude = INFINITY;
+    geo->longitude_delta = INFINITY;
+    // Centers off the globe and circles reaching past the antipode are only
+    // checked exactly
+    double angle = geo->radius / EARTH_RADIUS;
+    if(!(fabs(geo->latitude) <= 90) || !(angle >= 0 && angle < 180 * TO_RAD)) {
+        return;
+    }
+    double latitude_delta = angle / TO_RAD + GEO_BOUNDS_MARGIN;
+    geo->min_latitude = geo->latitude - latitude_delta;
+    geo->max_latitude = geo->latitude + latitude_delta;
+    // Around a pole, every longitude is in the box
+    if(geo->min_latitude <= -90 || geo->max_latitude >= 90) {
+        return;
+    }
+    geo->longitude_delta = asin(sin(angle) / geo->cos_latitude) / TO_RAD + GEO_BOUNDS_MARGIN;
+}
+
+static bool geo_within_bounds(const struct ast_special_geo* geo, double latitude, double longitude)
 {
+    // Off the globe, the exact distance folds the point back on it
+    if(!(fabs(latitude) <= 90)) {
+        return true;
+    }
+    if(latitude < geo->min_latitude || latitude > geo->max_latitude) {
+        return false;
+    }
+    double longitude_distance = fmod(fabs(longitude - geo->longitude), 360);
+    if(longitude_distance > 180) {
+        longitude_distance = 360 - longitude_distance;
+    }
+    return !(longitude_distance > geo->longitude_delta);
+}
+
+bool geo_within_radius(const struct ast_special_geo* geo, double latitude, double longitude)
+{
+    if(!geo_within_bounds(geo, latitude, longitude)) {
+        return false;
+    }
     double dx, dy, dz;
-    lon1 -= lon2;
-    lon1 *= TO_RAD, lat1 *= TO_RAD, lat2 *= TO_RAD;
+    double lon = (geo->longitude - longitude) * TO_RAD;
+    double lat = latitude * TO_RAD;
 
-    dz = sin(lat1) - sin(lat2);
-    dx = cos(lon1) * cos(lat1) - cos(lat2);
-    dy = sin(lon1) * cos(lat1);
+    dz = geo->sin_latitude - sin(lat);
+    dx = cos(lon) * geo->cos_latitude - cos(lat);
+    dy = sin(lon) * geo->cos_latitude;
 
-    return (asin(sqrt(dx * dx + dy * dy + dz * dz) / 2) * 2 * EARTH_RADIUS) <= distance;
+    return (asin(sqrt(dx * dx + dy * dy + dz * dz) / 2) * 2 * EARTH_RADIUS) <= geo->radius;
 }
 
 bool contains(const char* value, const char* pattern)
@@ -6,6 +6,8 @@
 
 #include "tree.h"
 
+struct ast_special_geo;
+
 bool within_frequency_caps(const struct betree_frequency_caps* caps,
     enum frequency_type_e type,
     uint32_t id,
@@ -17,7 +19,8 @@ bool segment_within(
     int64_t segment_id, int32_t after_seconds, const struct betree_segments* segments, int64_t now);
 bool segment_before(
     int64_t segment_id, int32_t before_seconds, const struct betree_segments* segments, int64_t now);
-bool geo_within_radius(double lat1, double lon1, double lat2, double lon2, double distance);
+void init_geo_bounds(struct ast_special_geo* geo);
+bool geo_within_radius(const struct ast_special_geo* geo, double latitude, double longitude);
 bool contains(const char* value, const char* pattern);
 bool starts_with(const char* value, const char* pattern);
 bool ends_with(const char* value, const char* pattern);
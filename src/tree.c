@@ -1,7 +1,7 @@
-#include <ctype.h>
 #include <float.h>
 #include <inttypes.h>
 #include <math.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -11,158 +11,129 @@
 #include "alloc.h"
 #include "ast.h"
 #include "betree.h"
+#include "bytecode.h"
+#include "eq_index.h"
 #include "error.h"
 #include "hashmap.h"
 #include "memoize.h"
+#include "pattern.h"
+#include "pool.h"
+#include "prefilter.h"
 #include "printer.h"
 #include "tree.h"
 #include "utils.h"
 
-struct subs_to_eval {
-    struct betree_sub** subs;
-    size_t capacity;
-    size_t count;
-};
-
 static void init_subs_to_eval(struct subs_to_eval* subs)
 {
     size_t init = 10;
     subs->subs = bmalloc(init * sizeof(*subs->subs));
     subs->capacity = init;
     subs->count = 0;
+    subs->shorted = 0;
+    subs->indexed = 0;
+    subs->passed_capacity = 0;
+    subs->passed_count = 0;
+    subs->passed = NULL;
+    subs->visit_capacity = 0;
+    subs->visit_count = 0;
+    subs->visits = NULL;
 }
 
-static void add_sub_to_eval(struct betree_sub* sub, struct subs_to_eval* subs)
+static void free_subs_to_eval(struct subs_to_eval* subs)
 {
-    if(subs->capacity == subs->count) {
-        subs->capacity *= 2;
-        subs->subs = brealloc(subs->subs, sizeof(*subs->subs) * subs->capacity);
-    }
-
-    subs->subs[subs->count] = sub;
-    subs->count++;
+    bfree(subs->subs);
+    bfree(subs->passed);
+    bfree(subs->visits);
 }
 
-enum short_circuit_e { SHORT_CIRCUIT_PASS, SHORT_CIRCUIT_FAIL, SHORT_CIRCUIT_NONE };
-
-static enum short_circuit_e try_short_circuit(size_t attr_domains_count,
-    const struct short_circuit* short_circuit, const uint64_t* undefined)
+// Room for count more subs in both lists, for the prefilter to write into
+static void reserve_subs_to_eval(struct subs_to_eval* subs, size_t count)
 {
-    size_t count = attr_domains_count / 64 + 1;
-    for(size_t i = 0; i < count; i++) {
-        bool pass = short_circuit->pass[i] & undefined[i];
-        if(pass) {
-            return SHORT_CIRCUIT_PASS;
+    if(subs->capacity < subs->count + count) {
+        while(subs->capacity < subs->count + count) {
+            subs->capacity *= 2;
         }
-        bool fail = short_circuit->fail[i] & undefined[i];
-        if(fail) {
-            return SHORT_CIRCUIT_FAIL;
+        struct betree_sub** new_subs = brealloc(subs->subs, sizeof(*new_subs) * subs->capacity);
+        if(new_subs == NULL) {
+            fprintf(stderr, "%s brealloc failed\n", __func__);
+            abort();
         }
+        subs->subs = new_subs;
+    }
+    if(subs->passed_capacity < subs->passed_count + count) {
+        if(subs->passed_capacity == 0) {
+            subs->passed_capacity = 10;
+        }
+        while(subs->passed_capacity < subs->passed_count + count) {
+            subs->passed_capacity *= 2;
+        }
+        struct betree_sub** passed = brealloc(subs->passed, sizeof(*passed) * subs->passed_capacity);
+        if(passed == NULL) {
+            fprintf(stderr, "%s brealloc failed\n", __func__);
+            abort();
+        }
+        subs->passed = passed;
     }
-    return SHORT_CIRCUIT_NONE;
 }
 
-static bool match_sub(size_t attr_domains_count,
-    const struct betree_variable** preds,
+enum short_circuit_e { SHORT_CIRCUIT_PASS, SHORT_CIRCUIT_FAIL, SHORT_CIRCUIT_NONE };
+
+static bool match_sub(const struct betree_variable** preds,
     const struct betree_sub* sub,
     struct report* report,
-    struct memoize* memoize,
-    const uint64_t* undefined)
+    struct memoize* memoize)
 {
-    enum short_circuit_e short_circuit = try_short_circuit(attr_domains_count, &sub->short_circuit, undefined);
-    if(short_circuit != SHORT_CIRCUIT_NONE) {
-        if(report != NULL) {
-            report->shorted++;
-        }
-        if(short_circuit == SHORT_CIRCUIT_PASS) {
-            return true;
-        }
-        if(short_circuit == SHORT_CIRCUIT_FAIL) {
-            return false;
-        }
+    if(sub->bytecode != NULL) {
+        return match_bytecode(preds, sub->bytecode, memoize, report);
     }
     bool result = match_node(preds, sub->expr, memoize, report);
     return result;
 }
 
-static void check_sub(const struct lnode* lnode, struct subs_to_eval* subs)
+static void check_sub(const struct lnode* lnode, const uint64_t* undefined, struct subs_to_eval* subs)
 {
-    for(size_t i = 0; i < lnode->sub_count; i++) {
-        struct betree_sub* sub = lnode->subs[i];
-        add_sub_to_eval(sub, subs);
-    }
+    reserve_subs_to_eval(subs, lnode->sub_count);
+    struct prefilter_result result = prefilter_short_circuit(lnode->sub_count,
+        lnode->short_circuit_words,
+        lnode->subs,
+        lnode->short_circuit_pass,
+        lnode->short_circuit_fail,
+        undefined,
+        subs->subs + subs->count,
+        subs->passed + subs->passed_count);
+    subs->count += result.survivor_count;
+    subs->passed_count += result.passed_count;
+    subs->shorted += result.passed_count + result.failed_count;
 }
 
 static struct pnode* search_pdir(betree_var_t variable_id, const struct pdir* pdir)
 {
-    if(pdir == NULL) {
+    if(pdir == NULL || variable_id >= pdir->attr_word_count * 64) {
         return NULL;
     }
-    for(size_t i = 0; i < pdir->pnode_count; i++) {
-        struct pnode* pnode = pdir->pnodes[i];
-        if(variable_id == pnode->attr_var.var) {
-            return pnode;
-        }
-    }
-    return NULL;
-}
-
-static void search_cdir(const struct attr_domain** attr_domains,
-    const struct betree_variable** preds,
-    struct cdir* cdir,
-    struct subs_to_eval* subs, bool open_left, bool open_right);
-
-static bool event_contains_variable(const struct betree_variable** preds, betree_var_t variable_id)
-{
-    return preds[variable_id] != NULL;
-}
-
-static void match_be_tree(const struct attr_domain** attr_domains,
-    const struct betree_variable** preds,
-    const struct cnode* cnode,
-    struct subs_to_eval* subs)
-{
-    check_sub(cnode->lnode, subs);
-    if(cnode->pdir != NULL) {
-        for(size_t i = 0; i < cnode->pdir->pnode_count; i++) {
-            struct pnode* pnode = cnode->pdir->pnodes[i];
-            const struct attr_domain* attr_domain
-                = get_attr_domain(attr_domains, pnode->attr_var.var);
-            if(attr_domain->allow_undefined
-                || event_contains_variable(preds, pnode->attr_var.var)) {
-                search_cdir(attr_domains, preds, pnode->cdir, subs, true, true);
-            }
-        }
-    }
+    return pdir->pnode_index[variable_id];
 }
 
-static bool is_event_enclosed(const struct betree_variable** preds, const struct cdir* cdir, bool open_left, bool open_right)
+static bool is_value_enclosed(const struct betree_variable* pred, const struct value_bound* bound, bool open_left, bool open_right)
 {
-    if(cdir == NULL) {
-        return false;
-    }
-    const struct betree_variable* pred = preds[cdir->attr_var.var];
-    if(pred == NULL) {
-        return true;
-    }
     // No open_left for smin because it's always 0
     switch(pred->value.value_type) {
         case BETREE_BOOLEAN:
-            return (cdir->bound.bmin <= pred->value.boolean_value) && (cdir->bound.bmax >= pred->value.boolean_value);
+            return (bound->bmin <= pred->value.boolean_value) && (bound->bmax >= pred->value.boolean_value);
         case BETREE_INTEGER:
-            return (open_left || cdir->bound.imin <= pred->value.integer_value) && (open_right || cdir->bound.imax >= pred->value.integer_value);
+            return (open_left || bound->imin <= pred->value.integer_value) && (open_right || bound->imax >= pred->value.integer_value);
         case BETREE_FLOAT:
-            return (open_left || cdir->bound.fmin <= pred->value.float_value) && (open_right || cdir->bound.fmax >= pred->value.float_value);
+            return (open_left || bound->fmin <= pred->value.float_value) && (open_right || bound->fmax >= pred->value.float_value);
         case BETREE_STRING:
-            return (cdir->bound.smin <= pred->value.string_value.str) && (open_right || cdir->bound.smax >= pred->value.string_value.str);
+            return (bound->smin <= pred->value.string_value.str) && (open_right || bound->smax >= pred->value.string_value.str);
         case BETREE_INTEGER_ENUM:
-            return (cdir->bound.smin <= pred->value.integer_enum_value.ienum) && (open_right || cdir->bound.smax >= pred->value.integer_enum_value.ienum);
+            return (bound->smin <= pred->value.integer_enum_value.ienum) && (open_right || bound->smax >= pred->value.integer_enum_value.ienum);
         case BETREE_INTEGER_LIST:
             if(pred->value.integer_list_value->count != 0) {
                 int64_t min = pred->value.integer_list_value->integers[0];
                 int64_t max = pred->value.integer_list_value->integers[pred->value.integer_list_value->count - 1];
-                int64_t bound_min = open_left ? INT64_MIN : cdir->bound.imin;
-                int64_t bound_max = open_right ? INT64_MAX : cdir->bound.imax;
+                int64_t bound_min = open_left ? INT64_MIN : bound->imin;
+                int64_t bound_max = open_right ? INT64_MAX : bound->imax;
                 return min <= bound_max && bound_min <= max;
             }
             else {
@@ -172,8 +143,8 @@ static bool is_event_enclosed(const struct betree_variable** preds, const struct
             if(pred->value.string_list_value->count != 0) {
                 size_t min = pred->value.string_list_value->strings[0].str;
                 size_t max = pred->value.string_list_value->strings[pred->value.string_list_value->count - 1].str;
-                size_t bound_min = cdir->bound.smin;
-                size_t bound_max = open_right ? SIZE_MAX : cdir->bound.smax;
+                size_t bound_min = bound->smin;
+                size_t bound_max = open_right ? SIZE_MAX : bound->smax;
                 return min <= bound_max && bound_min <= max;
             }
             else {
@@ -187,6 +158,40 @@ static bool is_event_enclosed(const struct betree_variable** preds, const struct
     return false;
 }
 
+static bool is_event_enclosed(const struct betree_variable** preds, const struct cdir* cdir, bool open_left, bool open_right)
+{
+    if(cdir == NULL) {
+        return false;
+    }
+    const struct betree_variable* pred = preds[cdir->attr_var.var];
+    if(pred == NULL) {
+        return true;
+    }
+    return is_value_enclosed(pred, &cdir->bound, open_left, open_right);
+}
+
+// Position of the attribute among the attributes of the sub
+static size_t attr_rank(const struct betree_sub* sub, betree_var_t variable_id)
+{
+    size_t word = variable_id / 64;
+    size_t rank = 0;
+    for(size_t w = 0; w < word; w++) {
+        rank += (size_t)__builtin_popcountll(sub->attr_vars[w]);
+    }
+    uint64_t below = (UINT64_C(1) << (variable_id % 64)) - 1;
+    return rank + (size_t)__builtin_popcountll(sub->attr_vars[word] & below);
+}
+
+static struct value_bound get_sub_bound(const struct attr_domain* attr_domain, const struct betree_sub* sub)
+{
+    struct sub_bound* cached = &sub->bounds[attr_rank(sub, attr_domain->attr_var.var)];
+    if(cached->version != attr_domain->bound_version) {
+        cached->bound = get_variable_bound(attr_domain, sub->expr);
+        cached->version = attr_domain->bound_version;
+    }
+    return cached->bound;
+}
+
 bool sub_is_enclosed(const struct attr_domain** attr_domains, const struct betree_sub* sub, const struct cdir* cdir)
 {
     if(cdir == NULL) {
@@ -194,7 +199,7 @@ bool sub_is_enclosed(const struct attr_domain** attr_domains, const struct betre
     }
     if(test_bit(sub->attr_vars, cdir->attr_var.var) == true) {
         const struct attr_domain* attr_domain = get_attr_domain(attr_domains, cdir->attr_var.var);
-        struct value_bound bound = get_variable_bound(attr_domain, sub->expr);
+        struct value_bound bound = get_sub_bound(attr_domain, sub);
         switch(attr_domain->bound.value_type) {
             case(BETREE_INTEGER):
             case(BETREE_INTEGER_LIST):
@@ -226,90 +231,437 @@ bool sub_is_enclosed(const struct attr_domain** attr_domains, const struct betre
     return false;
 }
 
-static void search_cdir(const struct attr_domain** attr_domains,
-    const struct betree_variable** preds,
-    struct cdir* cdir,
-    struct subs_to_eval* subs, bool open_left, bool open_right)
+enum search_visit_e {
+    SEARCH_VISIT_CNODE,
+    SEARCH_VISIT_CDIR,
+    // A frozen cdir and the children enclosing the event
+    SEARCH_VISIT_FROZEN,
+    // Every frozen cdir from index on, for an event lacking the attribute
+    SEARCH_VISIT_FROZEN_SCAN,
+};
+
+struct search_visit {
+    enum search_visit_e type;
+    union {
+        const struct cnode* cnode;
+        const struct cdir* cdir;
+        struct {
+            const struct pnode* pnode;
+            size_t index;
+        };
+    };
+    bool open_left;
+    bool open_right;
+};
+
+// Pushing is when the node is known, its memory is prefetched so it is
+// there by the time the lnode being gathered is done
+static void push_visit(struct subs_to_eval* subs, struct search_visit visit)
 {
-    match_be_tree(attr_domains, preds, cdir->cnode, subs);
-    if(is_event_enclosed(preds, cdir->lchild, open_left, false)) {
-        search_cdir(attr_domains, preds, cdir->lchild, subs, open_left, false);
+    if(subs->visit_count == subs->visit_capacity) {
+        size_t capacity = subs->visit_capacity == 0 ? 16 : subs->visit_capacity * 2;
+        struct search_visit* visits = brealloc(subs->visits, sizeof(*visits) * capacity);
+        if(visits == NULL) {
+            fprintf(stderr, "%s brealloc failed\n", __func__);
+            abort();
+        }
+        subs->visits = visits;
+        subs->visit_capacity = capacity;
     }
-    if(is_event_enclosed(preds, cdir->rchild, false, open_right)) {
-        search_cdir(attr_domains, preds, cdir->rchild, subs, false, open_right);
+    switch(visit.type) {
+        case SEARCH_VISIT_CNODE:
+            __builtin_prefetch(visit.cnode->lnode);
+            break;
+        case SEARCH_VISIT_CDIR:
+            __builtin_prefetch(visit.cdir);
+            break;
+        case SEARCH_VISIT_FROZEN:
+        case SEARCH_VISIT_FROZEN_SCAN:
+            __builtin_prefetch(&visit.pnode->frozen[visit.index]);
+            break;
+        default: abort();
     }
+    subs->visits[subs->visit_count++] = visit;
 }
 
-static bool is_used_cnode(betree_var_t variable_id, const struct cnode* cnode);
+static void push_cnode(struct subs_to_eval* subs, const struct cnode* cnode)
+{
+    push_visit(subs, (struct search_visit){ .type = SEARCH_VISIT_CNODE, .cnode = cnode });
+}
 
-static bool is_used_pdir(betree_var_t variable_id, const struct pdir* pdir)
+static void push_pnode(const struct betree_variable** preds, const struct pnode* pnode, struct subs_to_eval* subs)
 {
-    if(pdir == NULL || pdir->parent == NULL) {
-        return false;
+    struct search_visit visit = { .pnode = pnode, .index = 0, .open_left = true, .open_right = true };
+    if(pnode->frozen == NULL) {
+        visit.type = SEARCH_VISIT_CDIR;
+        visit.cdir = pnode->cdir;
+    }
+    else if(preds[pnode->attr_var.var] == NULL) {
+        visit.type = SEARCH_VISIT_FROZEN_SCAN;
+    }
+    else {
+        visit.type = SEARCH_VISIT_FROZEN;
+    }
+    push_visit(subs, visit);
+}
+
+// Only pushes the pnodes the event can reach. When the event lacks an
+// optional attribute whose subs all fail without it, they are counted as
+// shorted without walking the partition. Pushed last to first so they are
+// searched in variable id order
+static void push_pdir(const struct betree_variable** preds,
+    const uint64_t* undefined,
+    const struct pdir* pdir,
+    struct subs_to_eval* subs)
+{
+    for(size_t w = pdir->attr_word_count; w-- > 0;) {
+        uint64_t bits = pdir->attrs[w] & (~undefined[w] | pdir->open_attrs[w]);
+        uint64_t shorted = pdir->optional_attrs[w] & undefined[w] & ~pdir->open_attrs[w];
+        while(bits != 0) {
+            size_t bit = 63 - (size_t)__builtin_clzll(bits);
+            bits &= ~(UINT64_C(1) << bit);
+            push_pnode(preds, pdir->pnode_index[w * 64 + bit], subs);
+        }
+        while(shorted != 0) {
+            size_t variable_id = w * 64 + (size_t)__builtin_ctzll(shorted);
+            shorted &= shorted - 1;
+            subs->shorted += pdir->pnode_index[variable_id]->sub_count;
+        }
     }
-    return is_used_cnode(variable_id, pdir->parent);
 }
 
-static bool is_used_pnode(betree_var_t variable_id, const struct pnode* pnode)
+// Children are pushed right first, a cdir is searched before its left
+// subtree and its left subtree before its right one
+static void push_cdir(const struct betree_variable** preds, struct search_visit visit, struct subs_to_eval* subs)
 {
-    if(pnode == NULL || pnode->parent == NULL) {
-        return false;
+    const struct cdir* cdir = visit.cdir;
+    if(is_event_enclosed(preds, cdir->rchild, false, visit.open_right)) {
+        push_visit(subs,
+            (struct search_visit){
+                .type = SEARCH_VISIT_CDIR, .cdir = cdir->rchild, .open_left = false, .open_right = visit.open_right });
     }
-    if(pnode->attr_var.var == variable_id) {
-        return true;
+    if(is_event_enclosed(preds, cdir->lchild, visit.open_left, false)) {
+        push_visit(subs,
+            (struct search_visit){
+                .type = SEARCH_VISIT_CDIR, .cdir = cdir->lchild, .open_left = visit.open_left, .open_right = false });
     }
-    return is_used_pdir(variable_id, pnode->parent);
+    push_cnode(subs, cdir->cnode);
 }
 
-static bool is_used_cdir(betree_var_t variable_id, const struct cdir* cdir)
+static void push_frozen(const struct betree_variable** preds, struct search_visit visit, struct subs_to_eval* subs)
 {
-    if(cdir == NULL) {
-        return false;
+    const struct frozen_cdir* frozen = visit.pnode->frozen;
+    const struct frozen_cdir* node = &frozen[visit.index];
+    const struct betree_variable* pred = preds[visit.pnode->attr_var.var];
+    struct search_visit child = { .type = SEARCH_VISIT_FROZEN, .pnode = visit.pnode };
+    if(node->right != 0 && is_value_enclosed(pred, &frozen[node->right].bound, false, visit.open_right)) {
+        child.index = node->right;
+        child.open_left = false;
+        child.open_right = visit.open_right;
+        push_visit(subs, child);
     }
-    if(cdir->attr_var.var == variable_id) {
-        return true;
+    if(node->has_left && is_value_enclosed(pred, &frozen[visit.index + 1].bound, visit.open_left, false)) {
+        child.index = visit.index + 1;
+        child.open_left = visit.open_left;
+        child.open_right = false;
+        push_visit(subs, child);
+    }
+    push_cnode(subs, node->cnode);
+}
+
+// Every cdir encloses an undefined value, the frozen cdirs are searched in
+// array order
+static void push_frozen_scan(struct search_visit visit, struct subs_to_eval* subs)
+{
+    if(visit.index + 1 < visit.pnode->frozen_count) {
+        visit.index++;
+        push_visit(subs, visit);
+        visit.index--;
+    }
+    push_cnode(subs, visit.pnode->frozen[visit.index].cnode);
+}
+
+static int compare_sub_ids(const void* a, const void* b)
+{
+    betree_sub_t x = (*(const struct betree_sub* const*)a)->id;
+    betree_sub_t y = (*(const struct betree_sub* const*)b)->id;
+    return (x > y) - (x < y);
+}
+
+static size_t unique_subs(struct betree_sub** subs, size_t count)
+{
+    if(count < 2) {
+        return count;
     }
-    switch(cdir->parent_type) {
-        case CNODE_PARENT_PNODE: {
-            return is_used_pnode(variable_id, cdir->pnode_parent);
+    qsort(subs, count, sizeof(*subs), compare_sub_ids);
+    size_t unique = 1;
+    for(size_t i = 1; i < count; i++) {
+        if(subs[i] != subs[unique - 1]) {
+            subs[unique] = subs[i];
+            unique++;
         }
-        case CNODE_PARENT_CDIR: {
-            return is_used_cdir(variable_id, cdir->cdir_parent);
+    }
+    return unique;
+}
+
+// Subs matched by the lookup alone go straight to passed, the others are
+// evaluated with the tree candidates. Elements of an event list can find
+// the same sub more than once
+static void match_eq_index(const struct eq_index* index, const struct betree_variable** preds, struct subs_to_eval* subs)
+{
+    for(betree_var_t variable_id = 0; variable_id < index->var_count; variable_id++) {
+        const struct betree_variable* pred = preds[variable_id];
+        if(pred == NULL || !is_eq_indexed_var(index, variable_id)) {
+            continue;
+        }
+        size_t value_count = get_pred_value_count(pred);
+        size_t passed_begin = subs->passed_count;
+        size_t count_begin = subs->count;
+        for(size_t i = 0; i < value_count; i++) {
+            uint64_t value;
+            if(!get_pred_value(pred, i, &value)) {
+                continue;
+            }
+            const struct eq_posting* posting = eq_index_probe(index, variable_id, value);
+            if(posting == NULL) {
+                continue;
+            }
+            reserve_subs_to_eval(subs, smax(posting->matched.count, posting->checked.count));
+            for(size_t j = 0; j < posting->matched.count; j++) {
+                subs->passed[subs->passed_count++] = posting->matched.subs[j];
+            }
+            for(size_t j = 0; j < posting->checked.count; j++) {
+                subs->subs[subs->count++] = posting->checked.subs[j];
+            }
+        }
+        if(value_count > 1) {
+            subs->passed_count = passed_begin + unique_subs(subs->passed + passed_begin, subs->passed_count - passed_begin);
+            subs->count = count_begin + unique_subs(subs->subs + count_begin, subs->count - count_begin);
+        }
+        subs->indexed += subs->passed_count - passed_begin;
+    }
+}
+
+// Gathers the subs of every lnode the event reaches. The walk is iterative
+// over an explicit stack, a cnode pushes its pdir before its own lnode is
+// gathered so the next nodes are being fetched meanwhile
+static void match_be_tree(const struct betree_variable** preds,
+    const uint64_t* undefined,
+    const struct cnode* cnode,
+    struct subs_to_eval* subs)
+{
+    if(cnode->eq_index != NULL) {
+        match_eq_index(cnode->eq_index, preds, subs);
+    }
+    subs->visit_count = 0;
+    push_cnode(subs, cnode);
+    while(subs->visit_count != 0) {
+        struct search_visit visit = subs->visits[--subs->visit_count];
+        switch(visit.type) {
+            case SEARCH_VISIT_CNODE:
+                if(visit.cnode->pdir != NULL) {
+                    push_pdir(preds, undefined, visit.cnode->pdir, subs);
+                }
+                check_sub(visit.cnode->lnode, undefined, subs);
+                break;
+            case SEARCH_VISIT_CDIR:
+                push_cdir(preds, visit, subs);
+                break;
+            case SEARCH_VISIT_FROZEN:
+                push_frozen(preds, visit, subs);
+                break;
+            case SEARCH_VISIT_FROZEN_SCAN:
+                push_frozen_scan(visit, subs);
+                break;
+            default: abort();
         }
-        default: abort();
     }
 }
 
 static bool is_used_cnode(betree_var_t variable_id, const struct cnode* cnode)
 {
-    if(cnode == NULL) {
+    if(variable_id >= cnode->used_word_count * 64) {
         return false;
     }
-    if(cnode->parent == NULL) {
-        return false;
+    return test_bit(cnode->used_attrs, variable_id);
+}
+
+static size_t grow_capacity(size_t capacity, size_t count)
+{
+    if(capacity == 0) {
+        capacity = 4;
+    }
+    while(capacity < count) {
+        capacity *= 2;
     }
-    return is_used_cdir(variable_id, cnode->parent);
+    return capacity;
 }
 
-static void insert_sub(const struct betree_sub* sub, struct lnode* lnode)
+static void resize_lnode(struct lnode* lnode, size_t capacity)
 {
-    if(lnode->sub_count == 0) {
-        lnode->subs = bcalloc(sizeof(*lnode->subs));
-        if(lnode->subs == NULL) {
-            fprintf(stderr, "%s bcalloc failed\n", __func__);
-            abort();
-        }
+    lnode->sub_capacity = capacity;
+    if(capacity == 0) {
+        bfree(lnode->subs);
+        bfree(lnode->sub_ids);
+        bfree(lnode->short_circuit_pass);
+        bfree(lnode->short_circuit_fail);
+        lnode->subs = NULL;
+        lnode->sub_ids = NULL;
+        lnode->short_circuit_pass = NULL;
+        lnode->short_circuit_fail = NULL;
+        return;
+    }
+    size_t word_count = lnode->short_circuit_words;
+    struct betree_sub** subs = brealloc(lnode->subs, sizeof(*subs) * capacity);
+    betree_sub_t* sub_ids = brealloc(lnode->sub_ids, sizeof(*sub_ids) * capacity);
+    uint64_t* pass = brealloc(lnode->short_circuit_pass, sizeof(*pass) * capacity * word_count);
+    uint64_t* fail = brealloc(lnode->short_circuit_fail, sizeof(*fail) * capacity * word_count);
+    if(subs == NULL || sub_ids == NULL || pass == NULL || fail == NULL) {
+        fprintf(stderr, "%s brealloc failed\n", __func__);
+        abort();
+    }
+    lnode->subs = subs;
+    lnode->sub_ids = sub_ids;
+    lnode->short_circuit_pass = pass;
+    lnode->short_circuit_fail = fail;
+}
+
+static void reserve_lnode(struct lnode* lnode, size_t count)
+{
+    if(count > lnode->sub_capacity) {
+        resize_lnode(lnode, grow_capacity(lnode->sub_capacity, count));
+    }
+}
+
+// Drops the spare capacity once a bulk operation is done with the lnode
+static void compact_lnode(struct lnode* lnode)
+{
+    if(lnode->sub_capacity != lnode->sub_count) {
+        resize_lnode(lnode, lnode->sub_count);
+    }
+}
+
+static void pack_sub(struct lnode* lnode, size_t index, const struct betree_sub* sub);
+
+// The lnode can predate attributes, the root one predates them all. Widens
+// the packed masks to fit a sub made after them and packs the others again
+static void widen_lnode(struct lnode* lnode, size_t word_count)
+{
+    for(size_t i = 0; i < lnode->sub_count; i++) {
+        word_count = smax(word_count, lnode->subs[i]->word_count);
+    }
+    uint64_t* pass = brealloc(lnode->short_circuit_pass, sizeof(*pass) * lnode->sub_capacity * word_count);
+    uint64_t* fail = brealloc(lnode->short_circuit_fail, sizeof(*fail) * lnode->sub_capacity * word_count);
+    if(pass == NULL || fail == NULL) {
+        fprintf(stderr, "%s brealloc failed\n", __func__);
+        abort();
+    }
+    lnode->short_circuit_pass = pass;
+    lnode->short_circuit_fail = fail;
+    lnode->short_circuit_words = word_count;
+    for(size_t i = 0; i < lnode->sub_count; i++) {
+        pack_sub(lnode, i, lnode->subs[i]);
+    }
+}
+
+static void pack_sub(struct lnode* lnode, size_t index, const struct betree_sub* sub)
+{
+    if(sub->word_count > lnode->short_circuit_words) {
+        widen_lnode(lnode, sub->word_count);
+    }
+    size_t word_count = lnode->short_circuit_words;
+    size_t copied = smin(word_count, sub->word_count);
+    uint64_t* pass = lnode->short_circuit_pass + index * word_count;
+    uint64_t* fail = lnode->short_circuit_fail + index * word_count;
+    lnode->sub_ids[index] = sub->id;
+    memcpy(pass, sub->short_circuit.pass, sizeof(*pass) * copied);
+    memcpy(fail, sub->short_circuit.fail, sizeof(*fail) * copied);
+    memset(pass + copied, 0, sizeof(*pass) * (word_count - copied));
+    memset(fail + copied, 0, sizeof(*fail) * (word_count - copied));
+}
+
+static void repack_lnode(struct lnode* lnode, size_t from)
+{
+    for(size_t i = from; i < lnode->sub_count; i++) {
+        pack_sub(lnode, i, lnode->subs[i]);
+    }
+}
+
+static void grow_attr_counts(struct lnode* lnode, size_t count)
+{
+    size_t capacity = grow_capacity(lnode->attr_count_capacity, count);
+    size_t* attr_counts = brealloc(lnode->attr_counts, sizeof(*attr_counts) * capacity);
+    if(attr_counts == NULL) {
+        fprintf(stderr, "%s brealloc failed\n", __func__);
+        abort();
+    }
+    memset(attr_counts + lnode->attr_count_capacity,
+        0,
+        sizeof(*attr_counts) * (capacity - lnode->attr_count_capacity));
+    lnode->attr_counts = attr_counts;
+    lnode->attr_count_capacity = capacity;
+}
+
+static void count_pnode_sub(struct pnode* pnode, const struct betree_sub* sub, int delta)
+{
+    betree_var_t variable_id = pnode->attr_var.var;
+    pnode->sub_count += delta;
+    if(test_bit(sub->short_circuit.fail, variable_id)) {
+        return;
+    }
+    pnode->open_count += delta;
+    if(pnode->open_count != 0 && test_bit(pnode->parent->optional_attrs, variable_id)) {
+        set_bit(pnode->parent->open_attrs, variable_id);
     }
     else {
-        struct betree_sub** subs = brealloc(lnode->subs, sizeof(*subs) * (lnode->sub_count + 1));
-        if(subs == NULL) {
-            fprintf(stderr, "%s brealloc failed\n", __func__);
-            abort();
+        clear_bit(pnode->parent->open_attrs, variable_id);
+    }
+}
+
+// Keeps the attribute counters of the lnode, of the cdirs above it up to
+// their pnode and of every pnode up to the root, in line with a sub
+// entering (1) or leaving (-1) the lnode
+static void count_sub(struct lnode* lnode, const struct betree_sub* sub, int delta)
+{
+    for(size_t w = 0; w < sub->word_count; w++) {
+        uint64_t bits = sub->attr_vars[w];
+        while(bits != 0) {
+            size_t variable_id = w * 64 + (size_t)__builtin_ctzll(bits);
+            bits &= bits - 1;
+            if(variable_id >= lnode->attr_count_capacity) {
+                grow_attr_counts(lnode, variable_id + 1);
+            }
+            lnode->attr_counts[variable_id] += delta;
+        }
+    }
+    bool in_partition = true;
+    struct cdir* cdir = lnode->parent == NULL ? NULL : lnode->parent->parent;
+    while(cdir != NULL) {
+        if(in_partition && test_bit(sub->attr_vars, cdir->attr_var.var)) {
+            cdir->attr_count += delta;
+        }
+        switch(cdir->parent_type) {
+            case CNODE_PARENT_CDIR:
+                cdir = cdir->cdir_parent;
+                break;
+            case CNODE_PARENT_PNODE:
+                count_pnode_sub(cdir->pnode_parent, sub, delta);
+                in_partition = false;
+                cdir = cdir->pnode_parent->parent->parent->parent;
+                break;
+            default: abort();
         }
-        lnode->subs = subs;
     }
+}
+
+static void insert_sub(const struct betree_sub* sub, struct lnode* lnode)
+{
+    reserve_lnode(lnode, lnode->sub_count + 1);
     lnode->subs[lnode->sub_count] = (struct betree_sub*)sub;
+    lnode->subs[lnode->sub_count]->lnode = lnode;
+    pack_sub(lnode, lnode->sub_count, sub);
     lnode->sub_count++;
+    count_sub(lnode, sub, 1);
 }
 
 static bool is_root(const struct cnode* cnode)
@@ -325,22 +677,6 @@ static void space_clustering(const struct config* config, struct cdir* cdir);
 static struct cdir* insert_cdir(
     const struct config* config, const struct betree_sub* sub, struct cdir* cdir);
 
-static size_t count_attr_in_lnode(betree_var_t variable_id, const struct lnode* lnode);
-
-static size_t count_attr_in_cdir(betree_var_t variable_id, const struct cdir* cdir)
-{
-    if(cdir == NULL) {
-        return 0;
-    }
-    size_t count = 0;
-    if(cdir->cnode != NULL) {
-        count += count_attr_in_lnode(variable_id, cdir->cnode->lnode);
-    }
-    count += count_attr_in_cdir(variable_id, cdir->lchild);
-    count += count_attr_in_cdir(variable_id, cdir->rchild);
-    return count;
-}
-
 static size_t domain_bound_diff(const struct attr_domain* attr_domain)
 {
     const struct value_bound* b = &attr_domain->bound;
@@ -394,47 +730,152 @@ static double get_score(const struct attr_domain** attr_domains, betree_var_t va
 
 static double get_pnode_score(const struct attr_domain** attr_domains, struct pnode* pnode)
 {
-    size_t count = count_attr_in_cdir(pnode->attr_var.var, pnode->cdir);
-    return get_score(attr_domains, pnode->attr_var.var, count);
+    return get_score(attr_domains, pnode->attr_var.var, pnode->cdir->attr_count);
+}
+
+static void update_partition_score(const struct attr_domain** attr_domains, struct pnode* pnode)
+{
+    pnode->score = get_pnode_score(attr_domains, pnode);
 }
 
-static double get_lnode_score(
-    const struct attr_domain** attr_domains, const struct lnode* lnode, betree_var_t var)
+static bool try_insert_eq_index(const struct config* config, const struct betree_sub* sub, struct cnode* cnode)
 {
-    size_t count = count_attr_in_lnode(var, lnode);
-    return get_score(attr_domains, var, count);
+    if(!config->use_eq_index || !is_root(cnode) || !is_eq_indexable(config, sub)) {
+        return false;
+    }
+    if(cnode->eq_index == NULL) {
+        cnode->eq_index = make_eq_index();
+    }
+    eq_index_insert(config, cnode->eq_index, (struct betree_sub*)sub);
+    return true;
 }
 
-static void update_partition_score(const struct attr_domain** attr_domains, struct pnode* pnode)
+static uint64_t hash_sub_id(betree_sub_t id)
 {
-    pnode->score = get_pnode_score(attr_domains, pnode);
+    uint64_t hash = id;
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdULL;
+    hash ^= hash >> 33;
+    hash *= 0xc4ceb9fe1a85ec53ULL;
+    hash ^= hash >> 33;
+    return hash;
 }
 
-bool insert_be_tree(
-    const struct config* config, const struct betree_sub* sub, struct cnode* cnode, struct cdir* cdir)
+// Keeps the slots at most half full
+static void grow_sub_slots(struct cnode* cnode)
 {
-    if(config == NULL) {
-        fprintf(stderr, "Config is NULL, required to insert in the be tree\n");
+    size_t slot_count = cnode->sub_slot_count == 0 ? 16 : cnode->sub_slot_count * 2;
+    struct betree_sub** slots = bcalloc(sizeof(*slots) * slot_count);
+    if(slots == NULL) {
+        fprintf(stderr, "%s bcalloc failed\n", __func__);
         abort();
     }
-    bool foundPartition = false;
-    struct pnode* max_pnode = NULL;
-    if(cnode->pdir != NULL) {
-        float max_score = -DBL_MAX;
-        for(size_t i = 0; i < config->attr_domain_count; i++) {
-            if(test_bit(sub->attr_vars, i) == false) {
-                continue;
-            }
-            betree_var_t variable_id = i;
-            if(!is_used_cnode(variable_id, cnode)) {
-                struct pnode* pnode = search_pdir(variable_id, cnode->pdir);
-                if(pnode != NULL) {
-                    foundPartition = true;
-                    if(max_score < pnode->score) {
-                        max_pnode = pnode;
-                        max_score = pnode->score;
-                    }
-                }
+    size_t mask = slot_count - 1;
+    for(size_t i = 0; i < cnode->sub_slot_count; i++) {
+        struct betree_sub* sub = cnode->sub_slots[i];
+        if(sub == NULL) {
+            continue;
+        }
+        size_t slot = hash_sub_id(sub->id) & mask;
+        while(slots[slot] != NULL) {
+            slot = (slot + 1) & mask;
+        }
+        slots[slot] = sub;
+    }
+    bfree(cnode->sub_slots);
+    cnode->sub_slots = slots;
+    cnode->sub_slot_count = slot_count;
+}
+
+// Ids can repeat, every sub gets its own slot
+static void index_sub(struct cnode* cnode, struct betree_sub* sub)
+{
+    if((cnode->indexed_sub_count + 1) * 2 > cnode->sub_slot_count) {
+        grow_sub_slots(cnode);
+    }
+    size_t mask = cnode->sub_slot_count - 1;
+    size_t slot = hash_sub_id(sub->id) & mask;
+    while(cnode->sub_slots[slot] != NULL) {
+        slot = (slot + 1) & mask;
+    }
+    cnode->sub_slots[slot] = sub;
+    cnode->indexed_sub_count++;
+}
+
+static struct betree_sub* find_indexed_sub(const struct cnode* cnode, betree_sub_t id)
+{
+    if(cnode->sub_slot_count == 0) {
+        return NULL;
+    }
+    size_t mask = cnode->sub_slot_count - 1;
+    size_t slot = hash_sub_id(id) & mask;
+    while(cnode->sub_slots[slot] != NULL) {
+        if(cnode->sub_slots[slot]->id == id) {
+            return cnode->sub_slots[slot];
+        }
+        slot = (slot + 1) & mask;
+    }
+    return NULL;
+}
+
+// Backward shift deletion, keeps every probe sequence free of holes
+static void unindex_sub(struct cnode* cnode, const struct betree_sub* sub)
+{
+    size_t mask = cnode->sub_slot_count - 1;
+    size_t slot = hash_sub_id(sub->id) & mask;
+    while(cnode->sub_slots[slot] != sub) {
+        slot = (slot + 1) & mask;
+    }
+    size_t next = slot;
+    while(true) {
+        next = (next + 1) & mask;
+        struct betree_sub* next_sub = cnode->sub_slots[next];
+        if(next_sub == NULL) {
+            break;
+        }
+        size_t home = hash_sub_id(next_sub->id) & mask;
+        // The sub can move back unless its home is cyclically in (slot, next]
+        bool in_range = slot <= next ? (slot < home && home <= next) : (slot < home || home <= next);
+        if(!in_range) {
+            cnode->sub_slots[slot] = next_sub;
+            slot = next;
+        }
+    }
+    cnode->sub_slots[slot] = NULL;
+    cnode->indexed_sub_count--;
+}
+
+bool insert_be_tree(
+    const struct config* config, const struct betree_sub* sub, struct cnode* cnode, struct cdir* cdir)
+{
+    if(config == NULL) {
+        fprintf(stderr, "Config is NULL, required to insert in the be tree\n");
+        abort();
+    }
+    if(try_insert_eq_index(config, sub, cnode)) {
+        return true;
+    }
+    if(is_root(cnode)) {
+        index_sub(cnode, (struct betree_sub*)sub);
+    }
+    bool foundPartition = false;
+    struct pnode* max_pnode = NULL;
+    if(cnode->pdir != NULL) {
+        float max_score = -DBL_MAX;
+        for(size_t i = 0; i < config->attr_domain_count; i++) {
+            if(test_bit(sub->attr_vars, i) == false) {
+                continue;
+            }
+            betree_var_t variable_id = i;
+            if(!is_used_cnode(variable_id, cnode)) {
+                struct pnode* pnode = search_pdir(variable_id, cnode->pdir);
+                if(pnode != NULL) {
+                    foundPartition = true;
+                    if(max_score < pnode->score) {
+                        max_pnode = pnode;
+                        max_score = pnode->score;
+                    }
+                }
             }
         }
     }
@@ -494,26 +935,27 @@ bool sub_has_attribute_str(struct config* config, const struct betree_sub* sub,
     return sub_has_attribute(sub, variable_id);
 }
 
-static bool remove_sub(betree_sub_t sub, struct lnode* lnode)
+static bool remove_sub(const struct betree_sub* sub, struct lnode* lnode)
 {
     for(size_t i = 0; i < lnode->sub_count; i++) {
-        const struct betree_sub* lnode_sub = lnode->subs[i];
-        if(sub == lnode_sub->id) {
-            for(size_t j = i; j < lnode->sub_count - 1; j++) {
-                lnode->subs[j] = lnode->subs[j + 1];
-            }
+        if(sub == lnode->subs[i]) {
+            count_sub(lnode, lnode->subs[i], -1);
+            size_t word_count = lnode->short_circuit_words;
+            size_t after = lnode->sub_count - i - 1;
+            memmove(lnode->subs + i, lnode->subs + i + 1, sizeof(*lnode->subs) * after);
+            memmove(lnode->sub_ids + i, lnode->sub_ids + i + 1, sizeof(*lnode->sub_ids) * after);
+            memmove(lnode->short_circuit_pass + i * word_count,
+                lnode->short_circuit_pass + (i + 1) * word_count,
+                sizeof(*lnode->short_circuit_pass) * after * word_count);
+            memmove(lnode->short_circuit_fail + i * word_count,
+                lnode->short_circuit_fail + (i + 1) * word_count,
+                sizeof(*lnode->short_circuit_fail) * after * word_count);
             lnode->sub_count--;
             if(lnode->sub_count == 0) {
-                bfree(lnode->subs);
-                lnode->subs = NULL;
+                resize_lnode(lnode, 0);
             }
-            else {
-                struct betree_sub** subs = brealloc(lnode->subs, sizeof(*lnode->subs) * lnode->sub_count);
-                if(subs == NULL) {
-                    fprintf(stderr, "%s brealloc failed\n", __func__);
-                    abort();
-                }
-                lnode->subs = subs;
+            else if(lnode->sub_count * 4 <= lnode->sub_capacity) {
+                resize_lnode(lnode, lnode->sub_count * 2);
             }
             return true;
         }
@@ -523,32 +965,55 @@ static bool remove_sub(betree_sub_t sub, struct lnode* lnode)
 
 static void move(const struct betree_sub* sub, struct lnode* origin, struct lnode* destination)
 {
-    bool isFound = remove_sub(sub->id, origin);
+    bool isFound = remove_sub(sub, origin);
     if(!isFound) {
         fprintf(stderr, "Could not find sub %" PRIu64 "\n", sub->id);
         abort();
     }
-    if(destination->sub_count == 0) {
-        destination->subs = bcalloc(sizeof(*destination->subs));
-        if(destination->subs == NULL) {
-            fprintf(stderr, "%s bcalloc failed\n", __func__);
-            abort();
-        }
+    insert_sub(sub, destination);
+}
+
+static void thaw_pnode(struct pnode* pnode)
+{
+    bfree(pnode->frozen);
+    pnode->frozen = NULL;
+    pnode->frozen_count = 0;
+    pnode->frozen_depth = 0;
+}
+
+static struct pnode* get_cdir_pnode(const struct cdir* cdir)
+{
+    while(cdir->parent_type == CNODE_PARENT_CDIR) {
+        cdir = cdir->cdir_parent;
     }
-    else {
-        struct betree_sub** subs
-            = brealloc(destination->subs, sizeof(*destination->subs) * (destination->sub_count + 1));
-        if(subs == NULL) {
+    return cdir->pnode_parent;
+}
+
+// The cnode of a cdir inherits the attributes used above it, ancestor being
+// the closest cnode up the tree, and adds the cdir attribute
+static void inherit_used_attrs(struct cnode* cnode, const struct cnode* ancestor, betree_var_t variable_id)
+{
+    size_t word_count = smax(cnode->used_word_count, variable_id / 64 + 1);
+    if(word_count > cnode->used_word_count) {
+        uint64_t* used_attrs = brealloc(cnode->used_attrs, sizeof(*used_attrs) * word_count);
+        if(used_attrs == NULL) {
             fprintf(stderr, "%s brealloc failed\n", __func__);
             abort();
         }
-        destination->subs = subs;
+        memset(used_attrs + cnode->used_word_count,
+            0,
+            sizeof(*used_attrs) * (word_count - cnode->used_word_count));
+        cnode->used_attrs = used_attrs;
+        cnode->used_word_count = word_count;
     }
-    destination->subs[destination->sub_count] = (struct betree_sub*)sub;
-    destination->sub_count++;
+    memcpy(cnode->used_attrs,
+        ancestor->used_attrs,
+        sizeof(*cnode->used_attrs) * smin(word_count, ancestor->used_word_count));
+    set_bit(cnode->used_attrs, variable_id);
 }
 
 static struct cdir* create_cdir(const struct config* config,
+    const struct cnode* ancestor,
     const char* attr,
     betree_var_t variable_id,
     struct value_bound bound)
@@ -562,6 +1027,7 @@ static struct cdir* create_cdir(const struct config* config,
     cdir->attr_var.var = variable_id;
     cdir->bound = bound;
     cdir->cnode = make_cnode(config, cdir);
+    inherit_used_attrs(cdir->cnode, ancestor, variable_id);
     cdir->lchild = NULL;
     cdir->rchild = NULL;
     return cdir;
@@ -570,7 +1036,9 @@ static struct cdir* create_cdir(const struct config* config,
 static struct cdir* create_cdir_with_cdir_parent(
     const struct config* config, struct cdir* parent, struct value_bound bound)
 {
-    struct cdir* cdir = create_cdir(config, parent->attr_var.attr, parent->attr_var.var, bound);
+    thaw_pnode(get_cdir_pnode(parent));
+    struct cdir* cdir
+        = create_cdir(config, parent->cnode, parent->attr_var.attr, parent->attr_var.var, bound);
     cdir->parent_type = CNODE_PARENT_CDIR;
     cdir->cdir_parent = parent;
     return cdir;
@@ -579,12 +1047,62 @@ static struct cdir* create_cdir_with_cdir_parent(
 static struct cdir* create_cdir_with_pnode_parent(
     const struct config* config, struct pnode* parent, struct value_bound bound)
 {
-    struct cdir* cdir = create_cdir(config, parent->attr_var.attr, parent->attr_var.var, bound);
+    struct cdir* cdir = create_cdir(
+        config, parent->parent->parent, parent->attr_var.attr, parent->attr_var.var, bound);
     cdir->parent_type = CNODE_PARENT_PNODE;
     cdir->pnode_parent = parent;
     return cdir;
 }
 
+static uint64_t* grow_attr_bits(uint64_t* bits, size_t previous, size_t word_count)
+{
+    bits = brealloc(bits, sizeof(*bits) * word_count);
+    if(bits == NULL) {
+        fprintf(stderr, "%s brealloc failed\n", __func__);
+        abort();
+    }
+    memset(bits + previous, 0, sizeof(*bits) * (word_count - previous));
+    return bits;
+}
+
+static void grow_pdir_index(struct pdir* pdir, size_t word_count)
+{
+    size_t previous = pdir->attr_word_count;
+    struct pnode** pnode_index = brealloc(pdir->pnode_index, sizeof(*pnode_index) * word_count * 64);
+    if(pnode_index == NULL) {
+        fprintf(stderr, "%s brealloc failed\n", __func__);
+        abort();
+    }
+    memset(pnode_index + previous * 64, 0, sizeof(*pnode_index) * (word_count - previous) * 64);
+    pdir->pnode_index = pnode_index;
+    pdir->attrs = grow_attr_bits(pdir->attrs, previous, word_count);
+    pdir->optional_attrs = grow_attr_bits(pdir->optional_attrs, previous, word_count);
+    pdir->open_attrs = grow_attr_bits(pdir->open_attrs, previous, word_count);
+    pdir->attr_word_count = word_count;
+}
+
+static void index_pnode(struct pdir* pdir, struct pnode* pnode, bool allow_undefined)
+{
+    betree_var_t variable_id = pnode->attr_var.var;
+    if(variable_id >= pdir->attr_word_count * 64) {
+        grow_pdir_index(pdir, variable_id / 64 + 1);
+    }
+    pdir->pnode_index[variable_id] = pnode;
+    set_bit(pdir->attrs, variable_id);
+    if(allow_undefined) {
+        set_bit(pdir->optional_attrs, variable_id);
+    }
+}
+
+static void unindex_pnode(struct pdir* pdir, const struct pnode* pnode)
+{
+    betree_var_t variable_id = pnode->attr_var.var;
+    pdir->pnode_index[variable_id] = NULL;
+    clear_bit(pdir->attrs, variable_id);
+    clear_bit(pdir->optional_attrs, variable_id);
+    clear_bit(pdir->open_attrs, variable_id);
+}
+
 struct pnode* create_pdir(
     const struct config* config, const char* attr, betree_var_t variable_id, struct cnode* cnode)
 {
@@ -601,7 +1119,13 @@ struct pnode* create_pdir(
         }
         pdir->parent = cnode;
         pdir->pnode_count = 0;
+        pdir->pnode_capacity = 0;
         pdir->pnodes = NULL;
+        pdir->attr_word_count = 0;
+        pdir->pnode_index = NULL;
+        pdir->attrs = NULL;
+        pdir->optional_attrs = NULL;
+        pdir->open_attrs = NULL;
         cnode->pdir = pdir;
     }
 
@@ -614,7 +1138,12 @@ struct pnode* create_pdir(
     pnode->parent = pdir;
     pnode->attr_var.attr = bstrdup(attr);
     pnode->attr_var.var = variable_id;
+    pnode->frozen_count = 0;
+    pnode->frozen_depth = 0;
+    pnode->frozen = NULL;
     pnode->score = 0.f;
+    pnode->sub_count = 0;
+    pnode->open_count = 0;
     struct value_bound bound;
     bool found = false;
     for(size_t i = 0; i < config->attr_domain_count; i++) {
@@ -631,89 +1160,24 @@ struct pnode* create_pdir(
     }
     pnode->cdir = create_cdir_with_pnode_parent(config, pnode, bound);
 
-    if(pdir->pnode_count == 0) {
-        pdir->pnodes = bcalloc(sizeof(*pdir->pnodes));
-        if(pdir->pnodes == NULL) {
-            fprintf(stderr, "%s pnodes bcalloc failed\n", __func__);
-            abort();
-        }
-    }
-    else {
-        struct pnode** pnodes = brealloc(pdir->pnodes, sizeof(*pnodes) * (pdir->pnode_count + 1));
+    if(pdir->pnode_count == pdir->pnode_capacity) {
+        size_t capacity = grow_capacity(pdir->pnode_capacity, pdir->pnode_count + 1);
+        struct pnode** pnodes = brealloc(pdir->pnodes, sizeof(*pnodes) * capacity);
         if(pnodes == NULL) {
             fprintf(stderr, "%s brealloc failed\n", __func__);
             abort();
         }
         pdir->pnodes = pnodes;
+        pdir->pnode_capacity = capacity;
     }
     pdir->pnodes[pdir->pnode_count] = pnode;
     pdir->pnode_count++;
+    const struct attr_domain* attr_domain
+        = get_attr_domain((const struct attr_domain**)config->attr_domains, variable_id);
+    index_pnode(pdir, pnode, attr_domain->allow_undefined);
     return pnode;
 }
 
-static size_t count_attr_in_lnode(betree_var_t variable_id, const struct lnode* lnode)
-{
-    size_t count = 0;
-    if(lnode == NULL) {
-        return count;
-    }
-    for(size_t i = 0; i < lnode->sub_count; i++) {
-        const struct betree_sub* sub = lnode->subs[i];
-        if(sub == NULL) {
-            fprintf(stderr, "%s, sub is NULL\n", __func__);
-            continue;
-        }
-        if(test_bit(sub->attr_vars, variable_id) == true) {
-            count++;
-        }
-    }
-    return count;
-}
-
-static bool is_attr_used_in_parent_cnode(betree_var_t variable_id, const struct cnode* cnode);
-
-static bool is_attr_used_in_parent_pdir(betree_var_t variable_id, const struct pdir* pdir)
-{
-    return is_attr_used_in_parent_cnode(variable_id, pdir->parent);
-}
-
-static bool is_attr_used_in_parent_pnode(betree_var_t variable_id, const struct pnode* pnode)
-{
-    if(pnode->attr_var.var == variable_id) {
-        return true;
-    }
-    return is_attr_used_in_parent_pdir(variable_id, pnode->parent);
-}
-
-static bool is_attr_used_in_parent_cdir(betree_var_t variable_id, const struct cdir* cdir)
-{
-    if(cdir->attr_var.var == variable_id) {
-        return true;
-    }
-    switch(cdir->parent_type) {
-        case(CNODE_PARENT_CDIR): {
-            return is_attr_used_in_parent_cdir(variable_id, cdir->cdir_parent);
-        }
-        case(CNODE_PARENT_PNODE): {
-            return is_attr_used_in_parent_pnode(variable_id, cdir->pnode_parent);
-        }
-        default: abort();
-    }
-}
-
-static bool is_attr_used_in_parent_cnode(betree_var_t variable_id, const struct cnode* cnode)
-{
-    if(is_root(cnode)) {
-        return false;
-    }
-    return is_attr_used_in_parent_cdir(variable_id, cnode->parent);
-}
-
-static bool is_attr_used_in_parent_lnode(betree_var_t variable_id, const struct lnode* lnode)
-{
-    return is_attr_used_in_parent_cnode(variable_id, lnode->parent);
-}
-
 static bool splitable_attr_domain(
     const struct config* config, const struct attr_domain* attr_domain)
 {
@@ -749,37 +1213,32 @@ static bool splitable_attr_domain(
 }
 
 static bool get_next_highest_score_unused_attr(
-    const struct config* config, const struct lnode* lnode, betree_var_t* var)
+    const struct config* config, const struct lnode* lnode, betree_var_t* var, size_t* var_count)
 {
     bool found = false;
     double highest_score = 0;
-    betree_var_t highest_var;
-    for(size_t i = 0; i < lnode->sub_count; i++) {
-        const struct betree_sub* sub = lnode->subs[i];
-        for(size_t j = 0; j < config->attr_domain_count; j++) {
-            if(test_bit(sub->attr_vars, j) == false) {
-                continue;
-            }
-            betree_var_t current_variable_id = j;
-            const struct attr_domain* attr_domain = get_attr_domain(
-                (const struct attr_domain**)config->attr_domains, current_variable_id);
-            if(splitable_attr_domain(config, attr_domain)
-                && !is_attr_used_in_parent_lnode(current_variable_id, lnode)) {
-                double current_score = get_lnode_score(
-                    (const struct attr_domain**)config->attr_domains, lnode, current_variable_id);
-                found = true;
-                if(current_score > highest_score) {
-                    highest_score = current_score;
-                    highest_var = current_variable_id;
-                }
+    size_t attr_count = smin(config->attr_domain_count, lnode->attr_count_capacity);
+    for(size_t i = 0; i < attr_count; i++) {
+        size_t count = lnode->attr_counts[i];
+        if(count == 0) {
+            continue;
+        }
+        betree_var_t current_variable_id = i;
+        const struct attr_domain* attr_domain
+            = get_attr_domain((const struct attr_domain**)config->attr_domains, current_variable_id);
+        if(splitable_attr_domain(config, attr_domain)
+            && !is_used_cnode(current_variable_id, lnode->parent)) {
+            double current_score = get_score(
+                (const struct attr_domain**)config->attr_domains, current_variable_id, count);
+            if(!found || current_score > highest_score) {
+                highest_score = current_score;
+                *var = current_variable_id;
+                *var_count = count;
             }
+            found = true;
         }
     }
-    if(found == false) {
-        return false;
-    }
-    *var = highest_var;
-    return true;
+    return found;
 }
 
 static void update_cluster_capacity(const struct config* config, struct lnode* lnode)
@@ -793,30 +1252,15 @@ static void update_cluster_capacity(const struct config* config, struct lnode* l
     lnode->max = max;
 }
 
-static size_t count_subs_with_variable(
-    const struct betree_sub** subs, size_t sub_count, betree_var_t variable_id)
-{
-    size_t count = 0;
-    for(size_t i = 0; i < sub_count; i++) {
-        const struct betree_sub* sub = subs[i];
-        if(sub_has_attribute(sub, variable_id)) {
-            count++;
-        }
-    }
-    return count;
-}
-
 static void space_partitioning(const struct config* config, struct cnode* cnode)
 {
     struct lnode* lnode = cnode->lnode;
     while(is_overflowed(lnode) == true) {
-        betree_var_t var;
-        bool found = get_next_highest_score_unused_attr(config, lnode, &var);
-        if(found == false) {
+        betree_var_t var = INVALID_VAR;
+        size_t target_subs_count = 0;
+        if(!get_next_highest_score_unused_attr(config, lnode, &var, &target_subs_count)) {
             break;
         }
-        size_t target_subs_count = count_subs_with_variable(
-            (const struct betree_sub**)lnode->subs, lnode->sub_count, var);
         if(target_subs_count < config->partition_min_size) {
             break;
         }
@@ -872,7 +1316,17 @@ struct lnode* make_lnode(const struct config* config, struct cnode* parent)
     }
     lnode->parent = parent;
     lnode->sub_count = 0;
+    lnode->sub_capacity = 0;
     lnode->subs = NULL;
+    lnode->short_circuit_words = config->attr_domain_count / 64 + 1;
+    lnode->sub_ids = NULL;
+    lnode->short_circuit_pass = NULL;
+    lnode->short_circuit_fail = NULL;
+    lnode->attr_count_capacity = 0;
+    lnode->attr_counts = NULL;
+    if(config->attr_domain_count != 0) {
+        grow_attr_counts(lnode, config->attr_domain_count);
+    }
     lnode->max = config->lnode_max_cap;
     return lnode;
 }
@@ -886,6 +1340,16 @@ struct cnode* make_cnode(const struct config* config, struct cdir* parent)
     }
     cnode->parent = parent;
     cnode->pdir = NULL;
+    cnode->eq_index = NULL;
+    cnode->sub_slot_count = 0;
+    cnode->indexed_sub_count = 0;
+    cnode->sub_slots = NULL;
+    cnode->used_word_count = config->attr_domain_count / 64 + 1;
+    cnode->used_attrs = bcalloc(cnode->used_word_count * sizeof(*cnode->used_attrs));
+    if(cnode->used_attrs == NULL) {
+        fprintf(stderr, "%s bcalloc failed\n", __func__);
+        abort();
+    }
     cnode->lnode = make_lnode(config, cnode);
     return cnode;
 }
@@ -1003,112 +1467,321 @@ static struct value_bounds split_value_bound(struct value_bound bound)
     return bounds;
 }
 
-static void space_clustering(const struct config* config, struct cdir* cdir)
+static void append_subs(struct lnode* lnode, size_t count, struct betree_sub** subs)
 {
-    if(cdir == NULL || cdir->cnode == NULL) {
+    if(count == 0) {
         return;
     }
+    reserve_lnode(lnode, lnode->sub_count + count);
+    memcpy(lnode->subs + lnode->sub_count, subs, sizeof(*subs) * count);
+    lnode->sub_count += count;
+    repack_lnode(lnode, lnode->sub_count - count);
+    for(size_t i = 0; i < count; i++) {
+        subs[i]->lnode = lnode;
+        count_sub(lnode, subs[i], 1);
+    }
+}
+
+static void move_subs_with_variable(struct lnode* origin, betree_var_t variable_id, struct lnode* destination)
+{
+    struct betree_sub** moved = bmalloc(sizeof(*moved) * origin->sub_count);
+    if(moved == NULL) {
+        fprintf(stderr, "%s bmalloc failed\n", __func__);
+        abort();
+    }
+    size_t kept = 0, moved_count = 0;
+    for(size_t i = 0; i < origin->sub_count; i++) {
+        struct betree_sub* sub = origin->subs[i];
+        if(sub_has_attribute(sub, variable_id)) {
+            count_sub(origin, sub, -1);
+            moved[moved_count++] = sub;
+        }
+        else {
+            origin->subs[kept++] = sub;
+        }
+    }
+    origin->sub_count = kept;
+    repack_lnode(origin, 0);
+    compact_lnode(origin);
+    append_subs(destination, moved_count, moved);
+    bfree(moved);
+}
+
+static void move_subs_enclosed(const struct config* config, struct lnode* origin, struct cdir* cdir)
+{
+    struct betree_sub** moved = bmalloc(sizeof(*moved) * origin->sub_count);
+    if(moved == NULL) {
+        fprintf(stderr, "%s bmalloc failed\n", __func__);
+        abort();
+    }
+    size_t kept = 0, moved_count = 0;
+    for(size_t i = 0; i < origin->sub_count; i++) {
+        struct betree_sub* sub = origin->subs[i];
+        if(sub_is_enclosed((const struct attr_domain**)config->attr_domains, sub, cdir)) {
+            count_sub(origin, sub, -1);
+            moved[moved_count++] = sub;
+        }
+        else {
+            origin->subs[kept++] = sub;
+        }
+    }
+    origin->sub_count = kept;
+    repack_lnode(origin, 0);
+    compact_lnode(origin);
+    append_subs(cdir->cnode->lnode, moved_count, moved);
+    bfree(moved);
+}
+
+static void bulk_clustering(const struct config* config, struct cdir* cdir);
+
+static void bulk_partitioning(const struct config* config, struct cnode* cnode)
+{
+    struct lnode* lnode = cnode->lnode;
+    while(is_overflowed(lnode) == true) {
+        betree_var_t var = INVALID_VAR;
+        size_t target_subs_count = 0;
+        if(!get_next_highest_score_unused_attr(config, lnode, &var, &target_subs_count)) {
+            break;
+        }
+        if(target_subs_count < config->partition_min_size) {
+            break;
+        }
+        const char* attr = config->attr_domains[var]->attr_var.attr;
+        struct pnode* pnode = create_pdir(config, attr, var, cnode);
+        move_subs_with_variable(lnode, var, pnode->cdir->cnode->lnode);
+        bulk_clustering(config, pnode->cdir);
+        update_partition_score((const struct attr_domain**)config->attr_domains, pnode);
+    }
+    update_cluster_capacity(config, lnode);
+}
+
+static void bulk_clustering(const struct config* config, struct cdir* cdir)
+{
     struct lnode* lnode = cdir->cnode->lnode;
     if(!is_overflowed(lnode)) {
         return;
     }
-    if(!is_leaf(cdir) || is_atomic(cdir)) {
-        space_partitioning(config, cdir->cnode);
+    if(is_atomic(cdir)) {
+        bulk_partitioning(config, cdir->cnode);
     }
     else {
         struct value_bounds bounds = split_value_bound(cdir->bound);
         cdir->lchild = create_cdir_with_cdir_parent(config, cdir, bounds.lbound);
         cdir->rchild = create_cdir_with_cdir_parent(config, cdir, bounds.rbound);
-        for(size_t i = 0; i < lnode->sub_count; i++) {
-            const struct betree_sub* sub = lnode->subs[i];
-            if(sub_is_enclosed((const struct attr_domain**)config->attr_domains, sub, cdir->lchild)) {
-                move(sub, lnode, cdir->lchild->cnode->lnode);
-                i--;
-            }
-            else if(sub_is_enclosed((const struct attr_domain**)config->attr_domains, sub, cdir->rchild)) {
-                move(sub, lnode, cdir->rchild->cnode->lnode);
-                i--;
-            }
-        }
-        space_partitioning(config, cdir->cnode);
-        space_clustering(config, cdir->lchild);
-        space_clustering(config, cdir->rchild);
+        move_subs_enclosed(config, lnode, cdir->lchild);
+        move_subs_enclosed(config, lnode, cdir->rchild);
+        bulk_partitioning(config, cdir->cnode);
+        bulk_clustering(config, cdir->lchild);
+        bulk_clustering(config, cdir->rchild);
     }
     update_cluster_capacity(config, lnode);
 }
 
-/*static bool search_delete_cdir(size_t attr_domains_count,*/
-    /*const struct attr_domain** attr_domains, struct betree_sub* sub, struct cdir* cdir);*/
-
-/*static bool delete_sub_from_leaf(betree_sub_t sub, struct lnode* lnode)*/
-/*{*/
-    /*return remove_sub(sub, lnode);*/
-/*}*/
-
-/*static bool is_lnode_empty(const struct lnode* lnode)*/
-/*{*/
-    /*return lnode == NULL || lnode->sub_count == 0;*/
-/*}*/
-
-/*static bool is_pdir_empty(const struct pdir* pdir)*/
-/*{*/
-    /*return pdir == NULL || pdir->pnode_count == 0;*/
-/*}*/
-
-/*static bool is_cnode_empty(const struct cnode* cnode)*/
-/*{*/
-    /*return cnode == NULL || (is_lnode_empty(cnode->lnode) && is_pdir_empty(cnode->pdir));*/
-/*}*/
-
-/*static bool is_cdir_empty(const struct cdir* cdir)*/
-/*{*/
-    /*return cdir == NULL*/
-        /*|| (is_cnode_empty(cdir->cnode) && is_cdir_empty(cdir->lchild)*/
-               /*&& is_cdir_empty(cdir->rchild));*/
-/*}*/
-
-/*static bool is_pnode_empty(const struct pnode* pnode)*/
-/*{*/
-    /*return pnode == NULL || (is_cdir_empty(pnode->cdir));*/
-/*}*/
-
-static void free_pnode(struct pnode* pnode);
+static void compact_cnode(struct cnode* cnode);
 
-static void free_pdir(struct pdir* pdir)
+static void compact_cdir(struct cdir* cdir)
 {
-    if(pdir == NULL) {
+    if(cdir == NULL) {
         return;
     }
-    for(size_t i = 0; i < pdir->pnode_count; i++) {
-        struct pnode* pnode = pdir->pnodes[i];
-        free_pnode(pnode);
-    }
-    bfree(pdir->pnodes);
-    pdir->pnodes = NULL;
-    bfree(pdir);
+    compact_cnode(cdir->cnode);
+    compact_cdir(cdir->lchild);
+    compact_cdir(cdir->rchild);
 }
 
-static void free_pred(struct betree_variable* pred)
+static void compact_cnode(struct cnode* cnode)
 {
-    if(pred == NULL) {
+    compact_lnode(cnode->lnode);
+    struct pdir* pdir = cnode->pdir;
+    if(pdir == NULL) {
         return;
     }
-    bfree((char*)pred->attr_var.attr);
-    free_value(pred->value);
-    bfree(pred);
+    if(pdir->pnode_capacity != pdir->pnode_count) {
+        struct pnode** pnodes = brealloc(pdir->pnodes, sizeof(*pnodes) * pdir->pnode_count);
+        if(pnodes == NULL) {
+            fprintf(stderr, "%s brealloc failed\n", __func__);
+            abort();
+        }
+        pdir->pnodes = pnodes;
+        pdir->pnode_capacity = pdir->pnode_count;
+    }
+    for(size_t i = 0; i < pdir->pnode_count; i++) {
+        compact_cdir(pdir->pnodes[i]->cdir);
+    }
 }
 
-void free_sub(struct betree_sub* sub)
+bool bulk_load_be_tree(const struct config* config, size_t count, const struct betree_sub** subs, struct cnode* cnode)
 {
-    if(sub == NULL) {
-        return;
+    if(cnode->lnode->sub_count != 0 || cnode->pdir != NULL) {
+        for(size_t i = 0; i < count; i++) {
+            if(!insert_be_tree(config, subs[i], cnode, NULL)) {
+                return false;
+            }
+        }
+        return true;
+    }
+    struct betree_sub** tree_subs = bmalloc(sizeof(*tree_subs) * (count == 0 ? 1 : count));
+    if(tree_subs == NULL) {
+        fprintf(stderr, "%s bmalloc failed\n", __func__);
+        abort();
+    }
+    size_t tree_count = 0;
+    for(size_t i = 0; i < count; i++) {
+        if(!try_insert_eq_index(config, subs[i], cnode)) {
+            tree_subs[tree_count] = (struct betree_sub*)subs[i];
+            index_sub(cnode, tree_subs[tree_count]);
+            tree_count++;
+        }
+    }
+    append_subs(cnode->lnode, tree_count, tree_subs);
+    bfree(tree_subs);
+    bulk_partitioning(config, cnode);
+    compact_cnode(cnode);
+    freeze_be_tree(cnode);
+    return true;
+}
+
+static size_t count_cdirs(const struct cdir* cdir)
+{
+    if(cdir == NULL) {
+        return 0;
+    }
+    return 1 + count_cdirs(cdir->lchild) + count_cdirs(cdir->rchild);
+}
+
+// Lays the cdir out in preorder from index, returns the depth of its tree
+static size_t freeze_cdir(const struct cdir* cdir, struct frozen_cdir* frozen, size_t* index)
+{
+    struct frozen_cdir* node = &frozen[(*index)++];
+    node->bound = cdir->bound;
+    node->cnode = cdir->cnode;
+    node->has_left = cdir->lchild != NULL;
+    node->right = 0;
+    size_t depth = 0;
+    if(cdir->lchild != NULL) {
+        depth = freeze_cdir(cdir->lchild, frozen, index);
+    }
+    if(cdir->rchild != NULL) {
+        node->right = *index;
+        depth = smax(depth, freeze_cdir(cdir->rchild, frozen, index));
+    }
+    return depth + 1;
+}
+
+static void freeze_pnode(struct pnode* pnode)
+{
+    thaw_pnode(pnode);
+    size_t count = count_cdirs(pnode->cdir);
+    pnode->frozen = bmalloc(count * sizeof(*pnode->frozen));
+    if(pnode->frozen == NULL) {
+        fprintf(stderr, "%s bmalloc failed\n", __func__);
+        abort();
+    }
+    size_t index = 0;
+    pnode->frozen_depth = freeze_cdir(pnode->cdir, pnode->frozen, &index);
+    pnode->frozen_count = count;
+}
+
+static void freeze_cdir_cnodes(const struct cdir* cdir)
+{
+    if(cdir == NULL) {
+        return;
+    }
+    freeze_be_tree(cdir->cnode);
+    freeze_cdir_cnodes(cdir->lchild);
+    freeze_cdir_cnodes(cdir->rchild);
+}
+
+void freeze_be_tree(struct cnode* cnode)
+{
+    if(cnode->pdir == NULL) {
+        return;
+    }
+    for(size_t i = 0; i < cnode->pdir->pnode_count; i++) {
+        struct pnode* pnode = cnode->pdir->pnodes[i];
+        freeze_pnode(pnode);
+        freeze_cdir_cnodes(pnode->cdir);
+    }
+}
+
+static void space_clustering(const struct config* config, struct cdir* cdir)
+{
+    if(cdir == NULL || cdir->cnode == NULL) {
+        return;
+    }
+    struct lnode* lnode = cdir->cnode->lnode;
+    if(!is_overflowed(lnode)) {
+        return;
+    }
+    if(!is_leaf(cdir) || is_atomic(cdir)) {
+        space_partitioning(config, cdir->cnode);
+    }
+    else {
+        struct value_bounds bounds = split_value_bound(cdir->bound);
+        cdir->lchild = create_cdir_with_cdir_parent(config, cdir, bounds.lbound);
+        cdir->rchild = create_cdir_with_cdir_parent(config, cdir, bounds.rbound);
+        for(size_t i = 0; i < lnode->sub_count; i++) {
+            const struct betree_sub* sub = lnode->subs[i];
+            if(sub_is_enclosed((const struct attr_domain**)config->attr_domains, sub, cdir->lchild)) {
+                move(sub, lnode, cdir->lchild->cnode->lnode);
+                i--;
+            }
+            else if(sub_is_enclosed((const struct attr_domain**)config->attr_domains, sub, cdir->rchild)) {
+                move(sub, lnode, cdir->rchild->cnode->lnode);
+                i--;
+            }
+        }
+        space_partitioning(config, cdir->cnode);
+        space_clustering(config, cdir->lchild);
+        space_clustering(config, cdir->rchild);
+    }
+    update_cluster_capacity(config, lnode);
+}
+
+static void free_pnode(struct pnode* pnode);
+
+static void free_pdir(struct pdir* pdir)
+{
+    if(pdir == NULL) {
+        return;
+    }
+    for(size_t i = 0; i < pdir->pnode_count; i++) {
+        struct pnode* pnode = pdir->pnodes[i];
+        free_pnode(pnode);
+    }
+    bfree(pdir->pnodes);
+    pdir->pnodes = NULL;
+    bfree(pdir->pnode_index);
+    bfree(pdir->attrs);
+    bfree(pdir->optional_attrs);
+    bfree(pdir->open_attrs);
+    bfree(pdir);
+}
+
+static void free_pred(struct betree_variable* pred)
+{
+    if(pred == NULL) {
+        return;
+    }
+    bfree((char*)pred->attr_var.attr);
+    free_value(pred->value);
+    bfree(pred);
+}
+
+void free_sub(struct betree_sub* sub)
+{
+    if(sub == NULL) {
+        return;
     }
     bfree(sub->attr_vars);
     sub->attr_vars = NULL;
     free_ast_node((struct ast_node*)sub->expr);
     sub->expr = NULL;
+    free_bytecode(sub->bytecode);
+    sub->bytecode = NULL;
     bfree(sub->short_circuit.pass);
     bfree(sub->short_circuit.fail);
+    bfree(sub->bounds);
     bfree(sub);
 }
 
@@ -1136,8 +1809,8 @@ void free_lnode(struct lnode* lnode)
         const struct betree_sub* sub = lnode->subs[i];
         free_sub((struct betree_sub*)sub);
     }
-    bfree(lnode->subs);
-    lnode->subs = NULL;
+    resize_lnode(lnode, 0);
+    bfree(lnode->attr_counts);
     bfree(lnode);
 }
 
@@ -1150,6 +1823,10 @@ void free_cnode(struct cnode* cnode)
     cnode->lnode = NULL;
     free_pdir(cnode->pdir);
     cnode->pdir = NULL;
+    free_eq_index(cnode->eq_index);
+    cnode->eq_index = NULL;
+    bfree(cnode->sub_slots);
+    bfree(cnode->used_attrs);
     bfree(cnode);
 }
 
@@ -1168,32 +1845,6 @@ static void free_cdir(struct cdir* cdir)
     bfree(cdir);
 }
 
-/*static void try_remove_pnode_from_parent(const struct pnode* pnode)*/
-/*{*/
-    /*struct pdir* pdir = pnode->parent;*/
-    /*for(size_t i = 0; i < pdir->pnode_count; i++) {*/
-        /*if(pnode == pdir->pnodes[i]) {*/
-            /*for(size_t j = i; j < pdir->pnode_count - 1; j++) {*/
-                /*pdir->pnodes[j] = pdir->pnodes[j + 1];*/
-            /*}*/
-            /*pdir->pnode_count--;*/
-            /*if(pdir->pnode_count == 0) {*/
-                /*bfree(pdir->pnodes);*/
-                /*pdir->pnodes = NULL;*/
-            /*}*/
-            /*else {*/
-                /*struct pnode** pnodes = brealloc(pdir->pnodes, sizeof(*pnodes) * pdir->pnode_count);*/
-                /*if(pnodes == NULL) {*/
-                    /*fprintf(stderr, "%s brealloc failed\n", __func__);*/
-                    /*abort();*/
-                /*}*/
-                /*pdir->pnodes = pnodes;*/
-            /*}*/
-            /*return;*/
-        /*}*/
-    /*}*/
-/*}*/
-
 static void free_pnode(struct pnode* pnode)
 {
     if(pnode == NULL) {
@@ -1202,154 +1853,135 @@ static void free_pnode(struct pnode* pnode)
     bfree((char*)pnode->attr_var.attr);
     free_cdir(pnode->cdir);
     pnode->cdir = NULL;
+    bfree(pnode->frozen);
     bfree(pnode);
 }
 
-/*bool betree_delete_inner(size_t attr_domains_count,*/
-    /*const struct attr_domain** attr_domains, struct betree_sub* sub, struct cnode* cnode)*/
-/*{*/
-    /*struct pnode* pnode = NULL;*/
-    /*bool isFound = delete_sub_from_leaf(sub->id, cnode->lnode);*/
-    /*if(!isFound) {*/
-        /*for(size_t i = 0; i < attr_domains_count; i++) {*/
-            /*if(test_bit(sub->attr_vars, i) == false) {*/
-                /*continue;*/
-            /*}*/
-            /*betree_var_t variable_id = i;*/
-            /*pnode = search_pdir(variable_id, cnode->pdir);*/
-            /*if(pnode != NULL) {*/
-                /*isFound = search_delete_cdir(attr_domains_count, attr_domains, sub, pnode->cdir);*/
-            /*}*/
-            /*if(isFound) {*/
-                /*break;*/
-            /*}*/
-        /*}*/
-    /*}*/
-    /*if(isFound) {*/
-        /*if(pnode != NULL && is_pnode_empty(pnode)) {*/
-            /*try_remove_pnode_from_parent(pnode);*/
-            /*free_pnode(pnode);*/
-        /*}*/
-        /*if(cnode != NULL && is_pdir_empty(cnode->pdir)) {*/
-            /*free_pdir(cnode->pdir);*/
-            /*cnode->pdir = NULL;*/
-        /*}*/
-        /*if(!is_root(cnode)) {*/
-            /*if(cnode != NULL && is_lnode_empty(cnode->lnode)) {*/
-                /*free_lnode(cnode->lnode);*/
-                /*cnode->lnode = NULL;*/
-            /*}*/
-            /*if(is_cnode_empty(cnode)) {*/
-                /*cnode->parent->cnode = NULL;*/
-                /*free_cnode(cnode);*/
-            /*}*/
-        /*}*/
-    /*}*/
-    /*return isFound;*/
-/*}*/
-
-static struct betree_sub* find_sub_id_cdir(betree_sub_t id, struct cdir* cdir)
+struct betree_sub* find_sub_id(betree_sub_t id, struct cnode* cnode)
 {
-    if(cdir == NULL) {
-        return NULL;
+    if(cnode->eq_index != NULL) {
+        struct betree_sub* sub = eq_index_find(cnode->eq_index, id);
+        if(sub != NULL) {
+            return sub;
+        }
     }
-    struct betree_sub* in_cnode = find_sub_id(id, cdir->cnode);
-    if(in_cnode != NULL) {
-        return in_cnode;
+    return find_indexed_sub(cnode, id);
+}
+
+static bool is_bucket(const struct cdir* cdir)
+{
+    return is_leaf(cdir) && cdir->cnode->pdir == NULL;
+}
+
+// Half the capacity so a delete right after a split does not merge it back
+static bool can_absorb(const struct lnode* lnode, size_t count)
+{
+    return count == 0 || (lnode->sub_count + count) * 2 <= lnode->max;
+}
+
+static void absorb_lnode(struct lnode* origin, struct lnode* destination)
+{
+    for(size_t i = 0; i < origin->sub_count; i++) {
+        count_sub(origin, origin->subs[i], -1);
     }
-    struct betree_sub* in_lcdir = find_sub_id_cdir(id, cdir->lchild);
-    if(in_lcdir != NULL) {
-        return in_lcdir;
+    append_subs(destination, origin->sub_count, origin->subs);
+    origin->sub_count = 0;
+    resize_lnode(origin, 0);
+}
+
+static void try_merge_cdir_child(struct cdir* cdir, struct cdir** child)
+{
+    if(*child == NULL || !is_bucket(*child)) {
+        return;
     }
-    struct betree_sub* in_rcdir = find_sub_id_cdir(id, cdir->rchild);
-    if(in_rcdir != NULL) {
-        return in_rcdir;
+    struct lnode* lnode = (*child)->cnode->lnode;
+    if(can_absorb(cdir->cnode->lnode, lnode->sub_count)) {
+        absorb_lnode(lnode, cdir->cnode->lnode);
+        thaw_pnode(get_cdir_pnode(cdir));
+        free_cdir(*child);
+        *child = NULL;
     }
-    return NULL;
 }
 
-struct betree_sub* find_sub_id(betree_sub_t id, struct cnode* cnode)
+static void remove_pnode_from_parent(const struct pnode* pnode)
 {
-    if(cnode == NULL) {
-        return NULL;
-    }
-    for(size_t i = 0; i < cnode->lnode->sub_count; i++) {
-        if(cnode->lnode->subs[i]->id == id) {
-            return cnode->lnode->subs[i];
+    struct pdir* pdir = pnode->parent;
+    for(size_t i = 0; i < pdir->pnode_count; i++) {
+        if(pnode == pdir->pnodes[i]) {
+            unindex_pnode(pdir, pnode);
+            for(size_t j = i; j < pdir->pnode_count - 1; j++) {
+                pdir->pnodes[j] = pdir->pnodes[j + 1];
+            }
+            pdir->pnode_count--;
+            return;
         }
     }
-    if(cnode->pdir != NULL) {
-        for(size_t i = 0; i < cnode->pdir->pnode_count; i++) {
-            struct betree_sub* in_cdir = find_sub_id_cdir(id, cnode->pdir->pnodes[i]->cdir);
-            if(in_cdir != NULL) {
-                return in_cdir;
+}
+
+static void try_merge_pnode(struct pnode* pnode)
+{
+    struct pdir* pdir = pnode->parent;
+    struct cnode* cnode = pdir->parent;
+    if(!is_bucket(pnode->cdir)) {
+        return;
+    }
+    struct lnode* lnode = pnode->cdir->cnode->lnode;
+    if(!can_absorb(cnode->lnode, lnode->sub_count)) {
+        return;
+    }
+    absorb_lnode(lnode, cnode->lnode);
+    remove_pnode_from_parent(pnode);
+    free_pnode(pnode);
+    if(pdir->pnode_count == 0) {
+        free_pdir(pdir);
+        cnode->pdir = NULL;
+    }
+}
+
+// Walks from the cnode that lost a sub up to the root, folding empty or
+// under-filled buckets back into their parents
+static void collapse_cnode(struct cnode* cnode)
+{
+    while(!is_root(cnode)) {
+        struct cdir* cdir = cnode->parent;
+        try_merge_cdir_child(cdir, &cdir->lchild);
+        try_merge_cdir_child(cdir, &cdir->rchild);
+        switch(cdir->parent_type) {
+            case CNODE_PARENT_CDIR:
+                cnode = cdir->cdir_parent->cnode;
+                break;
+            case CNODE_PARENT_PNODE: {
+                cnode = cdir->pnode_parent->parent->parent;
+                try_merge_pnode(cdir->pnode_parent);
+                break;
             }
+            default: abort();
         }
     }
-    return NULL;
 }
 
-/*static bool is_empty(struct cdir* cdir)*/
-/*{*/
-    /*return is_cdir_empty(cdir);*/
-/*}*/
-
-/*static void remove_bucket(struct cdir* cdir)*/
-/*{*/
-    /*free_cdir(cdir);*/
-/*}*/
-
-/*static void try_remove_cdir_from_parent(struct cdir* cdir)*/
-/*{*/
-    /*switch(cdir->parent_type) {*/
-        /*case CNODE_PARENT_CDIR: {*/
-            /*if(cdir->cdir_parent->lchild == cdir) {*/
-                /*cdir->cdir_parent->lchild = NULL;*/
-            /*}*/
-            /*else if(cdir->cdir_parent->rchild == cdir) {*/
-                /*cdir->cdir_parent->rchild = NULL;*/
-            /*}*/
-            /*break;*/
-        /*}*/
-        /*case CNODE_PARENT_PNODE: {*/
-            /*cdir->pnode_parent->cdir = NULL;*/
-            /*break;*/
-        /*}*/
-        /*default: {*/
-            /*switch_default_error("Invalid cdir parent type");*/
-        /*}*/
-    /*}*/
-/*}*/
-
-/*static bool search_delete_cdir(size_t attr_domains_count,*/
-    /*const struct attr_domain** attr_domains, struct betree_sub* sub, struct cdir* cdir)*/
-/*{*/
-    /*bool isFound = false;*/
-    /*if(sub_is_enclosed(attr_domains, sub, cdir->lchild)) {*/
-        /*isFound = search_delete_cdir(attr_domains_count, attr_domains, sub, cdir->lchild);*/
-    /*}*/
-    /*else if(sub_is_enclosed(attr_domains, sub, cdir->rchild)) {*/
-        /*isFound = search_delete_cdir(attr_domains_count, attr_domains, sub, cdir->rchild);*/
-    /*}*/
-    /*else {*/
-        /*isFound = betree_delete_inner(attr_domains_count, attr_domains, sub, cdir->cnode);*/
-    /*}*/
-    /*if(isFound) {*/
-        /*if(is_empty(cdir->lchild)) {*/
-            /*remove_bucket(cdir->lchild);*/
-            /*cdir->lchild = NULL;*/
-        /*}*/
-        /*if(is_empty(cdir->rchild)) {*/
-            /*remove_bucket(cdir->rchild);*/
-            /*cdir->rchild = NULL;*/
-        /*}*/
-        /*if(is_empty(cdir)) {*/
-            /*try_remove_cdir_from_parent(cdir);*/
-            /*free_cdir(cdir);*/
-        /*}*/
-    /*}*/
-    /*return isFound;*/
-/*}*/
+bool betree_delete_inner(struct config* config, betree_sub_t id, struct cnode* cnode)
+{
+    if(cnode->eq_index != NULL) {
+        struct betree_sub* sub = eq_index_remove(config, cnode->eq_index, id);
+        if(sub != NULL) {
+            release_pred(config->pred_map, sub->expr);
+            free_sub(sub);
+            return true;
+        }
+    }
+    struct betree_sub* sub = find_indexed_sub(cnode, id);
+    if(sub == NULL) {
+        return false;
+    }
+    struct lnode* lnode = sub->lnode;
+    unindex_sub(cnode, sub);
+    remove_sub(sub, lnode);
+    release_pred(config->pred_map, sub->expr);
+    free_sub(sub);
+    collapse_cnode(lnode->parent);
+    return true;
+}
 
 struct betree_variable* make_pred(const char* attr, betree_var_t variable_id, struct value value)
 {
@@ -1594,8 +2226,15 @@ struct betree_sub* make_sub(struct config* config, betree_sub_t id, struct ast_n
     sub->id = id;
     size_t count = config->attr_domain_count / 64 + 1;
     sub->attr_vars = bcalloc(count * sizeof(*sub->attr_vars));
+    sub->word_count = count;
     sub->expr = expr;
+    sub->bytecode = config->use_bytecode ? compile_bytecode(config->pred_map, expr) : NULL;
     fill_pred(sub, sub->expr);
+    sub->bound_count = 0;
+    for(size_t i = 0; i < count; i++) {
+        sub->bound_count += (size_t)__builtin_popcountll(sub->attr_vars[i]);
+    }
+    sub->bounds = bcalloc(sub->bound_count * sizeof(*sub->bounds));
     sub->short_circuit.pass = bcalloc(count * sizeof(*sub->short_circuit.pass));
     sub->short_circuit.fail = bcalloc(count * sizeof(*sub->short_circuit.fail));
     fill_short_circuit(config, sub);
@@ -1622,22 +2261,6 @@ const char* get_attr_for_id(const struct config* config, betree_var_t variable_i
     return NULL;
 }
 
-betree_var_t try_get_id_for_attr(const struct config* config, const char* attr)
-{
-    char* copy = bstrdup(attr);
-    for(size_t i = 0; copy[i]; i++) {
-        copy[i] = tolower(copy[i]);
-    }
-    for(size_t i = 0; i < config->attr_domain_count; i++) {
-        if(strcmp(config->attr_domains[i]->attr_var.attr, copy) == 0) {
-            bfree(copy);
-            return i;
-        }
-    }
-    bfree(copy);
-    return INVALID_VAR;
-}
-
 void event_to_string(const struct betree_event* event, char* buffer)
 {
     size_t length = 0;
@@ -1702,50 +2325,177 @@ struct memoize make_memoize(size_t pred_count)
     struct memoize memoize = {
         .pass = bcalloc(count * sizeof(*memoize.pass)),
         .fail = bcalloc(count * sizeof(*memoize.fail)),
+        .epochs = NULL,
+        .epoch = 0,
     };
     return memoize;
 }
 
+struct memoize make_epoch_memoize(size_t pred_count)
+{
+    // Slots start at epoch 0, which is never current
+    struct memoize memoize = {
+        .pass = NULL,
+        .fail = NULL,
+        .epochs = bcalloc((pred_count + 1) * sizeof(*memoize.epochs)),
+        .epoch = 1,
+    };
+    if(memoize.epochs == NULL) {
+        fprintf(stderr, "%s bcalloc failed\n", __func__);
+        abort();
+    }
+    return memoize;
+}
+
+void reset_memoize(struct memoize* memoize, size_t pred_count)
+{
+    if(memoize->epochs != NULL) {
+        if(memoize->epoch == MAX_MEMOIZE_EPOCH) {
+            memset(memoize->epochs, 0, (pred_count + 1) * sizeof(*memoize->epochs));
+            memoize->epoch = 0;
+        }
+        memoize->epoch++;
+        return;
+    }
+    size_t count = pred_count / 64 + 1;
+    memset(memoize->pass, 0, count * sizeof(*memoize->pass));
+    memset(memoize->fail, 0, count * sizeof(*memoize->fail));
+}
+
 void free_memoize(struct memoize memoize)
 {
     bfree(memoize.pass);
     bfree(memoize.fail);
+    bfree(memoize.epochs);
 }
 
-static uint64_t* make_undefined(size_t attr_domain_count, const struct betree_variable** preds)
+// Memoize stores that are reused across searches, cleared with reset_memoize
+static struct memoize make_search_memoize(const struct config* config)
+{
+    if(config->use_epoch_memoize) {
+        return make_epoch_memoize(config->pred_map->memoize_count);
+    }
+    return make_memoize(config->pred_map->memoize_count);
+}
+
+static bool search_memoize_fits(const struct config* config, const struct memoize* memoize, size_t memoize_count)
+{
+    if(memoize->pass == NULL && memoize->epochs == NULL) {
+        return false;
+    }
+    if((memoize->epochs != NULL) != config->use_epoch_memoize) {
+        return false;
+    }
+    return config->pred_map->memoize_count <= memoize_count;
+}
+
+static void fill_undefined(size_t attr_domain_count, const struct betree_variable** preds, uint64_t* undefined)
 {
-    size_t count = attr_domain_count / 64 + 1;
-    uint64_t* undefined = bcalloc(count * sizeof(*undefined));
     for(size_t i = 0; i < attr_domain_count; i++) {
         if(preds[i] == NULL) {
             set_bit(undefined, i);
         }
     }
+}
+
+static uint64_t* make_undefined(size_t attr_domain_count, const struct betree_variable** preds)
+{
+    size_t count = attr_domain_count / 64 + 1;
+    uint64_t* undefined = bcalloc(count * sizeof(*undefined));
+    fill_undefined(attr_domain_count, preds, undefined);
     return undefined;
 }
 
 static void add_sub(betree_sub_t id, struct report* report)
 {
-    if(report->matched == 0) {
-        report->subs = bcalloc(sizeof(*report->subs));
-        if(report->subs == NULL) {
-            fprintf(stderr, "%s bcalloc failed", __func__);
-            abort();
+    if(report->matched == report->capacity) {
+        if(report->external) {
+            report->dropped++;
+            return;
         }
-    }
-    else {
-        betree_sub_t* subs
-            = brealloc(report->subs, sizeof(*report->subs) * (report->matched + 1));
+        size_t capacity = report->capacity == 0 ? 8 : report->capacity * 2;
+        betree_sub_t* subs = brealloc(report->subs, sizeof(*report->subs) * capacity);
         if(subs == NULL) {
             fprintf(stderr, "%s brealloc failed", __func__);
             abort();
         }
         report->subs = subs;
+        report->capacity = capacity;
     }
     report->subs[report->matched] = id;
     report->matched++;
 }
 
+static void report_shorted(const struct subs_to_eval* subs, struct report* report)
+{
+    report->evaluated += subs->shorted + subs->indexed;
+    report->shorted += subs->shorted;
+    for(size_t i = 0; i < subs->passed_count; i++) {
+        add_sub(subs->passed[i]->id, report);
+    }
+}
+
+static void evaluate_subs(const struct betree_variable** preds,
+    const struct subs_to_eval* subs,
+    struct report* report,
+    struct memoize* memoize)
+{
+    report_shorted(subs, report);
+    for(size_t i = 0; i < subs->count; i++) {
+        const struct betree_sub* sub = subs->subs[i];
+        report->evaluated++;
+        if(match_sub(preds, sub, report, memoize) == true) {
+            add_sub(sub->id, report);
+        }
+    }
+}
+
+// The compiled string patterns are only worth running when a sub is left to
+// evaluate
+static void publish_subs_patterns(const struct config* config,
+    const struct betree_variable** preds,
+    const struct subs_to_eval* subs,
+    struct memoize* memoize)
+{
+    if(subs->count != 0) {
+        publish_patterns(config->pred_map, preds, memoize);
+    }
+}
+
+static void search_be_tree(const struct config* config,
+    const struct betree_variable** preds,
+    const struct cnode* cnode,
+    struct report* report,
+    struct memoize* memoize,
+    const uint64_t* undefined,
+    struct subs_to_eval* subs)
+{
+    match_be_tree(preds, undefined, cnode, subs);
+    publish_subs_patterns(config, preds, subs, memoize);
+    evaluate_subs(preds, subs, report, memoize);
+}
+
+static bool exists_be_tree(const struct config* config,
+    const struct betree_variable** preds,
+    const struct cnode* cnode,
+    struct memoize* memoize,
+    const uint64_t* undefined,
+    struct subs_to_eval* subs)
+{
+    match_be_tree(preds, undefined, cnode, subs);
+    if(subs->passed_count != 0) {
+        return true;
+    }
+    publish_subs_patterns(config, preds, subs, memoize);
+    for(size_t i = 0; i < subs->count; i++) {
+        const struct betree_sub* sub = subs->subs[i];
+        if(match_sub(preds, sub, NULL, memoize) == true) {
+            return true;
+        }
+    }
+    return false;
+}
+
 bool betree_search_with_preds(const struct config* config,
     const struct betree_variable** preds,
     const struct cnode* cnode,
@@ -1755,15 +2505,8 @@ bool betree_search_with_preds(const struct config* config,
     struct memoize memoize = make_memoize(config->pred_map->memoize_count);
     struct subs_to_eval subs;
     init_subs_to_eval(&subs);
-    match_be_tree((const struct attr_domain**)config->attr_domains, preds, cnode, &subs);
-    for(size_t i = 0; i < subs.count; i++) {
-        const struct betree_sub* sub = subs.subs[i];
-        report->evaluated++;
-        if(match_sub(config->attr_domain_count, preds, sub, report, &memoize, undefined) == true) {
-            add_sub(sub->id, report);
-        }
-    }
-    bfree(subs.subs);
+    search_be_tree(config, preds, cnode, report, &memoize, undefined, &subs);
+    free_subs_to_eval(&subs);
     free_memoize(memoize);
     bfree(undefined);
     bfree(preds);
@@ -1776,22 +2519,635 @@ bool betree_exists_with_preds(const struct config* config, const struct betree_v
     struct memoize memoize = make_memoize(config->pred_map->memoize_count);
     struct subs_to_eval subs;
     init_subs_to_eval(&subs);
-    match_be_tree((const struct attr_domain**)config->attr_domains, preds, cnode, &subs);
-    bool result = false;
-    for(size_t i = 0; i < subs.count; i++) {
-        const struct betree_sub* sub = subs.subs[i];
-        if(match_sub(config->attr_domain_count, preds, sub, NULL, &memoize, undefined) == true) {
-            result = true;
-            break;
-        }
-    }
-    bfree(subs.subs);
+    bool result = exists_be_tree(config, preds, cnode, &memoize, undefined, &subs);
+    free_subs_to_eval(&subs);
     free_memoize(memoize);
     bfree(undefined);
     bfree(preds);
     return result;
 }
 
+struct betree_search_context* make_search_context(const struct config* config)
+{
+    struct betree_search_context* context = bcalloc(sizeof(*context));
+    if(context == NULL) {
+        fprintf(stderr, "%s bcalloc failed\n", __func__);
+        abort();
+    }
+    context->attr_domain_count = 0;
+    context->memoize_count = 0;
+    context->preds = NULL;
+    context->undefined = NULL;
+    context->memoize.pass = NULL;
+    context->memoize.fail = NULL;
+    context->memoize.epochs = NULL;
+    context->memoize.epoch = 0;
+    init_subs_to_eval(&context->subs);
+    prepare_search_context(config, context);
+    return context;
+}
+
+void free_search_context(struct betree_search_context* context)
+{
+    if(context == NULL) {
+        return;
+    }
+    bfree(context->preds);
+    bfree(context->undefined);
+    free_memoize(context->memoize);
+    free_subs_to_eval(&context->subs);
+    bfree(context);
+}
+
+static void grow_search_context(const struct config* config, struct betree_search_context* context)
+{
+    if(config->attr_domain_count > context->attr_domain_count) {
+        size_t count = config->attr_domain_count / 64 + 1;
+        bfree(context->preds);
+        bfree(context->undefined);
+        context->preds = bcalloc(config->attr_domain_count * sizeof(*context->preds));
+        context->undefined = bcalloc(count * sizeof(*context->undefined));
+        if(context->preds == NULL || context->undefined == NULL) {
+            fprintf(stderr, "%s bcalloc failed\n", __func__);
+            abort();
+        }
+        context->attr_domain_count = config->attr_domain_count;
+    }
+    if(!search_memoize_fits(config, &context->memoize, context->memoize_count)) {
+        free_memoize(context->memoize);
+        context->memoize = make_search_memoize(config);
+        context->memoize_count = config->pred_map->memoize_count;
+    }
+}
+
+void prepare_search_context(const struct config* config, struct betree_search_context* context)
+{
+    grow_search_context(config, context);
+    memset(context->preds, 0, config->attr_domain_count * sizeof(*context->preds));
+    reset_memoize(&context->memoize, context->memoize_count);
+    context->subs.count = 0;
+    context->subs.shorted = 0;
+    context->subs.indexed = 0;
+    context->subs.passed_count = 0;
+}
+
+static void fill_context_undefined(const struct config* config, struct betree_search_context* context)
+{
+    size_t count = config->attr_domain_count / 64 + 1;
+    memset(context->undefined, 0, count * sizeof(*context->undefined));
+    fill_undefined(config->attr_domain_count, context->preds, context->undefined);
+}
+
+bool betree_search_with_context_preds(const struct config* config,
+    const struct cnode* cnode,
+    struct betree_search_context* context,
+    struct report* report)
+{
+    fill_context_undefined(config, context);
+    search_be_tree(config, context->preds, cnode, report, &context->memoize, context->undefined, &context->subs);
+    return true;
+}
+
+bool betree_exists_with_context_preds(const struct config* config,
+    const struct cnode* cnode,
+    struct betree_search_context* context)
+{
+    fill_context_undefined(config, context);
+    return exists_be_tree(config, context->preds, cnode, &context->memoize, context->undefined, &context->subs);
+}
+
+// Candidates are handed out in chunks, each worker drains its own range
+// before stealing chunks from the others
+enum { PARALLEL_CHUNK = 64 };
+
+struct parallel_range {
+    _Atomic size_t next;
+    size_t end;
+};
+
+struct parallel_search {
+    const struct pred_map* pred_map;
+    const struct betree_variable** preds;
+    const struct subs_to_eval* subs;
+    // Memoize the string patterns were published in, on the calling thread
+    const struct memoize* patterns;
+    struct betree_search_pool* pool;
+};
+
+static void parallel_match_job(void* data, size_t worker)
+{
+    struct parallel_search* search = data;
+    struct betree_search_pool* pool = search->pool;
+    struct memoize* memoize = &pool->memoizes[worker];
+    struct report* report = &pool->reports[worker];
+    reset_memoize(memoize, pool->memoize_count);
+    copy_patterns(search->pred_map, search->preds, search->patterns, memoize);
+    size_t worker_count = thread_pool_size(pool->pool);
+    for(size_t i = 0; i < worker_count; i++) {
+        struct parallel_range* range = &pool->ranges[(worker + i) % worker_count];
+        while(true) {
+            size_t begin = atomic_fetch_add(&range->next, PARALLEL_CHUNK);
+            if(begin >= range->end) {
+                break;
+            }
+            size_t end = smin(begin + PARALLEL_CHUNK, range->end);
+            for(size_t j = begin; j < end; j++) {
+                report->evaluated++;
+                pool->matched[j] = match_sub(search->preds, search->subs->subs[j], report, memoize);
+            }
+        }
+    }
+}
+
+static void grow_search_pool(const struct config* config, struct betree_search_pool* pool, size_t count)
+{
+    size_t worker_count = thread_pool_size(pool->pool);
+    if(!search_memoize_fits(config, &pool->memoizes[0], pool->memoize_count)) {
+        for(size_t i = 0; i < worker_count; i++) {
+            free_memoize(pool->memoizes[i]);
+            pool->memoizes[i] = make_search_memoize(config);
+        }
+        pool->memoize_count = config->pred_map->memoize_count;
+    }
+    if(count > pool->matched_capacity) {
+        bfree(pool->matched);
+        pool->matched = bmalloc(count * sizeof(*pool->matched));
+        if(pool->matched == NULL) {
+            fprintf(stderr, "%s bmalloc failed\n", __func__);
+            abort();
+        }
+        pool->matched_capacity = count;
+    }
+}
+
+static void search_subs_parallel(const struct config* config,
+    const struct betree_variable** preds,
+    const struct subs_to_eval* subs,
+    const struct memoize* patterns,
+    struct betree_search_pool* pool,
+    struct report* report)
+{
+    size_t worker_count = thread_pool_size(pool->pool);
+    grow_search_pool(config, pool, subs->count);
+    size_t share = subs->count / worker_count + 1;
+    for(size_t i = 0; i < worker_count; i++) {
+        size_t begin = smin(i * share, subs->count);
+        atomic_store(&pool->ranges[i].next, begin);
+        pool->ranges[i].end = smin(begin + share, subs->count);
+        memset(&pool->reports[i], 0, sizeof(pool->reports[i]));
+    }
+    struct parallel_search search
+        = { .pred_map = config->pred_map, .preds = preds, .subs = subs, .patterns = patterns, .pool = pool };
+    run_thread_pool(pool->pool, parallel_match_job, &search);
+    report_shorted(subs, report);
+    for(size_t i = 0; i < worker_count; i++) {
+        report->evaluated += pool->reports[i].evaluated;
+        report->memoized += pool->reports[i].memoized;
+        report->shorted += pool->reports[i].shorted;
+    }
+    // Merging in candidate order keeps the result identical to a serial search
+    for(size_t i = 0; i < subs->count; i++) {
+        if(pool->matched[i]) {
+            add_sub(subs->subs[i]->id, report);
+        }
+    }
+}
+
+struct betree_search_pool* make_search_pool(const struct config* config, size_t thread_count, size_t threshold)
+{
+    struct betree_search_pool* pool = bcalloc(sizeof(*pool));
+    if(pool == NULL) {
+        fprintf(stderr, "%s bcalloc failed\n", __func__);
+        abort();
+    }
+    pool->pool = make_thread_pool(thread_count);
+    pool->threshold = threshold;
+    pool->context = make_search_context(config);
+    size_t worker_count = thread_pool_size(pool->pool);
+    pool->memoize_count = 0;
+    pool->memoizes = bcalloc(worker_count * sizeof(*pool->memoizes));
+    pool->reports = bcalloc(worker_count * sizeof(*pool->reports));
+    pool->ranges = bcalloc(worker_count * sizeof(*pool->ranges));
+    if(pool->memoizes == NULL || pool->reports == NULL || pool->ranges == NULL) {
+        fprintf(stderr, "%s bcalloc failed\n", __func__);
+        abort();
+    }
+    pool->matched = NULL;
+    pool->matched_capacity = 0;
+    return pool;
+}
+
+void free_search_pool(struct betree_search_pool* pool)
+{
+    if(pool == NULL) {
+        return;
+    }
+    size_t worker_count = thread_pool_size(pool->pool);
+    for(size_t i = 0; i < worker_count; i++) {
+        free_memoize(pool->memoizes[i]);
+    }
+    free_thread_pool(pool->pool);
+    free_search_context(pool->context);
+    bfree(pool->memoizes);
+    bfree(pool->reports);
+    bfree(pool->ranges);
+    bfree(pool->matched);
+    bfree(pool);
+}
+
+bool betree_search_with_pool_preds(const struct config* config,
+    const struct cnode* cnode,
+    struct betree_search_pool* pool,
+    struct report* report)
+{
+    struct betree_search_context* context = pool->context;
+    fill_context_undefined(config, context);
+    match_be_tree(context->preds, context->undefined, cnode, &context->subs);
+    // Patterns are run once, workers copy their results
+    publish_subs_patterns(config, context->preds, &context->subs, &context->memoize);
+    if(context->subs.count < pool->threshold || thread_pool_size(pool->pool) == 1) {
+        evaluate_subs(context->preds, &context->subs, report, &context->memoize);
+    }
+    else {
+        search_subs_parallel(config, context->preds, &context->subs, &context->memoize, pool, report);
+    }
+    return true;
+}
+
+// Events are walked down the tree together, each visit of the stack carries
+// the mask of the events it is searched for
+struct batch_search {
+    size_t word_count;
+    const struct betree_variable*** preds;
+    uint64_t** undefined;
+    struct memoize* memoizes;
+    struct report** reports;
+    // Mask of each visit, at its position on the stack
+    struct {
+        size_t mask_capacity;
+        uint64_t* masks;
+    };
+    // Mask of the visit being searched, its slot is reused by the pushes
+    uint64_t* mask;
+    // Events lacking each attribute, a mask per attribute id
+    uint64_t* undefined_events;
+    // Events a sub fails then passes by short circuit
+    uint64_t* short_circuit_events;
+    // Visit stack, and the subs gathered for one event at a time
+    struct subs_to_eval subs;
+};
+
+static bool mask_is_empty(size_t word_count, const uint64_t* mask)
+{
+    for(size_t i = 0; i < word_count; i++) {
+        if(mask[i] != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Slot of the next visit pushed, valid until the next call
+static uint64_t* next_batch_mask(struct batch_search* batch)
+{
+    size_t count = (batch->subs.visit_count + 1) * batch->word_count;
+    if(count > batch->mask_capacity) {
+        size_t capacity = smax(count, batch->mask_capacity * 2);
+        uint64_t* masks = brealloc(batch->masks, sizeof(*masks) * capacity);
+        if(masks == NULL) {
+            fprintf(stderr, "%s brealloc failed\n", __func__);
+            abort();
+        }
+        batch->masks = masks;
+        batch->mask_capacity = capacity;
+    }
+    return batch->masks + batch->subs.visit_count * batch->word_count;
+}
+
+// The mask is the one from next_batch_mask, a visit no event reaches is
+// dropped
+static void push_batch_visit(struct batch_search* batch, struct search_visit visit, const uint64_t* mask)
+{
+    if(!mask_is_empty(batch->word_count, mask)) {
+        push_visit(&batch->subs, visit);
+    }
+}
+
+static void push_batch_cnode(struct batch_search* batch, const struct cnode* cnode)
+{
+    uint64_t* mask = next_batch_mask(batch);
+    memcpy(mask, batch->mask, sizeof(*mask) * batch->word_count);
+    push_batch_visit(batch, (struct search_visit){ .type = SEARCH_VISIT_CNODE, .cnode = cnode }, mask);
+}
+
+// Events of the mask a short circuit mask applies to, every attribute of the
+// mask adds the events lacking it
+static void short_circuit_events(const struct batch_search* batch, size_t word_count, const uint64_t* attrs, uint64_t* events)
+{
+    memset(events, 0, sizeof(*events) * batch->word_count);
+    for(size_t u = 0; u < word_count; u++) {
+        uint64_t bits = attrs[u];
+        while(bits != 0) {
+            size_t variable_id = u * 64 + (size_t)__builtin_ctzll(bits);
+            bits &= bits - 1;
+            const uint64_t* lacking = batch->undefined_events + variable_id * batch->word_count;
+            for(size_t w = 0; w < batch->word_count; w++) {
+                events[w] |= lacking[w];
+            }
+        }
+    }
+}
+
+// Sub by sub so a sub is evaluated for every event while it is hot. The
+// short circuits are settled for the whole mask at once from the packed
+// masks and the events lacking each attribute
+static void check_sub_batch(struct batch_search* batch, const struct lnode* lnode)
+{
+    size_t word_count = lnode->short_circuit_words;
+    uint64_t* failed = batch->short_circuit_events;
+    uint64_t* passed = batch->short_circuit_events + batch->word_count;
+    for(size_t i = 0; i < lnode->sub_count; i++) {
+        const struct betree_sub* sub = lnode->subs[i];
+        short_circuit_events(batch, word_count, lnode->short_circuit_fail + i * word_count, failed);
+        short_circuit_events(batch, word_count, lnode->short_circuit_pass + i * word_count, passed);
+        for(size_t w = 0; w < batch->word_count; w++) {
+            uint64_t bits = batch->mask[w];
+            while(bits != 0) {
+                size_t bit = (size_t)__builtin_ctzll(bits);
+                bits &= bits - 1;
+                size_t e = w * 64 + bit;
+                struct report* report = batch->reports[e];
+                report->evaluated++;
+                if(failed[w] & (UINT64_C(1) << bit)) {
+                    report->shorted++;
+                }
+                else if(passed[w] & (UINT64_C(1) << bit)) {
+                    report->shorted++;
+                    add_sub(sub->id, report);
+                }
+                else if(match_sub(batch->preds[e], sub, report, &batch->memoizes[e]) == true) {
+                    add_sub(sub->id, report);
+                }
+            }
+        }
+    }
+}
+
+// Keeps the events of the mask defining the variable, or lacking it
+static void filter_defined_batch(const struct batch_search* batch, betree_var_t variable_id, bool defined, uint64_t* mask)
+{
+    for(size_t w = 0; w < batch->word_count; w++) {
+        uint64_t bits = batch->mask[w];
+        mask[w] = bits;
+        while(bits != 0) {
+            size_t bit = (size_t)__builtin_ctzll(bits);
+            bits &= bits - 1;
+            if(test_bit(batch->undefined[w * 64 + bit], variable_id) == defined) {
+                mask[w] &= ~(UINT64_C(1) << bit);
+            }
+        }
+    }
+}
+
+// Same as push_pdir for each event of the mask. A frozen pnode is pushed
+// once for the events defining its attribute and once for the others
+static void push_pdir_batch(struct batch_search* batch, const struct pdir* pdir)
+{
+    for(size_t w = pdir->attr_word_count; w-- > 0;) {
+        uint64_t attrs = pdir->attrs[w];
+        while(attrs != 0) {
+            size_t bit = 63 - (size_t)__builtin_clzll(attrs);
+            attrs &= ~(UINT64_C(1) << bit);
+            betree_var_t variable_id = w * 64 + bit;
+            const struct pnode* pnode = pdir->pnode_index[variable_id];
+            bool open = test_bit(pdir->open_attrs, variable_id);
+            struct search_visit visit = { .pnode = pnode, .index = 0, .open_left = true, .open_right = true };
+            if(!open && test_bit(pdir->optional_attrs, variable_id)) {
+                uint64_t* lacking = next_batch_mask(batch);
+                filter_defined_batch(batch, variable_id, false, lacking);
+                for(size_t m = 0; m < batch->word_count; m++) {
+                    uint64_t bits = lacking[m];
+                    while(bits != 0) {
+                        struct report* report = batch->reports[m * 64 + (size_t)__builtin_ctzll(bits)];
+                        bits &= bits - 1;
+                        report->evaluated += pnode->sub_count;
+                        report->shorted += pnode->sub_count;
+                    }
+                }
+            }
+            if(pnode->frozen == NULL) {
+                visit.type = SEARCH_VISIT_CDIR;
+                visit.cdir = pnode->cdir;
+                uint64_t* mask = next_batch_mask(batch);
+                if(open) {
+                    memcpy(mask, batch->mask, sizeof(*mask) * batch->word_count);
+                }
+                else {
+                    filter_defined_batch(batch, variable_id, true, mask);
+                }
+                push_batch_visit(batch, visit, mask);
+                continue;
+            }
+            visit.type = SEARCH_VISIT_FROZEN;
+            uint64_t* mask = next_batch_mask(batch);
+            filter_defined_batch(batch, variable_id, true, mask);
+            push_batch_visit(batch, visit, mask);
+            if(open) {
+                visit.type = SEARCH_VISIT_FROZEN_SCAN;
+                mask = next_batch_mask(batch);
+                filter_defined_batch(batch, variable_id, false, mask);
+                push_batch_visit(batch, visit, mask);
+            }
+        }
+    }
+}
+
+static void push_cdir_batch(struct batch_search* batch, struct search_visit visit)
+{
+    const struct cdir* cdir = visit.cdir;
+    const struct cdir* children[2] = { cdir->rchild, cdir->lchild };
+    for(size_t c = 0; c < 2; c++) {
+        if(children[c] == NULL) {
+            continue;
+        }
+        struct search_visit child = { .type = SEARCH_VISIT_CDIR,
+            .cdir = children[c],
+            .open_left = c == 1 && visit.open_left,
+            .open_right = c == 0 && visit.open_right };
+        uint64_t* mask = next_batch_mask(batch);
+        for(size_t w = 0; w < batch->word_count; w++) {
+            uint64_t bits = batch->mask[w];
+            mask[w] = bits;
+            while(bits != 0) {
+                size_t bit = (size_t)__builtin_ctzll(bits);
+                bits &= bits - 1;
+                if(!is_event_enclosed(batch->preds[w * 64 + bit], child.cdir, child.open_left, child.open_right)) {
+                    mask[w] &= ~(UINT64_C(1) << bit);
+                }
+            }
+        }
+        push_batch_visit(batch, child, mask);
+    }
+    push_batch_cnode(batch, cdir->cnode);
+}
+
+static void push_frozen_batch(struct batch_search* batch, struct search_visit visit)
+{
+    const struct frozen_cdir* frozen = visit.pnode->frozen;
+    const struct frozen_cdir* node = &frozen[visit.index];
+    betree_var_t variable_id = visit.pnode->attr_var.var;
+    size_t children[2] = { node->right, node->has_left ? visit.index + 1 : 0 };
+    for(size_t c = 0; c < 2; c++) {
+        if(children[c] == 0) {
+            continue;
+        }
+        struct search_visit child = { .type = SEARCH_VISIT_FROZEN,
+            .pnode = visit.pnode,
+            .index = children[c],
+            .open_left = c == 1 && visit.open_left,
+            .open_right = c == 0 && visit.open_right };
+        uint64_t* mask = next_batch_mask(batch);
+        for(size_t w = 0; w < batch->word_count; w++) {
+            uint64_t bits = batch->mask[w];
+            mask[w] = bits;
+            while(bits != 0) {
+                size_t bit = (size_t)__builtin_ctzll(bits);
+                bits &= bits - 1;
+                const struct betree_variable* pred = batch->preds[w * 64 + bit][variable_id];
+                if(!is_value_enclosed(pred, &frozen[child.index].bound, child.open_left, child.open_right)) {
+                    mask[w] &= ~(UINT64_C(1) << bit);
+                }
+            }
+        }
+        push_batch_visit(batch, child, mask);
+    }
+    push_batch_cnode(batch, node->cnode);
+}
+
+static void push_frozen_scan_batch(struct batch_search* batch, struct search_visit visit)
+{
+    if(visit.index + 1 < visit.pnode->frozen_count) {
+        visit.index++;
+        uint64_t* mask = next_batch_mask(batch);
+        memcpy(mask, batch->mask, sizeof(*mask) * batch->word_count);
+        push_batch_visit(batch, visit, mask);
+        visit.index--;
+    }
+    push_batch_cnode(batch, visit.pnode->frozen[visit.index].cnode);
+}
+
+// Same walk as match_be_tree, the events of the mask are searched together
+// and the subs of each lnode are evaluated right away
+static void match_be_tree_batch(struct batch_search* batch, const struct cnode* cnode)
+{
+    batch->subs.visit_count = 0;
+    push_batch_cnode(batch, cnode);
+    while(batch->subs.visit_count != 0) {
+        struct search_visit visit = batch->subs.visits[--batch->subs.visit_count];
+        memcpy(batch->mask,
+            batch->masks + batch->subs.visit_count * batch->word_count,
+            sizeof(*batch->mask) * batch->word_count);
+        switch(visit.type) {
+            case SEARCH_VISIT_CNODE:
+                if(visit.cnode->pdir != NULL) {
+                    push_pdir_batch(batch, visit.cnode->pdir);
+                }
+                check_sub_batch(batch, visit.cnode->lnode);
+                break;
+            case SEARCH_VISIT_CDIR:
+                push_cdir_batch(batch, visit);
+                break;
+            case SEARCH_VISIT_FROZEN:
+                push_frozen_batch(batch, visit);
+                break;
+            case SEARCH_VISIT_FROZEN_SCAN:
+                push_frozen_scan_batch(batch, visit);
+                break;
+            default: abort();
+        }
+    }
+}
+
+static void match_eq_index_batch(struct batch_search* batch, const struct eq_index* index, size_t event_count)
+{
+    struct subs_to_eval* subs = &batch->subs;
+    for(size_t e = 0; e < event_count; e++) {
+        subs->count = 0;
+        subs->shorted = 0;
+        subs->indexed = 0;
+        subs->passed_count = 0;
+        match_eq_index(index, batch->preds[e], subs);
+        evaluate_subs(batch->preds[e], subs, batch->reports[e], &batch->memoizes[e]);
+    }
+}
+
+bool betree_search_batch_with_preds(const struct config* config,
+    size_t event_count,
+    const struct betree_variable*** preds,
+    const struct cnode* cnode,
+    struct report** reports)
+{
+    if(event_count == 0) {
+        return true;
+    }
+    size_t undefined_count = config->attr_domain_count / 64 + 1;
+    size_t memoize_count = config->pred_map->memoize_count / 64 + 1;
+    struct batch_search batch = {
+        .word_count = event_count / 64 + 1,
+        .preds = preds,
+        .undefined = bmalloc(event_count * sizeof(*batch.undefined)),
+        .memoizes = bmalloc(event_count * sizeof(*batch.memoizes)),
+        .reports = reports,
+        .mask_capacity = 0,
+        .masks = NULL,
+    };
+    batch.mask = bcalloc(batch.word_count * sizeof(*batch.mask));
+    batch.undefined_events = bcalloc(undefined_count * 64 * batch.word_count * sizeof(*batch.undefined_events));
+    batch.short_circuit_events = bmalloc(2 * batch.word_count * sizeof(*batch.short_circuit_events));
+    // One block for every bitmap of the batch
+    uint64_t* bitmaps = bcalloc(event_count * (undefined_count + 2 * memoize_count) * sizeof(*bitmaps));
+    if(batch.undefined == NULL || batch.memoizes == NULL || batch.mask == NULL || batch.undefined_events == NULL
+        || batch.short_circuit_events == NULL || bitmaps == NULL) {
+        fprintf(stderr, "%s bmalloc failed\n", __func__);
+        abort();
+    }
+    uint64_t* bitmap = bitmaps;
+    for(size_t i = 0; i < event_count; i++) {
+        batch.undefined[i] = bitmap;
+        fill_undefined(config->attr_domain_count, preds[i], bitmap);
+        for(betree_var_t variable_id = 0; variable_id < config->attr_domain_count; variable_id++) {
+            if(test_bit(bitmap, variable_id)) {
+                set_bit(batch.undefined_events + variable_id * batch.word_count, i);
+            }
+        }
+        bitmap += undefined_count;
+        batch.memoizes[i].pass = bitmap;
+        bitmap += memoize_count;
+        batch.memoizes[i].fail = bitmap;
+        bitmap += memoize_count;
+        batch.memoizes[i].epochs = NULL;
+        batch.memoizes[i].epoch = 0;
+    }
+    for(size_t i = 0; i < event_count; i++) {
+        set_bit(batch.mask, i);
+        publish_patterns(config->pred_map, preds[i], &batch.memoizes[i]);
+    }
+    init_subs_to_eval(&batch.subs);
+    if(cnode->eq_index != NULL) {
+        match_eq_index_batch(&batch, cnode->eq_index, event_count);
+    }
+    match_be_tree_batch(&batch, cnode);
+    free_subs_to_eval(&batch.subs);
+    bfree(batch.masks);
+    bfree(batch.short_circuit_events);
+    bfree(batch.undefined_events);
+    bfree(batch.mask);
+    bfree(bitmaps);
+    bfree(batch.memoizes);
+    bfree(batch.undefined);
+    return true;
+}
+
 void sort_event_lists(struct betree_event* event)
 {
     for(size_t i = 0; i < event->variable_count; i++) {
@@ -14,16 +14,37 @@ struct betree_variable {
     struct value value;
 };
 
+struct bytecode;
+
 struct short_circuit {
     uint64_t* pass;
     uint64_t* fail;
 };
 
+struct lnode;
+
+struct sub_bound {
+    // bound_version of the attribute domain it was computed for, 0 when empty
+    uint64_t version;
+    struct value_bound bound;
+};
+
 struct betree_sub {
     betree_sub_t id;
+    // Words in attr_vars and in the short circuit masks
+    size_t word_count;
     uint64_t* attr_vars;
     const struct ast_node* expr;
+    struct bytecode* bytecode;
     struct short_circuit short_circuit;
+    // Variable bound of expr on each attribute of attr_vars, in variable id
+    // order, filled as cdirs ask for them
+    struct {
+        size_t bound_count;
+        struct sub_bound* bounds;
+    };
+    // Lnode holding the sub, NULL for the subs of the eq index
+    struct lnode* lnode;
 };
 
 struct cnode;
@@ -32,29 +53,81 @@ struct lnode {
     struct cnode* parent;
     struct {
         size_t sub_count;
+        size_t sub_capacity;
         struct betree_sub** subs;
     };
+    // Ids and short circuit masks of subs, packed in the same order so
+    // the short circuit check is a linear scan over the lnode. They share
+    // sub_capacity with subs
+    struct {
+        size_t short_circuit_words;
+        betree_sub_t* sub_ids;
+        uint64_t* short_circuit_pass;
+        uint64_t* short_circuit_fail;
+    };
+    // Subs using each attribute, indexed by variable id
+    struct {
+        size_t attr_count_capacity;
+        size_t* attr_counts;
+    };
     size_t max;
 };
 
 struct pdir;
 struct pnode;
 struct cdir;
+struct eq_index;
 
 struct cnode {
     struct cdir* parent;
     struct lnode* lnode;
     struct pdir* pdir;
+    // Root only, subs matched by a lookup of the event values
+    struct eq_index* eq_index;
+    // Root only, open addressing on the sub id, a slot holds a sub of the
+    // lnodes below, NULL when empty
+    struct {
+        size_t sub_slot_count;
+        size_t indexed_sub_count;
+        struct betree_sub** sub_slots;
+    };
+    // Attributes partitioned on along the path from the root, bit per variable id
+    struct {
+        size_t used_word_count;
+        uint64_t* used_attrs;
+    };
 };
 
 struct cdir;
 struct pdir;
 
+// Node of a cdir tree compiled into an array in preorder, with its bounds
+// inline
+struct frozen_cdir {
+    struct value_bound bound;
+    const struct cnode* cnode;
+    // Position of the right child, 0 when there is none. The left child,
+    // if any, directly follows its parent
+    size_t right;
+    bool has_left;
+};
+
 struct pnode {
     struct pdir* parent;
     struct attr_var attr_var;
     struct cdir* cdir;
+    // Compiled copy of cdir searched instead of it, dropped as soon as a
+    // cdir is added or removed until the next freeze
+    struct {
+        size_t frozen_count;
+        size_t frozen_depth;
+        struct frozen_cdir* frozen;
+    };
     float score;
+    // Subs under the pnode, nested partitions included, and the ones among
+    // them not failing when attr_var is undefined
+    size_t sub_count;
+    size_t open_count;
 };
 
 enum c_parent_e {
@@ -70,6 +143,8 @@ struct cdir {
     };
     struct attr_var attr_var;
     struct value_bound bound;
+    // Subs using attr_var in this cdir and its children
+    size_t attr_count;
     struct cnode* cnode;
     struct cdir* lchild;
     struct cdir* rchild;
@@ -79,8 +154,19 @@ struct pdir {
     struct cnode* parent;
     struct {
         size_t pnode_count;
+        size_t pnode_capacity;
         struct pnode** pnodes;
     };
+    // Pnodes indexed by variable id, with bitsets of their attributes so a
+    // search intersects them with the variables of the event. Optional
+    // attributes allow undefined, open ones also have an open_count
+    struct {
+        size_t attr_word_count;
+        struct pnode** pnode_index;
+        uint64_t* attrs;
+        uint64_t* optional_attrs;
+        uint64_t* open_attrs;
+    };
 };
 
 void free_sub(struct betree_sub* sub);
@@ -109,14 +195,74 @@ bool validate_variables(const struct config* config, const struct betree_variabl
 struct betree_event* make_event_from_string(const struct betree* betree, const char* event_str);
 
 struct memoize make_memoize(size_t pred_count);
+struct memoize make_epoch_memoize(size_t pred_count);
+void reset_memoize(struct memoize* memoize, size_t pred_count);
 void free_memoize(struct memoize memoize);
 
+struct search_visit;
+
+struct subs_to_eval {
+    struct betree_sub** subs;
+    size_t capacity;
+    size_t count;
+    // Subs settled by their short circuit masks while gathering
+    size_t shorted;
+    // Subs matched by the equality index, they are in passed as well
+    size_t indexed;
+    struct {
+        size_t passed_capacity;
+        size_t passed_count;
+        struct betree_sub** passed;
+    };
+    // Work stack of the tree walk, kept between searches
+    struct {
+        size_t visit_capacity;
+        size_t visit_count;
+        struct search_visit* visits;
+    };
+};
+
+struct betree_search_context {
+    size_t attr_domain_count;
+    size_t memoize_count;
+    const struct betree_variable** preds;
+    uint64_t* undefined;
+    struct memoize memoize;
+    struct subs_to_eval subs;
+};
+
+struct betree_search_context* make_search_context(const struct config* config);
+void free_search_context(struct betree_search_context* context);
+void prepare_search_context(const struct config* config, struct betree_search_context* context);
+
+struct thread_pool;
+struct parallel_range;
+
+// Searches with at least threshold candidates are evaluated on every thread
+// of the pool, each with its own memoize bitmaps
+struct betree_search_pool {
+    struct thread_pool* pool;
+    size_t threshold;
+    struct betree_search_context* context;
+    size_t memoize_count;
+    struct memoize* memoizes;
+    struct report* reports;
+    struct parallel_range* ranges;
+    struct {
+        size_t matched_capacity;
+        bool* matched;
+    };
+};
+
+struct betree_search_pool* make_search_pool(const struct config* config, size_t thread_count, size_t threshold);
+void free_search_pool(struct betree_search_pool* pool);
+
 struct betree_constant {
     const char* name;
     struct value value;
 };
 
-//bool betree_delete_inner(size_t attr_domains_count, const struct attr_domain** attr_domains, struct betree_sub* sub, struct cnode* cnode);
+bool betree_delete_inner(struct config* config, betree_sub_t id, struct cnode* cnode);
 struct betree_sub* find_sub_id(betree_sub_t id, struct cnode* cnode);
 
 bool betree_search_with_preds(const struct config* config,
@@ -124,8 +270,27 @@ bool betree_search_with_preds(const struct config* config,
     const struct cnode* cnode,
     struct report* report);
 bool betree_exists_with_preds(const struct config* config, const struct betree_variable** preds, const struct cnode* cnode);
+bool betree_search_batch_with_preds(const struct config* config,
+    size_t event_count,
+    const struct betree_variable*** preds,
+    const struct cnode* cnode,
+    struct report** reports);
+bool betree_search_with_pool_preds(const struct config* config,
+    const struct cnode* cnode,
+    struct betree_search_pool* pool,
+    struct report* report);
+bool betree_search_with_context_preds(const struct config* config,
+    const struct cnode* cnode,
+    struct betree_search_context* context,
+    struct report* report);
+bool betree_exists_with_context_preds(const struct config* config,
+    const struct cnode* cnode,
+    struct betree_search_context* context);
 
 bool insert_be_tree(const struct config* config, const struct betree_sub* sub, struct cnode* cnode, struct cdir* cdir);
+bool bulk_load_be_tree(const struct config* config, size_t count, const struct betree_sub** subs, struct cnode* cnode);
+// Compiles the cdir trees of every pnode under cnode for searching
+void freeze_be_tree(struct cnode* cnode);
 
 void sort_event_lists(struct betree_event* event);
 
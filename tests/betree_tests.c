@@ -7,8 +7,12 @@
 #include "alloc.h"
 #include "betree.h"
 #include "debug.h"
+#include "eq_index.h"
+#include "hashmap.h"
 #include "helper.h"
 #include "minunit.h"
+#include "pattern.h"
+#include "prefilter.h"
 #include "printer.h"
 #include "tree.h"
 #include "utils.h"
@@ -240,49 +244,49 @@ int test_cdir_split_twice()
     return 0;
 }
 
-/*int test_remove_sub_in_tree()*/
-/*{*/
-    /*struct betree* tree = betree_make();*/
-    /*add_attr_domain_bounded_i(tree->config, "a", false, 0, 10);*/
+int test_remove_sub_in_tree()
+{
+    struct betree* tree = betree_make();
+    add_attr_domain_bounded_i(tree->config, "a", false, 0, 10);
 
-    /*mu_assert(betree_insert(tree, 0, "a = 0"), "");*/
+    mu_assert(betree_insert(tree, 0, "a = 0"), "");
 
-    /*mu_assert(tree->cnode->lnode->sub_count == 1, "lnode has the sub");*/
+    mu_assert(tree->cnode->lnode->sub_count == 1, "lnode has the sub");
 
-    /*mu_assert(betree_delete(tree, 0), "");*/
+    mu_assert(betree_delete(tree, 0), "");
 
-    /*mu_assert(tree->cnode->lnode->sub_count == 0, "lnode does not have the sub");*/
-    /*mu_assert(tree->cnode != NULL && tree->cnode->lnode != NULL,*/
-        /*"did not delete the cnode or lnode because it's root");*/
+    mu_assert(tree->cnode->lnode->sub_count == 0, "lnode does not have the sub");
+    mu_assert(tree->cnode != NULL && tree->cnode->lnode != NULL,
+        "did not delete the cnode or lnode because it's root");
 
-    /*betree_free(tree);*/
-    /*return 0;*/
-/*}*/
+    betree_free(tree);
+    return 0;
+}
 
-/*int test_remove_sub_in_tree_with_delete()*/
-/*{*/
-    /*struct betree* tree = betree_make();*/
-    /*add_attr_domain_bounded_i(tree->config, "a", false, 0, 10);*/
-    /*add_attr_domain_bounded_i(tree->config, "b", false, 0, 10);*/
+int test_remove_sub_in_tree_with_delete()
+{
+    struct betree* tree = betree_make();
+    add_attr_domain_bounded_i(tree->config, "a", false, 0, 10);
+    add_attr_domain_bounded_i(tree->config, "b", false, 0, 10);
 
-    /*mu_assert(betree_insert(tree, 1, "a = 0"), "");*/
-    /*mu_assert(betree_insert(tree, 2, "a = 0"), "");*/
-    /*mu_assert(betree_insert(tree, 3, "a = 0"), "");*/
-    /*mu_assert(betree_insert(tree, 4, "b = 0"), "");*/
+    mu_assert(betree_insert(tree, 1, "a = 0"), "");
+    mu_assert(betree_insert(tree, 2, "a = 0"), "");
+    mu_assert(betree_insert(tree, 3, "a = 0"), "");
+    mu_assert(betree_insert(tree, 4, "b = 0"), "");
 
-    /*mu_assert(tree->cnode->lnode->sub_count == 1, "sub 4 is in lnode");*/
-    /*mu_assert(tree->cnode->pdir->pnodes[0]->cdir->cnode->lnode->sub_count == 3,*/
-        /*"sub 1, 2, and 3 is lower lnode");*/
+    mu_assert(tree->cnode->lnode->sub_count == 1, "sub 4 is in lnode");
+    mu_assert(tree->cnode->pdir->pnodes[0]->cdir->cnode->lnode->sub_count == 3,
+        "sub 1, 2, and 3 is lower lnode");
 
-    /*mu_assert(betree_delete(tree, 1), "");*/
-    /*mu_assert(betree_delete(tree, 2), "");*/
-    /*mu_assert(betree_delete(tree, 3), "");*/
+    mu_assert(betree_delete(tree, 1), "");
+    mu_assert(betree_delete(tree, 2), "");
+    mu_assert(betree_delete(tree, 3), "");
 
-    /*mu_assert(tree->cnode->pdir == NULL, "deleted everything down of the pdir");*/
+    mu_assert(tree->cnode->pdir == NULL, "deleted everything down of the pdir");
 
-    /*betree_free(tree);*/
-    /*return 0;*/
-/*}*/
+    betree_free(tree);
+    return 0;
+}
 
 int test_match_deeper()
 {
@@ -1071,35 +1075,80 @@ int test_not_domain_changing()
     return 0;
 }
 
-/*
-int test_insert_all()
+int test_bulk_load()
 {
-    struct betree* tree = betree_make();
-    add_attr_domain_bounded_i(tree->config, "i1", true, 0, 10);
-    add_attr_domain_bounded_i(tree->config, "i2", true, 0, 10);
+    {
+        struct betree* tree = betree_make();
+        add_attr_domain_bounded_i(tree->config, "i1", true, 0, 10);
+        add_attr_domain_bounded_i(tree->config, "i2", true, 0, 10);
+
+        const char* exprs[3] = {
+            "i1 = 0 || i1 = 2",
+            "i1 = 0 || i1 = 4",
+            "i1 = 0 || i1 = 6"
+        };
+        const struct betree_sub* subs[3];
+        for(size_t i = 0; i < 3; i++) {
+            subs[i] = betree_make_sub(tree, i, 0, NULL, exprs[i]);
+        }
+        mu_assert(betree_bulk_load(tree, 3, subs), "");
+        mu_assert(tree->cnode->lnode->sub_count == 3, "did not split yet");
 
-    const char* exprs[3] = {
-        "i1 = 0 || i1 = 2",
-        "i1 = 0 || i1 = 4",
-        "i1 = 0 || i1 = 6"
-    };
-    betree_insert_all(tree, 3, exprs);
-    mu_assert(tree->cnode->lnode->sub_count == 3, "did not split yet");
+        mu_assert(betree_insert(tree, 5, "i2 = 0 || i2 = 2"), "");
+        mu_assert(tree->cnode->lnode->sub_count == 1 &&
+          tree->cnode->pdir != NULL &&
+          tree->cnode->pdir->pnodes[0]->cdir->cnode->lnode->sub_count == 3, "split");
 
-    mu_assert(betree_insert(tree, 5, "i2 = 0 || i2 = 2"), "");
-    mu_assert(tree->cnode->lnode->sub_count == 1 &&
-      tree->cnode->pdir != NULL &&
-      tree->cnode->pdir->pnodes[0]->cdir->cnode->lnode->sub_count == 3, "split");
+        struct report* report = make_report();
+        mu_assert(betree_search(tree, "{\"i1\": 0}", report), "");
+        mu_assert(report->matched == 3, "correct match");
 
-    struct report* report = make_report();
-    mu_assert(betree_search(tree, "{\"i1\": 0}", report), "");
-    mu_assert(report->matched == 3, "correct match");
+        free_report(report);
+        betree_free(tree);
+    }
+    {
+        struct betree* bulk_tree = betree_make();
+        struct betree* tree = betree_make();
+        struct betree* trees[2] = { bulk_tree, tree };
+        for(size_t i = 0; i < 2; i++) {
+            betree_add_integer_variable(trees[i], "a", false, 0, 100);
+            betree_add_integer_variable(trees[i], "b", true, 0, 10);
+            betree_add_boolean_variable(trees[i], "c", true);
+        }
+        enum { sub_count = 500 };
+        const struct betree_sub* subs[sub_count];
+        for(size_t i = 0; i < sub_count; i++) {
+            char* expr;
+            if(basprintf(&expr, "a = %zu and (b > %zu or c)", i % 100, i % 10) < 0) {
+                abort();
+            }
+            subs[i] = betree_make_sub(bulk_tree, i, 0, NULL, expr);
+            mu_assert(betree_insert(tree, i, expr), "");
+            free(expr);
+        }
+        mu_assert(betree_bulk_load(bulk_tree, sub_count, subs), "");
+        mu_assert(bulk_tree->cnode->lnode->sub_count <= bulk_tree->config->lnode_max_cap, "root was split");
+
+        for(size_t a = 0; a < 100; a += 7) {
+            char* event;
+            if(basprintf(&event, "{\"a\": %zu, \"b\": 10}", a) < 0) {
+                abort();
+            }
+            struct report* bulk_report = make_report();
+            struct report* report = make_report();
+            mu_assert(betree_search(bulk_tree, event, bulk_report), "");
+            mu_assert(betree_search(tree, event, report), "");
+            mu_assert(bulk_report->matched == report->matched && report->matched != 0, "same matches");
+            free_report(bulk_report);
+            free_report(report);
+            free(event);
+        }
 
-    free_report(report);
-    betree_free(tree);
+        betree_free(bulk_tree);
+        betree_free(tree);
+    }
     return 0;
 }
-*/
 
 int test_bug_cases()
 {
@@ -1649,6 +1698,1260 @@ int test_duplicate_unsorted_string_list()
     return 0;
 }
 
+int test_search_context()
+{
+    struct betree* tree = betree_make();
+    betree_add_integer_variable(tree, "i", false, 0, 100);
+    betree_add_boolean_variable(tree, "b", true);
+
+    mu_assert(betree_insert(tree, 0, "i = 10"), "");
+    mu_assert(betree_insert(tree, 1, "i > 5 and b"), "");
+
+    struct betree_search_context* context = betree_make_search_context(tree);
+
+    for(int64_t value = 0; value < 20; value++) {
+        struct betree_event* event = betree_make_event(tree);
+        betree_set_variable(event, 0, betree_make_integer_variable("i", value));
+        betree_set_variable(event, 1, betree_make_boolean_variable("b", value % 2 == 0));
+        struct report* context_report = make_report();
+        struct report* report = make_report();
+        mu_assert(betree_search_with_context(tree, event, context, context_report), "");
+        mu_assert(betree_search_with_event(tree, event, report), "");
+        mu_assert(context_report->matched == report->matched, "same matches");
+        for(size_t i = 0; i < report->matched; i++) {
+            mu_assert(context_report->subs[i] == report->subs[i], "same subs");
+        }
+        mu_assert(betree_exists_with_context(tree, event, context) == (report->matched != 0), "exists agrees");
+        free_report(context_report);
+        free_report(report);
+        betree_free_event(event);
+    }
+
+    // The tree grows after the context was made
+    betree_add_integer_variable(tree, "j", true, 0, 100);
+    mu_assert(betree_insert(tree, 2, "j = 3 and not b"), "");
+    mu_assert(betree_insert(tree, 3, "i = 10 or j = 4"), "");
+
+    struct betree_event* event = betree_make_event(tree);
+    betree_set_variable(event, 0, betree_make_integer_variable("i", 10));
+    betree_set_variable(event, 1, betree_make_boolean_variable("b", false));
+    betree_set_variable(event, 2, betree_make_integer_variable("j", 3));
+    struct report* report = make_report();
+    mu_assert(betree_search_with_context(tree, event, context, report), "");
+    mu_assert(report->matched == 3, "found 3");
+    mu_assert(context->attr_domain_count == 3, "preds grew");
+    free_report(report);
+    betree_free_event(event);
+
+    betree_free_search_context(context);
+    betree_free(tree);
+
+    return 0;
+}
+
+int test_search_batch()
+{
+    struct betree* tree = betree_make_with_parameters(2, 0);
+    betree_add_integer_variable(tree, "i", false, 0, 100);
+    betree_add_integer_variable(tree, "j", true, 0, 100);
+    betree_add_boolean_variable(tree, "b", true);
+
+    for(size_t i = 0; i < 100; i++) {
+        char* expr;
+        if(basprintf(&expr, "(i = %zu or j > %zu) and not b", i, i) < 0) {
+            abort();
+        }
+        mu_assert(betree_insert(tree, i, expr), "");
+        free(expr);
+    }
+    mu_assert(betree_insert(tree, 100, "i < 50 and b"), "");
+    mu_assert(betree_insert(tree, 101, "j = 3"), "");
+    // A partition that events lacking k short circuit as a whole
+    betree_add_integer_variable(tree, "k", true, 0, 10);
+    for(size_t i = 0; i < 10; i++) {
+        char* expr;
+        if(basprintf(&expr, "k = %zu", i) < 0) {
+            abort();
+        }
+        mu_assert(betree_insert(tree, 102 + i, expr), "");
+        free(expr);
+    }
+
+    enum { event_count = 150 };
+    struct betree_event* events[event_count];
+    struct report* reports[event_count];
+    for(size_t i = 0; i < event_count; i++) {
+        events[i] = betree_make_event(tree);
+        betree_set_variable(events[i], 0, betree_make_integer_variable("i", i % 100));
+        if(i % 3 != 0) {
+            betree_set_variable(events[i], 1, betree_make_integer_variable("j", i % 7));
+        }
+        if(i % 5 != 0) {
+            betree_set_variable(events[i], 2, betree_make_boolean_variable("b", i % 2 == 0));
+        }
+        if(i % 4 == 0) {
+            betree_set_variable(events[i], 3, betree_make_integer_variable("k", i % 11));
+        }
+    }
+
+    // Through the linked cdirs then the frozen ones
+    for(size_t pass = 0; pass < 2; pass++) {
+        if(pass == 1) {
+            betree_freeze(tree);
+        }
+        for(size_t i = 0; i < event_count; i++) {
+            reports[i] = make_report();
+        }
+        mu_assert(betree_search_batch(tree, events, event_count, reports), "");
+
+        for(size_t i = 0; i < event_count; i++) {
+            struct report* report = make_report();
+            mu_assert(betree_search_with_event(tree, events[i], report), "");
+            mu_assert(reports[i]->matched == report->matched, "same matches");
+            mu_assert(reports[i]->evaluated == report->evaluated, "same evaluations");
+            mu_assert(reports[i]->shorted == report->shorted, "same short circuits");
+            for(size_t j = 0; j < report->matched; j++) {
+                mu_assert(reports[i]->subs[j] == report->subs[j], "same subs");
+            }
+            free_report(report);
+            free_report(reports[i]);
+        }
+    }
+    for(size_t i = 0; i < event_count; i++) {
+        betree_free_event(events[i]);
+    }
+
+    betree_free(tree);
+
+    return 0;
+}
+
+int test_search_pool()
+{
+    struct betree* tree = betree_make();
+    betree_add_integer_variable(tree, "i", false, 0, 1000);
+    betree_add_integer_variable(tree, "j", true, 0, 10);
+
+    for(size_t i = 0; i < 1000; i++) {
+        char* expr;
+        if(basprintf(&expr, "i > %zu and (j = %zu or j = 5)", i, i % 10) < 0) {
+            abort();
+        }
+        mu_assert(betree_insert(tree, i, expr), "");
+        free(expr);
+    }
+
+    struct betree_search_pool* parallel = betree_make_search_pool(tree, 4, 0);
+    struct betree_search_pool* serial = betree_make_search_pool(tree, 4, SIZE_MAX);
+
+    for(int64_t value = 0; value < 1000; value += 97) {
+        struct betree_event* event = betree_make_event(tree);
+        betree_set_variable(event, 0, betree_make_integer_variable("i", value));
+        betree_set_variable(event, 1, betree_make_integer_variable("j", value % 10));
+        struct report* report = make_report();
+        struct report* parallel_report = make_report();
+        struct report* serial_report = make_report();
+        mu_assert(betree_search_with_event(tree, event, report), "");
+        mu_assert(betree_search_with_pool(tree, event, parallel, parallel_report), "");
+        mu_assert(betree_search_with_pool(tree, event, serial, serial_report), "");
+        mu_assert(parallel_report->matched == report->matched, "same matches");
+        mu_assert(serial_report->matched == report->matched, "same matches");
+        mu_assert(parallel_report->evaluated == report->evaluated, "same evaluations");
+        for(size_t i = 0; i < report->matched; i++) {
+            mu_assert(parallel_report->subs[i] == report->subs[i], "same subs");
+            mu_assert(serial_report->subs[i] == report->subs[i], "same subs");
+        }
+        free_report(report);
+        free_report(parallel_report);
+        free_report(serial_report);
+        betree_free_event(event);
+    }
+
+    betree_free_search_pool(parallel);
+    betree_free_search_pool(serial);
+    betree_free(tree);
+
+    return 0;
+}
+
+int test_delete()
+{
+    struct betree* tree = betree_make();
+    betree_add_integer_variable(tree, "a", false, 0, 100);
+    betree_add_integer_variable(tree, "b", true, 0, 100);
+
+    for(size_t i = 0; i < 200; i++) {
+        char* expr;
+        if(basprintf(&expr, "a = %zu and b > %zu", i % 100, i % 7) < 0) {
+            abort();
+        }
+        mu_assert(betree_insert(tree, i, expr), "");
+        free(expr);
+    }
+    size_t memoize_count = tree->config->pred_map->memoize_count;
+
+    mu_assert(!betree_delete(tree, 1000), "unknown id");
+    for(size_t i = 0; i < 200; i += 2) {
+        mu_assert(betree_delete(tree, i), "");
+        mu_assert(find_sub_id(i, tree->cnode) == NULL, "sub is gone");
+    }
+    mu_assert(!betree_delete(tree, 0), "already deleted");
+
+    for(size_t a = 0; a < 100; a++) {
+        char* event;
+        if(basprintf(&event, "{\"a\": %zu, \"b\": 50}", a) < 0) {
+            abort();
+        }
+        struct report* report = make_report();
+        mu_assert(betree_search(tree, event, report), "");
+        mu_assert(report->matched == (a % 2 == 1 ? 2 : 0), "only odd subs are left");
+        for(size_t i = 0; i < report->matched; i++) {
+            mu_assert(report->subs[i] % 2 == 1 && report->subs[i] % 100 == a, "right sub");
+        }
+        free_report(report);
+        free(event);
+    }
+
+    for(size_t i = 1; i < 200; i += 2) {
+        mu_assert(betree_delete(tree, i), "");
+    }
+    mu_assert(tree->cnode->lnode->sub_count == 0, "empty");
+    mu_assert(tree->cnode->pdir == NULL, "collapsed");
+    mu_assert(tree->config->pred_map->free_pred_count == tree->config->pred_map->pred_count, "preds released");
+
+    // Freed memoize ids are handed out again
+    for(size_t i = 0; i < 200; i++) {
+        char* expr;
+        if(basprintf(&expr, "a = %zu and b > %zu", i % 100, i % 7) < 0) {
+            abort();
+        }
+        mu_assert(betree_insert(tree, i, expr), "");
+        free(expr);
+    }
+    mu_assert(tree->config->pred_map->memoize_count == memoize_count, "no new memoize ids");
+
+    betree_free(tree);
+
+    return 0;
+}
+
+static bool is_in_lnode(const struct betree_sub* sub)
+{
+    if(sub->lnode == NULL) {
+        return false;
+    }
+    for(size_t i = 0; i < sub->lnode->sub_count; i++) {
+        if(sub->lnode->subs[i] == sub) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Deletes look subs up by id instead of walking the tree, the lookups have to
+// follow subs as splits and merges move them between lnodes
+int test_delete_index()
+{
+    for(size_t bulk = 0; bulk < 2; bulk++) {
+        struct betree* tree = betree_make_with_parameters(4, 0);
+        betree_add_integer_variable(tree, "a", false, 0, 100);
+        betree_add_integer_variable(tree, "b", true, 0, 100);
+        betree_use_eq_index(tree, true);
+        enum { sub_count = 400 };
+        const struct betree_sub* subs[sub_count];
+        for(size_t i = 0; i < sub_count; i++) {
+            char* expr;
+            // Even ids go to the eq index, odd ones to the tree
+            if(basprintf(&expr, i % 2 == 0 ? "a = %zu" : "a > %zu and b < %zu", i % 100, i % 13) < 0) {
+                abort();
+            }
+            subs[i] = betree_make_sub(tree, i, 0, NULL, expr);
+            free(expr);
+        }
+        if(bulk == 1) {
+            mu_assert(betree_bulk_load(tree, sub_count, subs), "");
+        }
+        else {
+            for(size_t i = 0; i < sub_count; i++) {
+                mu_assert(betree_insert_sub(tree, subs[i]), "");
+            }
+        }
+        mu_assert(tree->cnode->eq_index->sub_count == sub_count / 2, "even ids indexed");
+        mu_assert(tree->cnode->indexed_sub_count == sub_count / 2, "odd ids in the tree");
+        mu_assert(tree->cnode->pdir != NULL, "split");
+
+        srand(7);
+        bool deleted[sub_count] = { false };
+        for(size_t n = 0; n < sub_count; n++) {
+            size_t id = (size_t)rand() % sub_count;
+            while(deleted[id]) {
+                id = (id + 1) % sub_count;
+            }
+            mu_assert(betree_delete(tree, id), "deleted");
+            mu_assert(find_sub_id(id, tree->cnode) == NULL, "gone");
+            deleted[id] = true;
+            if(n % 50 != 0) {
+                continue;
+            }
+            for(size_t i = 0; i < sub_count; i++) {
+                const struct betree_sub* sub = find_sub_id(i, tree->cnode);
+                mu_assert(deleted[i] ? sub == NULL : sub == subs[i], "found by id");
+                mu_assert(deleted[i] || i % 2 == 0 || is_in_lnode(sub), "in its lnode");
+            }
+        }
+        mu_assert(tree->cnode->eq_index->sub_count == 0, "index emptied");
+        mu_assert(tree->cnode->indexed_sub_count == 0, "tree emptied");
+        mu_assert(tree->cnode->lnode->sub_count == 0 && tree->cnode->pdir == NULL, "collapsed");
+
+        // Repeated ids are deleted one at a time
+        for(size_t i = 0; i < 3; i++) {
+            mu_assert(betree_insert(tree, 1, i == 0 ? "a = 1" : "a > 1 and b < 1"), "");
+        }
+        for(size_t i = 0; i < 3; i++) {
+            mu_assert(find_sub_id(1, tree->cnode) != NULL, "still one left");
+            mu_assert(betree_delete(tree, 1), "deleted");
+        }
+        mu_assert(!betree_delete(tree, 1), "all deleted");
+        betree_free(tree);
+    }
+    return 0;
+}
+
+int test_bytecode()
+{
+    const char* exprs[] = {
+        "i > 5",
+        "i <= 5 and b",
+        "i = 3 or f < 2.5",
+        "not (i <> 7) or s = \"a\"",
+        "s <> \"b\" and (f >= 1.0 and f = 3.0)",
+        "i in (1, 2, 3) and not b",
+        "b and i > 5",
+        "(i > 5 or b) and not (s = \"a\" or f > 4.0)",
+        "i is null or (i > 5 and s = \"b\")",
+        "true and not false",
+    };
+    size_t expr_count = sizeof(exprs) / sizeof(*exprs);
+    struct betree* trees[2];
+    for(size_t t = 0; t < 2; t++) {
+        trees[t] = betree_make();
+        betree_add_integer_variable(trees[t], "i", true, 0, 10);
+        betree_add_boolean_variable(trees[t], "b", true);
+        betree_add_float_variable(trees[t], "f", true, 0., 5.);
+        betree_add_string_variable(trees[t], "s", true, 3);
+        betree_use_bytecode(trees[t], t == 1);
+        for(size_t i = 0; i < expr_count; i++) {
+            mu_assert(betree_insert(trees[t], i, exprs[i]), "inserted");
+        }
+    }
+    for(size_t t = 0; t < 2; t++) {
+        struct betree_sub* sub = (struct betree_sub*)betree_make_sub(trees[t], expr_count, 0, NULL, exprs[0]);
+        mu_assert((sub->bytecode != NULL) == (t == 1), "compiled when enabled");
+        free_sub(sub);
+    }
+
+    const char* strings[] = { "a", "b", "c" };
+    for(size_t n = 0; n < 512; n++) {
+        // Shared preds lose and regain a memoize id
+        if(n == 256) {
+            for(size_t t = 0; t < 2; t++) {
+                mu_assert(betree_delete(trees[t], 0), "deleted");
+                mu_assert(betree_delete(trees[t], 6), "deleted");
+                mu_assert(betree_insert(trees[t], expr_count, "i > 5 and s = \"c\""), "inserted");
+            }
+        }
+        struct report* reports[2];
+        for(size_t t = 0; t < 2; t++) {
+            struct betree_event* event = betree_make_event(trees[t]);
+            if(n % 4 != 0) {
+                betree_set_variable(event, 0, betree_make_integer_variable("i", (int64_t)(n % 11)));
+            }
+            if(n % 5 != 0) {
+                betree_set_variable(event, 1, betree_make_boolean_variable("b", n % 3 == 0));
+            }
+            if(n % 7 != 0) {
+                betree_set_variable(event, 2, betree_make_float_variable("f", (double)(n % 6)));
+            }
+            if(n % 9 != 0) {
+                betree_set_variable(event, 3, betree_make_string_variable("s", strings[n % 3]));
+            }
+            reports[t] = make_report();
+            mu_assert(betree_search_with_event(trees[t], event, reports[t]), "");
+            betree_free_event(event);
+        }
+        mu_assert(reports[0]->matched == reports[1]->matched, "same matches");
+        for(size_t i = 0; i < reports[0]->matched; i++) {
+            mu_assert(reports[0]->subs[i] == reports[1]->subs[i], "same subs");
+        }
+        mu_assert(reports[0]->memoized == reports[1]->memoized, "same memoized");
+        free_report(reports[0]);
+        free_report(reports[1]);
+    }
+
+    betree_free(trees[0]);
+    betree_free(trees[1]);
+    return 0;
+}
+
+int test_attr_lookup()
+{
+    struct config* config = make_default_config();
+    char attr[32];
+    for(size_t i = 0; i < 200; i++) {
+        sprintf(attr, "attr_%zu", i);
+        add_attr_domain_i(config, attr, false);
+    }
+    add_attr_domain_i(config, "attr_7", false);
+
+    for(size_t i = 0; i < 200; i++) {
+        sprintf(attr, "attr_%zu", i);
+        mu_assert(try_get_id_for_attr(config, attr) == i, "found %s", attr);
+        sprintf(attr, "ATTR_%zu", i);
+        mu_assert(try_get_id_for_attr(config, attr) == i, "found folded %s", attr);
+    }
+    mu_assert(try_get_id_for_attr(config, "attr_7") == 7, "duplicate resolves to the first");
+    mu_assert(try_get_id_for_attr(config, "attr_200") == INVALID_VAR, "unknown");
+    mu_assert(try_get_id_for_attr(config, "attr_") == INVALID_VAR, "prefix");
+    mu_assert(try_get_id_for_attr(config, "attr_10x") == INVALID_VAR, "suffix");
+
+    free_config(config);
+    return 0;
+}
+
+int test_ienum_lookup()
+{
+    struct config* config = make_default_config();
+    add_attr_domain_i(config, "i", false);
+    add_attr_domain_bounded_ie(config, "bounded", false, 3000);
+    add_attr_domain_ie(config, "unbounded", false);
+    struct attr_var bounded = make_attr_var("bounded", config);
+    struct attr_var unbounded = make_attr_var("unbounded", config);
+
+    mu_assert(try_get_id_for_ienum(config, unbounded, 0) == INVALID_IENUM, "no map yet");
+    for(int64_t i = 0; i < 10000; i++) {
+        int64_t integer = (i * 7919) - 5000;
+        mu_assert(get_id_for_ienum(config, unbounded, integer, false) == (betree_ienum_t)i, "assigned in order");
+        if(i < 3000) {
+            mu_assert(get_id_for_ienum(config, bounded, integer, false) == (betree_ienum_t)i, "assigned in order");
+        }
+        else {
+            mu_assert(get_id_for_ienum(config, bounded, integer, false) == INVALID_IENUM, "past the bound");
+        }
+    }
+    for(int64_t i = 0; i < 10000; i++) {
+        int64_t integer = (i * 7919) - 5000;
+        mu_assert(try_get_id_for_ienum(config, unbounded, integer) == (betree_ienum_t)i, "found");
+        mu_assert(get_id_for_ienum(config, unbounded, integer, false) == (betree_ienum_t)i, "not reassigned");
+    }
+    mu_assert(try_get_id_for_ienum(config, unbounded, 1) == INVALID_IENUM, "unknown integer");
+    mu_assert(try_get_id_for_ienum(config, bounded, 3000 * 7919 - 5000) == INVALID_IENUM, "not assigned");
+    mu_assert(get_id_for_ienum(config, bounded, 1, true) == 3000, "always assign");
+
+    free_attr_var(bounded);
+    free_attr_var(unbounded);
+    free_config(config);
+    return 0;
+}
+
+int test_string_lookup()
+{
+    struct config* config = make_default_config();
+    add_attr_domain_i(config, "i", false);
+    add_attr_domain_bounded_s(config, "bounded", false, 3000);
+    add_attr_domain_s(config, "unbounded", false);
+    struct attr_var bounded = make_attr_var("bounded", config);
+    struct attr_var unbounded = make_attr_var("unbounded", config);
+    char string[32];
+
+    mu_assert(try_get_id_for_string(config, unbounded, "s0") == INVALID_STR, "no map yet");
+    for(size_t i = 0; i < 10000; i++) {
+        sprintf(string, "s%zu", i);
+        mu_assert(get_id_for_string(config, unbounded, string, false) == i, "assigned in order");
+        if(i < 3000) {
+            mu_assert(get_id_for_string(config, bounded, string, false) == i, "assigned in order");
+        }
+        else {
+            mu_assert(get_id_for_string(config, bounded, string, false) == INVALID_STR, "past the bound");
+        }
+    }
+    for(size_t i = 0; i < 10000; i++) {
+        sprintf(string, "s%zu", i);
+        mu_assert(try_get_id_for_string(config, unbounded, string) == i, "found");
+        mu_assert(get_id_for_string(config, unbounded, string, false) == i, "not reassigned");
+    }
+    mu_assert(try_get_id_for_string(config, unbounded, "s") == INVALID_STR, "prefix");
+    mu_assert(try_get_id_for_string(config, unbounded, "") == INVALID_STR, "empty");
+    mu_assert(try_get_id_for_string(config, bounded, "s3000") == INVALID_STR, "not assigned");
+    mu_assert(get_id_for_string(config, bounded, "", true) == 3000, "always assign");
+    mu_assert(try_get_id_for_string(config, bounded, "") == 3000, "empty found");
+
+    free_attr_var(bounded);
+    free_attr_var(unbounded);
+    free_config(config);
+    return 0;
+}
+
+// The root lnode is made before any attribute, its packed masks are widened
+// for the subs on attributes past the first 64
+int test_wide_short_circuit()
+{
+    for(size_t bulk = 0; bulk < 2; bulk++) {
+        struct betree* tree = betree_make();
+        betree_add_integer_variable(tree, "a", false, 0, 10);
+        for(size_t i = 0; i < 90; i++) {
+            char* name;
+            if(basprintf(&name, "x%zu", i) < 0) {
+                abort();
+            }
+            betree_add_integer_variable(tree, name, true, 0, 10);
+            free(name);
+        }
+        const char* exprs[3] = { "x2 = 3", "x70 = 3", "x89 = 3 and a = 1" };
+        if(bulk == 1) {
+            const struct betree_sub* subs[3];
+            for(size_t i = 0; i < 3; i++) {
+                subs[i] = betree_make_sub(tree, i, 0, NULL, exprs[i]);
+            }
+            mu_assert(betree_bulk_load(tree, 3, subs), "");
+        }
+        else {
+            for(size_t i = 0; i < 3; i++) {
+                mu_assert(betree_insert(tree, i, exprs[i]), "");
+            }
+        }
+        mu_assert(tree->cnode->lnode->short_circuit_words == 2, "widened");
+
+        struct report* report = make_report();
+        mu_assert(betree_search(tree, "{\"a\": 1}", report), "");
+        mu_assert(report->matched == 0 && report->shorted == 3, "every sub shorted");
+        free_report(report);
+
+        report = make_report();
+        mu_assert(betree_search(tree, "{\"a\": 1, \"x70\": 3, \"x89\": 3}", report), "");
+        mu_assert(report->matched == 2 && report->shorted == 1, "only x2 = 3 shorted");
+        free_report(report);
+        betree_free(tree);
+    }
+    return 0;
+}
+
+static uint64_t random_mask()
+{
+    uint64_t mask = 0;
+    for(size_t i = 0; i < 2; i++) {
+        if(rand() % 3 == 0) {
+            mask |= 1ULL << (rand() % 64);
+        }
+    }
+    return mask;
+}
+
+static bool check_cnode_counters(const struct config* config, const struct cnode* cnode);
+
+static size_t count_cnode_subs(const struct cnode* cnode);
+
+static size_t count_cdir_subs(const struct cdir* cdir)
+{
+    if(cdir == NULL) {
+        return 0;
+    }
+    return count_cnode_subs(cdir->cnode) + count_cdir_subs(cdir->lchild) + count_cdir_subs(cdir->rchild);
+}
+
+static size_t count_cnode_subs(const struct cnode* cnode)
+{
+    size_t count = cnode->lnode->sub_count;
+    if(cnode->pdir != NULL) {
+        for(size_t i = 0; i < cnode->pdir->pnode_count; i++) {
+            count += count_cdir_subs(cnode->pdir->pnodes[i]->cdir);
+        }
+    }
+    return count;
+}
+
+static size_t recount_cdir(betree_var_t variable_id, const struct cdir* cdir)
+{
+    if(cdir == NULL) {
+        return 0;
+    }
+    size_t count = 0;
+    const struct lnode* lnode = cdir->cnode->lnode;
+    for(size_t i = 0; i < lnode->sub_count; i++) {
+        count += test_bit(lnode->subs[i]->attr_vars, variable_id);
+    }
+    return count + recount_cdir(variable_id, cdir->lchild) + recount_cdir(variable_id, cdir->rchild);
+}
+
+static bool check_cdir_counters(const struct config* config, const struct cdir* cdir)
+{
+    if(cdir == NULL) {
+        return true;
+    }
+    return cdir->attr_count == recount_cdir(cdir->attr_var.var, cdir)
+        && check_cnode_counters(config, cdir->cnode) && check_cdir_counters(config, cdir->lchild)
+        && check_cdir_counters(config, cdir->rchild);
+}
+
+static bool check_cnode_counters(const struct config* config, const struct cnode* cnode)
+{
+    const struct lnode* lnode = cnode->lnode;
+    for(size_t v = 0; v < config->attr_domain_count; v++) {
+        size_t count = 0;
+        for(size_t i = 0; i < lnode->sub_count; i++) {
+            count += test_bit(lnode->subs[i]->attr_vars, v);
+        }
+        size_t counter = v < lnode->attr_count_capacity ? lnode->attr_counts[v] : 0;
+        if(counter != count) {
+            return false;
+        }
+    }
+    if(cnode->pdir != NULL) {
+        for(size_t i = 0; i < cnode->pdir->pnode_count; i++) {
+            const struct pnode* pnode = cnode->pdir->pnodes[i];
+            if(pnode->sub_count != count_cdir_subs(pnode->cdir)
+                || !check_cdir_counters(config, pnode->cdir)) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+int test_attr_counters()
+{
+    struct betree* tree = betree_make();
+    betree_add_integer_variable(tree, "a", false, 0, 100);
+    betree_add_integer_variable(tree, "b", true, 0, 100);
+    betree_add_boolean_variable(tree, "c", true);
+
+    for(size_t i = 0; i < 400; i++) {
+        char* expr;
+        int ret = i % 3 == 0 ? basprintf(&expr, "a = %zu and b > %zu", i % 100, i % 7)
+                             : basprintf(&expr, "a = %zu and (b < %zu or c)", i % 100, i % 7);
+        if(ret < 0) {
+            abort();
+        }
+        mu_assert(betree_insert(tree, i, expr), "");
+        free(expr);
+    }
+    mu_assert(tree->cnode->pdir != NULL, "split");
+    mu_assert(check_cnode_counters(tree->config, tree->cnode), "counters after inserts");
+
+    for(size_t i = 0; i < 400; i += 3) {
+        mu_assert(betree_delete(tree, i), "");
+    }
+    mu_assert(check_cnode_counters(tree->config, tree->cnode), "counters after deletes");
+
+    betree_free(tree);
+    return 0;
+}
+
+static bool check_used_attrs(const struct config* config, const struct cnode* cnode, const uint64_t* expected);
+
+static bool check_cdir_used_attrs(const struct config* config, const struct cdir* cdir, const uint64_t* expected)
+{
+    if(cdir == NULL) {
+        return true;
+    }
+    return check_used_attrs(config, cdir->cnode, expected)
+        && check_cdir_used_attrs(config, cdir->lchild, expected)
+        && check_cdir_used_attrs(config, cdir->rchild, expected);
+}
+
+// Expected holds the attributes of every pnode on the path from the root
+static bool check_used_attrs(const struct config* config, const struct cnode* cnode, const uint64_t* expected)
+{
+    for(size_t v = 0; v < config->attr_domain_count; v++) {
+        bool used = v < cnode->used_word_count * 64 && test_bit(cnode->used_attrs, v);
+        if(used != test_bit(expected, v)) {
+            return false;
+        }
+    }
+    if(cnode->pdir != NULL) {
+        for(size_t i = 0; i < cnode->pdir->pnode_count; i++) {
+            const struct pnode* pnode = cnode->pdir->pnodes[i];
+            uint64_t child_expected[config->attr_domain_count / 64 + 1];
+            memcpy(child_expected, expected, sizeof(child_expected));
+            set_bit(child_expected, pnode->attr_var.var);
+            if(!check_cdir_used_attrs(config, pnode->cdir, child_expected)) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+int test_used_attrs()
+{
+    struct betree* tree = betree_make_with_parameters(4, 2);
+    betree_add_integer_variable(tree, "a", false, 0, 10);
+    betree_add_integer_variable(tree, "b", false, 0, 10);
+    betree_add_integer_variable(tree, "c", false, 0, 10);
+
+    for(size_t i = 0; i < 200; i++) {
+        char* expr;
+        if(basprintf(&expr, "a = %zu and b = %zu and c = %zu", i % 10, i % 7, i % 3) < 0) {
+            abort();
+        }
+        mu_assert(betree_insert(tree, i, expr), "");
+        free(expr);
+    }
+    mu_assert(tree->cnode->pdir != NULL, "partitioned");
+    uint64_t expected[1] = { 0 };
+    mu_assert(check_used_attrs(tree->config, tree->cnode, expected), "used attributes follow the path");
+    mu_assert(check_cnode_counters(tree->config, tree->cnode), "counters with nested partitions");
+
+    betree_free(tree);
+    return 0;
+}
+
+int test_sub_bound_cache()
+{
+    struct betree* tree = betree_make();
+    betree_add_integer_variable(tree, "i", false, 0, 100);
+    const struct attr_domain** attr_domains = (const struct attr_domain**)tree->config->attr_domains;
+
+    struct betree_sub* sub = (struct betree_sub*)betree_make_sub(tree, 0, 0, NULL, "not (i < 5)");
+    struct cdir cdir = { .attr_var = attr_domains[0]->attr_var,
+        .bound = { .value_type = BETREE_INTEGER, .imin = 0, .imax = 100 } };
+    mu_assert(sub_is_enclosed(attr_domains, sub, &cdir), "enclosed");
+    mu_assert(sub->bounds[0].version == attr_domains[0]->bound_version, "cached");
+
+    // Widening the domain widens the bound of the sub
+    mu_assert(betree_change_boundaries(tree, "i = 200"), "");
+    mu_assert(attr_domains[0]->bound.imax == 200, "domain changed");
+    mu_assert(!sub_is_enclosed(attr_domains, sub, &cdir), "stale bound is recomputed");
+
+    free_sub(sub);
+    betree_free(tree);
+    return 0;
+}
+
+int test_undefined_partition_skip()
+{
+    struct betree* tree = betree_make();
+    betree_add_integer_variable(tree, "a", true, 0, 10);
+    betree_add_integer_variable(tree, "c", false, 0, 10);
+    for(size_t i = 0; i < 40; i++) {
+        char* expr;
+        if(basprintf(&expr, "a = %zu", i % 10) < 0) {
+            abort();
+        }
+        mu_assert(betree_insert(tree, i, expr), "");
+        free(expr);
+    }
+    mu_assert(tree->cnode->pdir != NULL && tree->cnode->pdir->pnodes[0]->open_count == 0, "partitioned on a");
+
+    // Every sub fails without a, the partition is counted as shorted
+    struct report* report = make_report();
+    mu_assert(betree_search(tree, "{\"c\": 1}", report), "");
+    mu_assert(report->matched == 0 && report->evaluated == 40 && report->shorted == 40, "skipped");
+    free_report(report);
+
+    // One sub can match without a, the partition is searched again
+    mu_assert(betree_insert(tree, 40, "a = 1 or c = 1"), "");
+    mu_assert(tree->cnode->pdir->pnodes[0]->open_count == 1, "open");
+    report = make_report();
+    mu_assert(betree_search(tree, "{\"c\": 1}", report), "");
+    mu_assert(report->matched == 1 && report->subs[0] == 40 && report->evaluated == 41, "searched");
+    free_report(report);
+
+    mu_assert(betree_delete(tree, 40), "");
+    mu_assert(tree->cnode->pdir->pnodes[0]->open_count == 0, "closed");
+
+    betree_free(tree);
+    return 0;
+}
+
+static bool is_frozen(const struct cnode* cnode)
+{
+    if(cnode->pdir == NULL) {
+        return true;
+    }
+    for(size_t i = 0; i < cnode->pdir->pnode_count; i++) {
+        if(cnode->pdir->pnodes[i]->frozen == NULL) {
+            return false;
+        }
+    }
+    return true;
+}
+
+int test_frozen_search()
+{
+    struct betree* tree = betree_make_with_parameters(2, 0);
+    betree_add_integer_variable(tree, "i", false, 0, 100);
+    betree_add_integer_variable(tree, "j", true, 0, 100);
+
+    for(size_t i = 0; i < 100; i++) {
+        char* expr;
+        if(basprintf(&expr, "i = %zu or j > %zu", i, i) < 0) {
+            abort();
+        }
+        mu_assert(betree_insert(tree, i, expr), "");
+        free(expr);
+    }
+
+    enum { event_count = 60 };
+    struct betree_event* events[event_count];
+    struct report* linked[event_count];
+    for(size_t i = 0; i < event_count; i++) {
+        events[i] = betree_make_event(tree);
+        betree_set_variable(events[i], 0, betree_make_integer_variable("i", (i * 7) % 100));
+        if(i % 3 != 0) {
+            betree_set_variable(events[i], 1, betree_make_integer_variable("j", i));
+        }
+        linked[i] = make_report();
+        mu_assert(betree_search_with_event(tree, events[i], linked[i]), "");
+    }
+
+    betree_freeze(tree);
+    mu_assert(tree->cnode->pdir != NULL && is_frozen(tree->cnode), "frozen");
+    for(size_t i = 0; i < event_count; i++) {
+        struct report* report = make_report();
+        mu_assert(betree_search_with_event(tree, events[i], report), "");
+        mu_assert(report->matched == linked[i]->matched && report->evaluated == linked[i]->evaluated,
+            "same search");
+        for(size_t j = 0; j < report->matched; j++) {
+            mu_assert(report->subs[j] == linked[i]->subs[j], "same subs, same order");
+        }
+        free_report(report);
+    }
+
+    // Splitting a cdir sends the partition back to the linked cdirs
+    for(size_t i = 100; i < 120; i++) {
+        char* expr;
+        if(basprintf(&expr, "i = %zu", i % 4) < 0) {
+            abort();
+        }
+        mu_assert(betree_insert(tree, i, expr), "");
+        free(expr);
+    }
+    mu_assert(!is_frozen(tree->cnode), "thawed");
+    struct report* report = make_report();
+    mu_assert(betree_search(tree, "{\"i\": 2}", report), "");
+    mu_assert(report->matched == 6, "i = 2 and the new subs");
+    free_report(report);
+
+    for(size_t i = 0; i < event_count; i++) {
+        free_report(linked[i]);
+        betree_free_event(events[i]);
+    }
+    betree_free(tree);
+    return 0;
+}
+
+static int compare_sub_ids(const void* a, const void* b)
+{
+    betree_sub_t x = *(const betree_sub_t*)a;
+    betree_sub_t y = *(const betree_sub_t*)b;
+    return (x > y) - (x < y);
+}
+
+// Index hits are reported ahead of the tree ones, only the set matters
+static bool same_matches(struct report* a, struct report* b)
+{
+    if(a->matched != b->matched || a->evaluated < a->matched || b->evaluated < b->matched) {
+        return false;
+    }
+    qsort(a->subs, a->matched, sizeof(*a->subs), compare_sub_ids);
+    qsort(b->subs, b->matched, sizeof(*b->subs), compare_sub_ids);
+    return memcmp(a->subs, b->subs, a->matched * sizeof(*a->subs)) == 0;
+}
+
+int test_eq_index()
+{
+    const char* exprs[] = {
+        "i = 1",
+        "i in (1, 2, 3)",
+        "i in (2, 2, 4)",
+        "s = \"a\"",
+        "s in (\"a\", \"b\")",
+        "e = 2",
+        "i = 1 and s = \"a\"",
+        "i <> 2",
+        "i not in (1, 2)",
+        "i > 3",
+        "f = 1.5",
+        "i = 3",
+    };
+    size_t expr_count = sizeof(exprs) / sizeof(*exprs);
+    struct betree* trees[2];
+    for(size_t t = 0; t < 2; t++) {
+        trees[t] = betree_make_with_parameters(2, 0);
+        betree_add_integer_variable(trees[t], "i", true, 0, 5);
+        betree_add_string_variable(trees[t], "s", true, 3);
+        betree_add_integer_enum_variable(trees[t], "e", true, 5);
+        betree_add_float_variable(trees[t], "f", true, 0., 5.);
+        betree_use_eq_index(trees[t], t == 1);
+        for(size_t i = 0; i < expr_count * 4; i++) {
+            mu_assert(betree_insert(trees[t], i, exprs[i % expr_count]), "inserted");
+        }
+    }
+    mu_assert(trees[0]->cnode->eq_index == NULL, "not indexed by default");
+    mu_assert(trees[1]->cnode->eq_index != NULL && trees[1]->cnode->eq_index->sub_count == 8 * 4,
+        "equality and in subs indexed");
+    mu_assert(find_sub_id(0, trees[1]->cnode) != NULL && find_sub_id(6, trees[1]->cnode) != NULL, "found");
+
+    const char* strings[] = { "a", "b", "c", "d" };
+    for(size_t n = 0; n < 240; n++) {
+        // Indexed and tree subs are deleted along the way
+        if(n == 120) {
+            for(size_t t = 0; t < 2; t++) {
+                mu_assert(betree_delete(trees[t], 1), "deleted");
+                mu_assert(betree_delete(trees[t], 4), "deleted");
+                mu_assert(betree_delete(trees[t], 7), "deleted");
+                mu_assert(!betree_delete(trees[t], 1), "already deleted");
+            }
+            mu_assert(find_sub_id(1, trees[1]->cnode) == NULL, "gone");
+        }
+        char* event;
+        if(basprintf(&event, "{\"i\": %zu, \"s\": \"%s\", \"e\": %zu, \"f\": %.1f}",
+               n % 6, strings[n % 4], n % 5, (double)(n % 3) * 0.5 + 0.5) < 0) {
+            abort();
+        }
+        struct report* reports[2];
+        for(size_t t = 0; t < 2; t++) {
+            reports[t] = make_report();
+            mu_assert(betree_search(trees[t], event, reports[t]), "");
+        }
+        mu_assert(same_matches(reports[0], reports[1]), "same search");
+        mu_assert(betree_exists(trees[1], event) == (reports[0]->matched != 0), "same exists");
+
+        struct betree_search_context* context = betree_make_search_context(trees[1]);
+        struct betree_event* filled = make_event_from_string(trees[1], event);
+        struct report* context_report = make_report();
+        mu_assert(betree_search_with_context(trees[1], filled, context, context_report), "");
+        mu_assert(same_matches(reports[0], context_report), "same context search");
+        free_report(context_report);
+        betree_free_event(filled);
+        betree_free_search_context(context);
+
+        struct betree_event* batch_event = make_event_from_string(trees[1], event);
+        struct report* batch_report = make_report();
+        mu_assert(betree_search_batch(trees[1], &batch_event, 1, &batch_report), "");
+        mu_assert(same_matches(reports[0], batch_report), "same batch search");
+        free_report(batch_report);
+        betree_free_event(batch_event);
+
+        for(size_t t = 0; t < 2; t++) {
+            free_report(reports[t]);
+        }
+        free(event);
+    }
+
+    // Bulk loads index the same subs
+    struct betree* bulk = betree_make_with_parameters(2, 0);
+    betree_add_integer_variable(bulk, "i", true, 0, 5);
+    betree_add_string_variable(bulk, "s", true, 3);
+    betree_add_integer_enum_variable(bulk, "e", true, 5);
+    betree_add_float_variable(bulk, "f", true, 0., 5.);
+    betree_use_eq_index(bulk, true);
+    const struct betree_sub* subs[expr_count];
+    for(size_t i = 0; i < expr_count; i++) {
+        subs[i] = betree_make_sub(bulk, i, 0, NULL, exprs[i]);
+    }
+    mu_assert(betree_bulk_load(bulk, expr_count, subs), "");
+    mu_assert(bulk->cnode->eq_index != NULL && bulk->cnode->eq_index->sub_count == 8, "bulk indexed");
+    struct report* report = make_report();
+    mu_assert(betree_search(bulk, "{\"i\": 1, \"s\": \"a\"}", report), "");
+    // Five from the index, i <> 2 from the tree
+    mu_assert(report->matched == 6, "bulk search");
+    free_report(report);
+    betree_free(bulk);
+
+    for(size_t t = 0; t < 2; t++) {
+        betree_free(trees[t]);
+    }
+    return 0;
+}
+
+int test_list_index()
+{
+    const char* exprs[] = {
+        "l one of (1, 2, 3)",
+        "l one of (3, 4)",
+        "2 in l",
+        "\"x\" in sl",
+        "sl one of (\"x\", \"y\")",
+        "l one of (1, 5) and i > 2",
+        "i in (1, 2) and l one of (4, 5, 6) and sl one of (\"y\")",
+        "l all of (1, 2)",
+        "l none of (1, 2)",
+        "l one of (1, 2) or i = 3",
+    };
+    size_t expr_count = sizeof(exprs) / sizeof(*exprs);
+    struct betree* trees[2];
+    for(size_t t = 0; t < 2; t++) {
+        trees[t] = betree_make_with_parameters(2, 0);
+        betree_add_integer_variable(trees[t], "i", true, 0, 5);
+        betree_add_integer_list_variable(trees[t], "l", true, 0, 10);
+        betree_add_string_list_variable(trees[t], "sl", true, 3);
+        betree_use_eq_index(trees[t], t == 1);
+        for(size_t i = 0; i < expr_count * 3; i++) {
+            mu_assert(betree_insert(trees[t], i, exprs[i % expr_count]), "inserted");
+        }
+    }
+    mu_assert(trees[1]->cnode->eq_index->sub_count == 7 * 3, "one of, in and and subs indexed");
+
+    const char* strings[] = { "x", "y", "z" };
+    for(size_t n = 0; n < 200; n++) {
+        if(n == 100) {
+            for(size_t t = 0; t < 2; t++) {
+                mu_assert(betree_delete(trees[t], 0), "deleted");
+                mu_assert(betree_delete(trees[t], 6), "deleted");
+                mu_assert(betree_delete(trees[t], 9), "deleted");
+            }
+        }
+        // Lists of up to three elements, repeated ones included
+        char* event;
+        if(basprintf(&event, "{\"i\": %zu, \"l\": [%zu, %zu, %zu], \"sl\": [\"%s\", \"%s\"]}",
+               n % 6, n % 7, (n / 7) % 7, n % 3, strings[n % 3], strings[(n / 3) % 3]) < 0) {
+            abort();
+        }
+        struct report* reports[2];
+        for(size_t t = 0; t < 2; t++) {
+            reports[t] = make_report();
+            mu_assert(betree_search(trees[t], event, reports[t]), "");
+        }
+        mu_assert(same_matches(reports[0], reports[1]), "same search");
+
+        struct betree_event* batch_event = make_event_from_string(trees[1], event);
+        struct report* batch_report = make_report();
+        mu_assert(betree_search_batch(trees[1], &batch_event, 1, &batch_report), "");
+        mu_assert(same_matches(reports[0], batch_report), "same batch search");
+        free_report(batch_report);
+        betree_free_event(batch_event);
+
+        for(size_t t = 0; t < 2; t++) {
+            free_report(reports[t]);
+        }
+        free(event);
+    }
+
+    // The and on the index, the none of and the or from the tree, less the
+    // deleted copy of the or
+    struct report* report = make_report();
+    mu_assert(betree_search(trees[1], "{\"i\": 3, \"l\": [5]}", report), "");
+    mu_assert(report->matched == 3 + 3 + 2, "mixed subs");
+    free_report(report);
+
+    for(size_t t = 0; t < 2; t++) {
+        betree_free(trees[t]);
+    }
+    return 0;
+}
+
+int test_string_patterns()
+{
+    const char* exprs[] = {
+        "contains(s, \"ab\")",
+        "contains(s, \"b\")",
+        "contains(s, \"abab\")",
+        "contains(s, \"\")",
+        "starts_with(s, \"a\")",
+        "starts_with(s, \"ab\")",
+        "starts_with(s, \"\")",
+        "ends_with(s, \"b\")",
+        "ends_with(s, \"bab\")",
+        "ends_with(s, \"\")",
+        "not contains(s, \"ba\")",
+        "contains(s, \"aa\") or i = 1",
+        "starts_with(s, \"b\") and ends_with(t, \"a\")",
+        "contains(t, \"ab\") and i > 2",
+    };
+    size_t expr_count = sizeof(exprs) / sizeof(*exprs);
+    struct betree* trees[2];
+    for(size_t t = 0; t < 2; t++) {
+        trees[t] = betree_make_with_parameters(2, 0);
+        betree_add_integer_variable(trees[t], "i", true, 0, 5);
+        betree_add_string_variable(trees[t], "s", true, 20);
+        betree_add_string_variable(trees[t], "t", true, 20);
+        for(size_t i = 0; i < expr_count * 2; i++) {
+            mu_assert(betree_insert(trees[t], i, exprs[i % expr_count]), "inserted");
+        }
+    }
+    betree_freeze(trees[1]);
+    mu_assert(trees[1]->config->pred_map->pattern_matcher_count == 2, "one matcher per string attribute");
+
+    // Every string of up to five a and b, and the undefined one
+    for(size_t n = 0; n < 64; n++) {
+        char string[6] = { 0 };
+        size_t length = 0;
+        for(size_t bits = n + 1; bits > 1; bits >>= 1) {
+            string[length++] = bits & 1 ? 'b' : 'a';
+        }
+        char* event;
+        if(n == 63) {
+            if(basprintf(&event, "{\"i\": 3, \"t\": \"ba\"}") < 0) {
+                abort();
+            }
+        }
+        else if(basprintf(&event, "{\"i\": %zu, \"s\": \"%s\", \"t\": \"%s\"}", n % 6, string, string + length / 2) < 0) {
+            abort();
+        }
+        struct report* reports[2];
+        for(size_t t = 0; t < 2; t++) {
+            reports[t] = make_report();
+            mu_assert(betree_search(trees[t], event, reports[t]), "");
+        }
+        mu_assert(same_matches(reports[0], reports[1]), "same search");
+        mu_assert(betree_exists(trees[1], event) == (reports[0]->matched != 0), "same exists");
+
+        // Epoch store on the second pass
+        for(size_t pass = 0; pass < 2; pass++) {
+            betree_use_epoch_memoize(trees[1], pass == 1);
+            struct betree_search_context* context = betree_make_search_context(trees[1]);
+            struct betree_event* filled = make_event_from_string(trees[1], event);
+            struct report* context_report = make_report();
+            mu_assert(betree_search_with_context(trees[1], filled, context, context_report), "");
+            mu_assert(same_matches(reports[0], context_report), "same context search");
+            // Every candidate on the workers, which copy the published patterns
+            struct betree_search_pool* pool = betree_make_search_pool(trees[1], 4, 0);
+            struct report* pool_report = make_report();
+            mu_assert(betree_search_with_pool(trees[1], filled, pool, pool_report), "");
+            mu_assert(same_matches(reports[0], pool_report), "same pool search");
+            free_report(pool_report);
+            betree_free_search_pool(pool);
+            const struct pred_map* pred_map = trees[1]->config->pred_map;
+            struct memoize published = pass == 1 ? make_epoch_memoize(pred_map->memoize_count)
+                                                 : make_memoize(pred_map->memoize_count);
+            struct memoize copied = pass == 1 ? make_epoch_memoize(pred_map->memoize_count)
+                                              : make_memoize(pred_map->memoize_count);
+            publish_patterns(pred_map, context->preds, &published);
+            copy_patterns(pred_map, context->preds, &published, &copied);
+            for(size_t m = 0; m < pred_map->pattern_matcher_count; m++) {
+                const struct pattern_matcher* matcher = &pred_map->pattern_matchers[m];
+                for(size_t j = 0; j < matcher->memoize_id_count; j++) {
+                    bool published_result = false, copied_result = false;
+                    bool is_published = get_memoize(&published, matcher->memoize_ids[j], &published_result);
+                    bool is_copied = get_memoize(&copied, matcher->memoize_ids[j], &copied_result);
+                    mu_assert(is_published == is_copied && published_result == copied_result, "same patterns");
+                }
+            }
+            free_memoize(published);
+            free_memoize(copied);
+            free_report(context_report);
+            betree_free_event(filled);
+            betree_free_search_context(context);
+        }
+        betree_use_epoch_memoize(trees[1], false);
+
+        struct betree_event* batch_event = make_event_from_string(trees[1], event);
+        struct report* batch_report = make_report();
+        mu_assert(betree_search_batch(trees[1], &batch_event, 1, &batch_report), "");
+        mu_assert(same_matches(reports[0], batch_report), "same batch search");
+        free_report(batch_report);
+        betree_free_event(batch_event);
+
+        for(size_t t = 0; t < 2; t++) {
+            free_report(reports[t]);
+        }
+        free(event);
+    }
+
+    // The last copy of a pattern going away turns its matcher off, a new
+    // pattern is evaluated on its own until the next freeze
+    for(size_t t = 0; t < 2; t++) {
+        mu_assert(betree_delete(trees[t], 1), "deleted");
+        mu_assert(betree_delete(trees[t], 1 + expr_count), "deleted");
+        mu_assert(betree_insert(trees[t], 100, "ends_with(s, \"ba\")"), "inserted");
+    }
+    const struct pred_map* pred_map = trees[1]->config->pred_map;
+    mu_assert(pred_map->pattern_matchers[0].stale != pred_map->pattern_matchers[1].stale, "stale");
+    for(size_t pass = 0; pass < 2; pass++) {
+        struct report* reports[2];
+        for(size_t t = 0; t < 2; t++) {
+            reports[t] = make_report();
+            mu_assert(betree_search(trees[t], "{\"i\": 0, \"s\": \"abba\", \"t\": \"aba\"}", reports[t]), "");
+        }
+        mu_assert(same_matches(reports[0], reports[1]), "same search");
+        for(size_t t = 0; t < 2; t++) {
+            free_report(reports[t]);
+        }
+        betree_freeze(trees[1]);
+        mu_assert(!pred_map->pattern_matchers[0].stale && !pred_map->pattern_matchers[1].stale, "compiled");
+    }
+
+    for(size_t t = 0; t < 2; t++) {
+        betree_free(trees[t]);
+    }
+    return 0;
+}
+
+int test_prefilter()
+{
+    srand(42);
+    enum prefilter_e prefilters[3] = { PREFILTER_SCALAR, PREFILTER_SSE2, PREFILTER_AVX2 };
+    size_t max_count = 67;
+    struct betree_sub subs[max_count];
+    struct betree_sub* sub_ptrs[max_count];
+    for(size_t i = 0; i < max_count; i++) {
+        subs[i].id = i;
+        sub_ptrs[i] = &subs[i];
+    }
+    for(size_t word_count = 1; word_count <= 3; word_count++) {
+        uint64_t pass[max_count * word_count], fail[max_count * word_count], undefined[word_count];
+        for(size_t i = 0; i < max_count * word_count; i++) {
+            pass[i] = random_mask();
+            fail[i] = random_mask();
+        }
+        for(size_t w = 0; w < word_count; w++) {
+            undefined[w] = random_mask() | random_mask() << 32 | 0xF0F0F0F0F0F0F0F0ULL;
+        }
+        for(size_t count = 0; count <= max_count; count++) {
+            struct betree_sub* survivors[3][max_count];
+            struct betree_sub* passed[3][max_count];
+            struct prefilter_result results[3];
+            for(size_t p = 0; p < 3; p++) {
+                if(!is_prefilter_supported(prefilters[p])) {
+                    results[p] = results[0];
+                    memcpy(survivors[p], survivors[0], sizeof(survivors[0]));
+                    memcpy(passed[p], passed[0], sizeof(passed[0]));
+                    continue;
+                }
+                results[p] = prefilter_short_circuit_with(
+                    prefilters[p], count, word_count, sub_ptrs, pass, fail, undefined, survivors[p], passed[p]);
+            }
+            size_t expected_survivors = 0, expected_passed = 0, expected_failed = 0;
+            for(size_t i = 0; i < count; i++) {
+                uint64_t is_passed = 0, is_failed = 0;
+                for(size_t w = 0; w < word_count; w++) {
+                    is_passed |= pass[i * word_count + w] & undefined[w];
+                    is_failed |= fail[i * word_count + w] & undefined[w];
+                }
+                if(is_failed != 0) {
+                    expected_failed++;
+                }
+                else if(is_passed != 0) {
+                    mu_assert(passed[0][expected_passed] == sub_ptrs[i], "passed in order");
+                    expected_passed++;
+                }
+                else {
+                    mu_assert(survivors[0][expected_survivors] == sub_ptrs[i], "survived in order");
+                    expected_survivors++;
+                }
+            }
+            mu_assert(results[0].survivor_count == expected_survivors
+                    && results[0].passed_count == expected_passed
+                    && results[0].failed_count == expected_failed,
+                "scalar counts");
+            for(size_t p = 1; p < 3; p++) {
+                mu_assert(results[p].survivor_count == results[0].survivor_count
+                        && results[p].passed_count == results[0].passed_count
+                        && results[p].failed_count == results[0].failed_count,
+                    "same counts for %zu", p);
+                for(size_t i = 0; i < results[0].survivor_count; i++) {
+                    mu_assert(survivors[p][i] == survivors[0][i], "same survivors for %zu", p);
+                }
+                for(size_t i = 0; i < results[0].passed_count; i++) {
+                    mu_assert(passed[p][i] == passed[0][i], "same passed for %zu", p);
+                }
+            }
+        }
+    }
+    return 0;
+}
+
 int all_tests()
 {
     mu_run_test(test_int_enum);
@@ -1657,8 +2960,8 @@ int all_tests()
     mu_run_test(test_insert_first_split);
     mu_run_test(test_pdir_split_twice);
     mu_run_test(test_cdir_split_twice);
-    /*mu_run_test(test_remove_sub_in_tree);*/
-    /*mu_run_test(test_remove_sub_in_tree_with_delete);*/
+    mu_run_test(test_remove_sub_in_tree);
+    mu_run_test(test_remove_sub_in_tree_with_delete);
     mu_run_test(test_match_deeper);
     mu_run_test(test_large_cdir_split);
     mu_run_test(test_min_partition);
@@ -1694,6 +2997,26 @@ int all_tests()
     mu_run_test(test_frequency_bug);
     mu_run_test(test_duplicate_unsorted_integer_list);
     mu_run_test(test_duplicate_unsorted_string_list);
+    mu_run_test(test_search_context);
+    mu_run_test(test_search_batch);
+    mu_run_test(test_search_pool);
+    mu_run_test(test_delete);
+    mu_run_test(test_delete_index);
+    mu_run_test(test_bulk_load);
+    mu_run_test(test_bytecode);
+    mu_run_test(test_attr_lookup);
+    mu_run_test(test_ienum_lookup);
+    mu_run_test(test_string_lookup);
+    mu_run_test(test_wide_short_circuit);
+    mu_run_test(test_prefilter);
+    mu_run_test(test_attr_counters);
+    mu_run_test(test_used_attrs);
+    mu_run_test(test_sub_bound_cache);
+    mu_run_test(test_undefined_partition_skip);
+    mu_run_test(test_frozen_search);
+    mu_run_test(test_eq_index);
+    mu_run_test(test_list_index);
+    mu_run_test(test_string_patterns);
 
     return 0;
 }
@@ -881,6 +881,65 @@ int test_bool_wrong()
     return 0;
 }
 
+int test_hash()
+{
+    struct config* config = make_default_config();
+    add_attr_domain_b(config, "b", false);
+    add_attr_domain_bounded_i(config, "i", false, 0, 10);
+    add_attr_domain_bounded_f(config, "f", false, 0., 10.);
+    add_attr_domain_s(config, "s", false);
+    add_attr_domain_il(config, "il", false);
+    add_attr_domain_frequency(config, "frequency_caps", false);
+
+    const char* exprs[] = {
+        "i is null",
+        "i > 1",
+        "i >= 2",
+        "f < 1.5",
+        "f <= 2.5",
+        "i = 3",
+        "f <> 3.5",
+        "s = \"a\"",
+        "s <> \"b\"",
+        "i in (1, 2, 3)",
+        "s not in (\"a\", \"b\")",
+        "1 in il",
+        "il one of (1, 2)",
+        "il all of (1, 2)",
+        "within_frequency_cap(\"flight\", \"namespace\", 1, 2)",
+        "segment_within(1, 2)",
+        "geo_within_radius(1, 2, 3)",
+        "contains(s, \"abc\")",
+        "starts_with(s, \"abc\")",
+        "b",
+        "not b",
+        "true",
+        "b and i > 1",
+        "i > 1 and b",
+        "b or (i = 3 and not (f < 1.5))",
+    };
+    size_t count = sizeof(exprs) / sizeof(*exprs);
+    uint64_t hashes[count];
+    for(size_t i = 0; i < count; i++) {
+        struct ast_node* a = parse_and_assign(exprs[i], config);
+        struct ast_node* b = parse_and_assign(exprs[i], config);
+        mu_assert(eq_expr(a, b), "equal for %s", exprs[i]);
+        mu_assert(hash_expr(a) == hash_expr(b), "same hash for %s", exprs[i]);
+        hashes[i] = hash_expr(a);
+        free_ast_node(a);
+        free_ast_node(b);
+    }
+    for(size_t i = 0; i < count; i++) {
+        for(size_t j = i + 1; j < count; j++) {
+            mu_assert(hashes[i] != hashes[j], "different hash for %s and %s", exprs[i], exprs[j]);
+        }
+    }
+
+    free_config(config);
+
+    return 0;
+}
+
 int all_tests() 
 {
     mu_run_test(test_compare_integer);
@@ -906,6 +965,7 @@ int all_tests()
     mu_run_test(test_bool);
     mu_run_test(test_bool_wrong);
     mu_run_test(test_is_null);
+    mu_run_test(test_hash);
 
     return 0;
 }
@@ -2,7 +2,9 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
+#include "alloc.h"
 #include "ast.h"
 #include "hashmap.h"
 #include "parser.h"
@@ -25,6 +27,27 @@ struct report* test(const char* expr_a, const char* expr_b, const char* event, s
         fprintf(stderr, "Failed to search for event\n");
         abort();
     }
+    // The epoch store has to memoize the same way, searched twice so the
+    // second search runs on a bumped epoch
+    betree_use_epoch_memoize(tree, true);
+    struct betree_search_context* context = betree_make_search_context(tree);
+    for(size_t i = 0; i < 2; i++) {
+        struct betree_event* filled = make_event_from_string(tree, event);
+        struct report* epoch_report = make_report();
+        if(betree_search_with_context(tree, filled, context, epoch_report) == false) {
+            fprintf(stderr, "Failed to search for event\n");
+            abort();
+        }
+        if(epoch_report->evaluated != report->evaluated || epoch_report->matched != report->matched
+            || epoch_report->memoized != report->memoized) {
+            fprintf(stderr, "Epoch memoize differs\n");
+            abort();
+        }
+        free_report(epoch_report);
+        free_event(filled);
+    }
+    betree_free_search_context(context);
+    betree_use_epoch_memoize(tree, false);
     free_cnode(tree->cnode);
     tree->cnode = make_cnode(tree->config, NULL);
     free_pred_map(tree->config->pred_map);
@@ -338,6 +361,85 @@ int test_bit_logic()
     return 0;
 }
 
+int test_epoch_logic()
+{
+    enum { pred_count = 250 };
+    struct memoize memoize = make_epoch_memoize(pred_count);
+    for(size_t epoch = 0; epoch < 3; epoch++) {
+        for(size_t i = 0; i < pred_count; i++) {
+            bool result;
+            mu_assert(!get_memoize(&memoize, i, &result), "cleared for %zu, at %zu", i, epoch);
+            set_memoize(&memoize, i, (i + epoch) % 2 == 0);
+        }
+        for(size_t i = 0; i < pred_count; i++) {
+            bool result = false;
+            mu_assert(get_memoize(&memoize, i, &result), "set for %zu, at %zu", i, epoch);
+            mu_assert(result == ((i + epoch) % 2 == 0), "result for %zu, at %zu", i, epoch);
+        }
+        reset_memoize(&memoize, pred_count);
+    }
+    // Wrapping around clears the slots
+    memoize.epoch = MAX_MEMOIZE_EPOCH;
+    set_memoize(&memoize, 0, true);
+    reset_memoize(&memoize, pred_count);
+    bool result;
+    mu_assert(memoize.epoch == 1, "wrapped");
+    mu_assert(!get_memoize(&memoize, 0, &result), "cleared after wrap");
+    free_memoize(memoize);
+    return 0;
+}
+
+int test_epoch_performance()
+{
+    enum { pred_count = 20000, partition_count = 1000, search_count = 10000 };
+    struct betree* tree = betree_make();
+    betree_add_integer_variable(tree, "c", false, 0, partition_count - 1);
+    betree_add_integer_variable(tree, "i", false, 0, pred_count);
+
+    // Every pred is shared by two subs so all of them get a memoize id, an
+    // event only reaches the subs of one partition
+    const struct betree_sub** subs = malloc(sizeof(*subs) * pred_count * 2);
+    for(size_t i = 0; i < pred_count * 2; i++) {
+        char* expr;
+        if(basprintf(&expr, "c = %zu and i = %zu", (i / 2) % partition_count, i / 2) < 0) {
+            abort();
+        }
+        subs[i] = betree_make_sub(tree, i, 0, NULL, expr);
+        free(expr);
+    }
+    mu_assert(betree_bulk_load(tree, pred_count * 2, subs), "");
+    free(subs);
+
+    uint64_t took[2];
+    for(size_t mode = 0; mode < 2; mode++) {
+        betree_use_epoch_memoize(tree, mode == 1);
+        struct betree_search_context* context = betree_make_search_context(tree);
+        struct betree_event* event = betree_make_event(tree);
+        betree_set_variable(event, 0, betree_make_integer_variable("c", 42));
+        betree_set_variable(event, 1, betree_make_integer_variable("i", 42));
+        struct report* report = make_report();
+        struct timespec start, done;
+        clock_gettime(CLOCK_MONOTONIC_RAW, &start);
+        for(size_t i = 0; i < search_count; i++) {
+            betree_report_reset(report);
+            betree_search_with_context(tree, event, context, report);
+        }
+        clock_gettime(CLOCK_MONOTONIC_RAW, &done);
+        took[mode] = (done.tv_sec - start.tv_sec) * 1000000 + (done.tv_nsec - start.tv_nsec) / 1000;
+        mu_assert(report->matched == 2, "found the shared pred");
+        mu_assert(report->evaluated < pred_count * 2 / 10, "searched a partition");
+        free_report(report);
+        betree_free_event(event);
+        betree_free_search_context(context);
+    }
+
+    printf("    Bitmap memoize took %" PRIu64 "\n", took[0]);
+    printf("    Epoch memoize took %" PRIu64 "\n", took[1]);
+
+    betree_free(tree);
+    return 0;
+}
+
 int all_tests() 
 {
     mu_run_test(test_compare_integer);
@@ -358,6 +460,8 @@ int all_tests()
     mu_run_test(test_bool);
     mu_run_test(test_sub);
     mu_run_test(test_bit_logic);
+    mu_run_test(test_epoch_logic);
+    mu_run_test(test_epoch_performance);
 
     return 0;
 }
@@ -6,13 +6,19 @@
 #include <time.h>
 
 #include "alloc.h"
+#include "ast.h"
 #include "betree.h"
 #include "debug.h"
+#include "hashmap.h"
 #include "minunit.h"
+#include "prefilter.h"
+#include "tree.h"
 #include "utils.h"
 
 #define COUNT 1000
 
+int parse(const char* text, struct ast_node** node);
+
 int test_cdir_split()
 {
     struct betree* tree = betree_make();
@@ -113,12 +119,826 @@ int test_pdir_split()
     return 0;
 }
 
+int test_batch_search()
+{
+    struct betree* tree = betree_make();
+    betree_add_integer_variable(tree, "a", false, 0, COUNT);
+    betree_add_integer_variable(tree, "b", true, 0, 10);
+
+    for(size_t i = 0; i < COUNT; i++) {
+        char* expr;
+        if(basprintf(&expr, "a > %zu and (b = %zu or b = 5)", i, i % 10) < 0) {
+            abort();
+        }
+        betree_insert(tree, i + 1, expr);
+        free(expr);
+    }
+
+    enum { event_count = 256 };
+    struct betree_event* events[event_count];
+    struct report* loop_reports[event_count];
+    struct report* batch_reports[event_count];
+    for(size_t i = 0; i < event_count; i++) {
+        events[i] = betree_make_event(tree);
+        betree_set_variable(events[i], 0, betree_make_integer_variable("a", (int64_t)(i * COUNT / event_count)));
+        betree_set_variable(events[i], 1, betree_make_integer_variable("b", i % 10));
+        loop_reports[i] = make_report();
+        batch_reports[i] = make_report();
+    }
+
+    struct timespec start, loop_done, batch_done;
+
+    clock_gettime(CLOCK_MONOTONIC_RAW, &start);
+
+    for(size_t i = 0; i < event_count; i++) {
+        mu_assert(betree_search_with_event(tree, events[i], loop_reports[i]), "");
+    }
+
+    clock_gettime(CLOCK_MONOTONIC_RAW, &loop_done);
+
+    mu_assert(betree_search_batch(tree, events, event_count, batch_reports), "");
+
+    clock_gettime(CLOCK_MONOTONIC_RAW, &batch_done);
+
+    for(size_t i = 0; i < event_count; i++) {
+        mu_assert(loop_reports[i]->matched == batch_reports[i]->matched, "Same matches");
+        free_report(loop_reports[i]);
+        free_report(batch_reports[i]);
+        betree_free_event(events[i]);
+    }
+
+    uint64_t loop_us = (loop_done.tv_sec - start.tv_sec) * 1000000
+        + (loop_done.tv_nsec - start.tv_nsec) / 1000;
+    uint64_t batch_us = (batch_done.tv_sec - loop_done.tv_sec) * 1000000
+        + (batch_done.tv_nsec - loop_done.tv_nsec) / 1000;
+
+    printf("    Loop search took %" PRIu64 "\n", loop_us);
+    printf("    Batch search took %" PRIu64 "\n", batch_us);
+
+    betree_free(tree);
+    return 0;
+}
+
+int test_parallel_search()
+{
+    struct betree* tree = betree_make();
+    betree_add_integer_variable(tree, "a", false, 0, COUNT);
+    betree_add_integer_list_variable(tree, "l", false, 0, COUNT);
+
+    for(size_t i = 0; i < COUNT * 10; i++) {
+        char* expr;
+        if(basprintf(&expr, "a >= %zu and %zu in l", i % COUNT, i % 100) < 0) {
+            abort();
+        }
+        betree_insert(tree, i + 1, expr);
+        free(expr);
+    }
+
+    struct betree_event* event = betree_make_event(tree);
+    betree_set_variable(event, 0, betree_make_integer_variable("a", COUNT));
+    struct betree_integer_list* l = betree_make_integer_list(50);
+    for(size_t i = 0; i < 50; i++) {
+        betree_add_integer(l, i, i * 2);
+    }
+    betree_set_variable(event, 1, betree_make_integer_list_variable("l", l));
+
+    struct betree_search_pool* pool = betree_make_search_pool(tree, 4, 1024);
+
+    // A first search of each kind grows the context and the pool, then the
+    // two take turns and the best round of each is kept
+    enum { round_count = 5, search_count = 20 };
+    uint64_t took[2] = { UINT64_MAX, UINT64_MAX };
+    size_t matched[2];
+    for(size_t round = 0; round <= round_count; round++) {
+        for(size_t j = 0; j < 2; j++) {
+            struct timespec start, done;
+            struct report* report = make_report();
+            clock_gettime(CLOCK_MONOTONIC_RAW, &start);
+            for(size_t i = 0; i < search_count; i++) {
+                betree_report_reset(report);
+                if(j == 0) {
+                    mu_assert(betree_search_with_event(tree, event, report), "");
+                }
+                else {
+                    mu_assert(betree_search_with_pool(tree, event, pool, report), "");
+                }
+            }
+            clock_gettime(CLOCK_MONOTONIC_RAW, &done);
+            uint64_t round_took = (done.tv_sec - start.tv_sec) * 1000000 + (done.tv_nsec - start.tv_nsec) / 1000;
+            if(round != 0) {
+                took[j] = round_took < took[j] ? round_took : took[j];
+            }
+            matched[j] = report->matched;
+            free_report(report);
+        }
+    }
+    mu_assert(matched[0] == matched[1], "Same matches");
+
+    printf("    Serial search took %" PRIu64 "\n", took[0]);
+    printf("    Parallel search took %" PRIu64 "\n", took[1]);
+
+    betree_free_search_pool(pool);
+    betree_free_event(event);
+    betree_free(tree);
+    return 0;
+}
+
+int test_bulk_load()
+{
+    struct betree* bulk_tree = betree_make();
+    struct betree* tree = betree_make();
+    struct betree* trees[2] = { bulk_tree, tree };
+    for(size_t i = 0; i < 2; i++) {
+        betree_add_integer_variable(trees[i], "a", false, 0, COUNT);
+        betree_add_integer_variable(trees[i], "b", true, 0, 10);
+    }
+
+    const struct betree_sub** subs = malloc(sizeof(*subs) * COUNT * 10);
+    char** exprs = malloc(sizeof(*exprs) * COUNT * 10);
+    for(size_t i = 0; i < COUNT * 10; i++) {
+        if(basprintf(&exprs[i], "a = %zu and b > %zu", i % COUNT, i % 10) < 0) {
+            abort();
+        }
+        subs[i] = betree_make_sub(bulk_tree, i + 1, 0, NULL, exprs[i]);
+    }
+
+    struct timespec start, insert_done, bulk_done;
+
+    clock_gettime(CLOCK_MONOTONIC_RAW, &start);
+
+    for(size_t i = 0; i < COUNT * 10; i++) {
+        betree_insert(tree, i + 1, exprs[i]);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC_RAW, &insert_done);
+
+    mu_assert(betree_bulk_load(bulk_tree, COUNT * 10, subs), "");
+
+    clock_gettime(CLOCK_MONOTONIC_RAW, &bulk_done);
+
+    struct report* bulk_report = make_report();
+    struct report* report = make_report();
+    const char* event = "{\"a\": 10, \"b\": 5}";
+    mu_assert(betree_search(bulk_tree, event, bulk_report), "");
+    mu_assert(betree_search(tree, event, report), "");
+    mu_assert(bulk_report->matched == report->matched, "Same matches");
+
+    uint64_t insert_us = (insert_done.tv_sec - start.tv_sec) * 1000000
+        + (insert_done.tv_nsec - start.tv_nsec) / 1000;
+    uint64_t bulk_us = (bulk_done.tv_sec - insert_done.tv_sec) * 1000000
+        + (bulk_done.tv_nsec - insert_done.tv_nsec) / 1000;
+
+    printf("    Insert took %" PRIu64 "\n", insert_us);
+    printf("    Bulk load took %" PRIu64 "\n", bulk_us);
+
+    for(size_t i = 0; i < COUNT * 10; i++) {
+        free(exprs[i]);
+    }
+    free(exprs);
+    free(subs);
+    free_report(bulk_report);
+    free_report(report);
+    betree_free(bulk_tree);
+    betree_free(tree);
+    return 0;
+}
+
+int test_bytecode_search()
+{
+    struct betree* ast_tree = betree_make();
+    struct betree* bytecode_tree = betree_make();
+    struct betree* trees[2] = { ast_tree, bytecode_tree };
+    for(size_t i = 0; i < 2; i++) {
+        betree_add_integer_variable(trees[i], "a", false, 0, COUNT);
+        betree_add_integer_variable(trees[i], "b", true, 0, 10);
+        betree_add_float_variable(trees[i], "c", true, 0., 10.);
+        betree_use_bytecode(trees[i], i == 1);
+    }
+
+    for(size_t i = 0; i < COUNT; i++) {
+        char* expr;
+        if(basprintf(&expr,
+               "(a > %zu and b <> %zu) or (c < %zu.5 and not (a = %zu or b = %zu))",
+               i,
+               i % 10,
+               i % 10,
+               i + 1,
+               (i + 1) % 10)
+            < 0) {
+            abort();
+        }
+        for(size_t j = 0; j < 2; j++) {
+            betree_insert(trees[j], i, expr);
+        }
+        free(expr);
+    }
+
+    // The two trees take turns, the best round of each is kept so a noisy
+    // round does not decide the comparison
+    enum { round_count = 5 };
+    uint64_t took[2] = { UINT64_MAX, UINT64_MAX };
+    size_t matched[2];
+    for(size_t round = 0; round < round_count; round++) {
+        for(size_t j = 0; j < 2; j++) {
+            struct betree_event* event = betree_make_event(trees[j]);
+            betree_set_variable(event, 0, betree_make_integer_variable("a", 42));
+            betree_set_variable(event, 1, betree_make_integer_variable("b", 3));
+            betree_set_variable(event, 2, betree_make_float_variable("c", 4.0));
+            struct timespec start, done;
+            struct report* report = make_report();
+            clock_gettime(CLOCK_MONOTONIC_RAW, &start);
+            for(size_t i = 0; i < COUNT; i++) {
+                betree_report_reset(report);
+                betree_search_with_event(trees[j], event, report);
+            }
+            clock_gettime(CLOCK_MONOTONIC_RAW, &done);
+            uint64_t round_took = (done.tv_sec - start.tv_sec) * 1000000 + (done.tv_nsec - start.tv_nsec) / 1000;
+            took[j] = round_took < took[j] ? round_took : took[j];
+            matched[j] = report->matched;
+            free_report(report);
+            betree_free_event(event);
+        }
+    }
+    mu_assert(matched[0] == matched[1], "Same matches");
+
+    printf("    AST search took %" PRIu64 "\n", took[0]);
+    printf("    Bytecode search took %" PRIu64 "\n", took[1]);
+
+    betree_free(ast_tree);
+    betree_free(bytecode_tree);
+    return 0;
+}
+
+int test_short_circuit_search()
+{
+    struct betree* tree = betree_make();
+    betree_add_integer_variable(tree, "a", true, 0, 100000);
+    betree_add_integer_variable(tree, "b", true, 0, 100000);
+    betree_add_integer_variable(tree, "c", false, 0, 100000);
+
+    size_t sub_count = COUNT * 10;
+    for(size_t i = 0; i < sub_count; i++) {
+        char* expr;
+        if(basprintf(&expr, "a = %zu and (b = %zu or c > %zu)", i, i % 97, i) < 0) {
+            abort();
+        }
+        betree_insert(tree, i, expr);
+        free(expr);
+    }
+
+    struct betree_event* event = betree_make_event(tree);
+    betree_set_variable(event, 2, betree_make_integer_variable("c", 42));
+    struct timespec start, done;
+    struct report* report = make_report();
+    clock_gettime(CLOCK_MONOTONIC_RAW, &start);
+    for(size_t i = 0; i < COUNT; i++) {
+        betree_report_reset(report);
+        betree_search_with_event(tree, event, report);
+    }
+    clock_gettime(CLOCK_MONOTONIC_RAW, &done);
+    uint64_t took = (done.tv_sec - start.tv_sec) * 1000000 + (done.tv_nsec - start.tv_nsec) / 1000;
+    mu_assert(report->matched == 0 && report->shorted == sub_count, "all shorted");
+
+    printf("    Short circuit search took %" PRIu64 "\n", took);
+
+    free_report(report);
+    betree_free_event(event);
+    betree_free(tree);
+    return 0;
+}
+
+int test_insert_throughput()
+{
+    // The wide domain can not be split, every sub lands in the root lnode
+    struct betree* wide_tree = betree_make();
+    betree_add_integer_variable(wide_tree, "a", false, 0, INT64_MAX);
+    struct betree* split_tree = betree_make();
+    betree_add_integer_variable(split_tree, "a", false, 0, 999);
+    betree_add_integer_variable(split_tree, "b", false, 0, 999);
+    struct betree* trees[2] = { wide_tree, split_tree };
+    const char* names[2] = { "Unsplittable", "Splittable" };
+
+    size_t sub_count = COUNT * 10;
+    for(size_t t = 0; t < 2; t++) {
+        struct timespec start, done;
+        clock_gettime(CLOCK_MONOTONIC_RAW, &start);
+        for(size_t i = 0; i < sub_count; i++) {
+            char* expr;
+            if(basprintf(&expr, t == 0 ? "a = %zu" : "a = %zu and b > %zu", i % 1000, i % 997) < 0) {
+                abort();
+            }
+            betree_insert(trees[t], i, expr);
+            free(expr);
+        }
+        clock_gettime(CLOCK_MONOTONIC_RAW, &done);
+        uint64_t took = (done.tv_sec - start.tv_sec) * 1000000 + (done.tv_nsec - start.tv_nsec) / 1000;
+        printf("    %s insert took %" PRIu64 "\n", names[t], took);
+    }
+
+    betree_free(wide_tree);
+    betree_free(split_tree);
+    return 0;
+}
+
+// Campaigns come and go while the tree is live, each delete is followed by
+// the insert of a replacement
+int test_delete_churn()
+{
+    struct betree* tree_tree = betree_make();
+    struct betree* index_tree = betree_make();
+    betree_use_eq_index(index_tree, true);
+    struct betree* trees[2] = { tree_tree, index_tree };
+    const char* names[2] = { "Tree", "Eq index" };
+    const char* formats[2] = { "a = %zu and b > %zu", "a = %zu" };
+
+    size_t sub_count = COUNT * 10;
+    for(size_t t = 0; t < 2; t++) {
+        betree_add_integer_variable(trees[t], "a", false, 0, 999);
+        betree_add_integer_variable(trees[t], "b", false, 0, 999);
+        for(size_t i = 0; i < sub_count; i++) {
+            char* expr;
+            if(basprintf(&expr, formats[t], i % 1000, i % 997) < 0) {
+                abort();
+            }
+            betree_insert(trees[t], i, expr);
+            free(expr);
+        }
+        struct timespec start, done;
+        clock_gettime(CLOCK_MONOTONIC_RAW, &start);
+        for(size_t i = 0; i < COUNT; i++) {
+            size_t id = (i * 7919) % sub_count;
+            mu_assert(betree_delete(trees[t], id), "deleted");
+            char* expr;
+            if(basprintf(&expr, formats[t], (i * 31) % 1000, i % 997) < 0) {
+                abort();
+            }
+            betree_insert(trees[t], id, expr);
+            free(expr);
+        }
+        clock_gettime(CLOCK_MONOTONIC_RAW, &done);
+        uint64_t took = (done.tv_sec - start.tv_sec) * 1000000 + (done.tv_nsec - start.tv_nsec) / 1000;
+        printf("    %s delete and insert took %" PRIu64 "\n", names[t], took);
+    }
+
+    betree_free(tree_tree);
+    betree_free(index_tree);
+    return 0;
+}
+
+int test_sparse_event_search()
+{
+    // Every attribute gets its own partition at the root, an event defines
+    // a handful of them
+    enum { attr_count = 400, defined_count = 30 };
+    struct betree* tree = betree_make();
+    for(size_t i = 0; i < attr_count; i++) {
+        char name[16];
+        snprintf(name, sizeof(name), "v%zu", i);
+        betree_add_integer_variable(tree, name, true, 0, 9);
+    }
+
+    size_t sub_count = attr_count * 10;
+    for(size_t i = 0; i < sub_count; i++) {
+        char* expr;
+        if(basprintf(&expr, "v%zu = %zu", i % attr_count, i / attr_count) < 0) {
+            abort();
+        }
+        betree_insert(tree, i, expr);
+        free(expr);
+    }
+    mu_assert(tree->cnode->pdir != NULL && tree->cnode->pdir->pnode_count == attr_count, "one partition per attribute");
+
+    struct betree_event* event = betree_make_event(tree);
+    for(size_t i = 0; i < defined_count; i++) {
+        char name[16];
+        snprintf(name, sizeof(name), "v%zu", i * 13);
+        betree_set_variable(event, i * 13, betree_make_integer_variable(name, 3));
+    }
+    struct timespec start, done;
+    struct report* report = make_report();
+    clock_gettime(CLOCK_MONOTONIC_RAW, &start);
+    for(size_t i = 0; i < COUNT * 10; i++) {
+        betree_report_reset(report);
+        betree_search_with_event(tree, event, report);
+    }
+    clock_gettime(CLOCK_MONOTONIC_RAW, &done);
+    uint64_t took = (done.tv_sec - start.tv_sec) * 1000000 + (done.tv_nsec - start.tv_nsec) / 1000;
+    mu_assert(report->matched == defined_count, "one match per defined attribute");
+
+    printf("    Sparse event search took %" PRIu64 "\n", took);
+
+    free_report(report);
+    betree_free_event(event);
+    betree_free(tree);
+    return 0;
+}
+
+int test_frozen_search()
+{
+    // Ten subs per value, deep enough cdir trees for the layout to matter
+    size_t sub_count = COUNT * 10;
+    struct betree* tree = betree_make();
+    betree_add_integer_variable(tree, "a", false, 0, COUNT - 1);
+    for(size_t i = 0; i < sub_count; i++) {
+        char* expr;
+        if(basprintf(&expr, "a = %zu", i % COUNT) < 0) {
+            abort();
+        }
+        betree_insert(tree, i, expr);
+        free(expr);
+    }
+
+    struct betree_event* events[COUNT];
+    for(size_t i = 0; i < COUNT; i++) {
+        events[i] = betree_make_event(tree);
+        betree_set_variable(events[i], 0, betree_make_integer_variable("a", (i * 7919) % COUNT));
+    }
+    const char* names[2] = { "Linked", "Frozen" };
+    betree_use_epoch_memoize(tree, true);
+    struct betree_search_context* context = betree_make_search_context(tree);
+    struct report* report = make_report();
+    for(size_t t = 0; t < 2; t++) {
+        if(t == 1) {
+            betree_freeze(tree);
+        }
+        struct timespec start, done;
+        clock_gettime(CLOCK_MONOTONIC_RAW, &start);
+        for(size_t r = 0; r < 10; r++) {
+            for(size_t i = 0; i < COUNT; i++) {
+                betree_report_reset(report);
+                betree_search_with_context(tree, events[i], context, report);
+            }
+        }
+        clock_gettime(CLOCK_MONOTONIC_RAW, &done);
+        uint64_t took = (done.tv_sec - start.tv_sec) * 1000000 + (done.tv_nsec - start.tv_nsec) / 1000;
+        mu_assert(report->matched == 10, "found the subs");
+        printf("    %s cdir search took %" PRIu64 "\n", names[t], took);
+    }
+
+    free_report(report);
+    betree_free_search_context(context);
+    for(size_t i = 0; i < COUNT; i++) {
+        betree_free_event(events[i]);
+    }
+    betree_free(tree);
+    return 0;
+}
+
+int test_eq_index_search()
+{
+    // Equality subs on a single variable, ten per value
+    size_t sub_count = COUNT * 10;
+    const char* names[2] = { "Tree", "Indexed" };
+    size_t matched[2];
+    for(size_t t = 0; t < 2; t++) {
+        struct betree* tree = betree_make();
+        betree_add_integer_variable(tree, "a", false, 0, COUNT - 1);
+        betree_add_string_variable(tree, "s", false, COUNT);
+        betree_use_eq_index(tree, t == 1);
+        for(size_t i = 0; i < sub_count; i++) {
+            char* expr;
+            int written = i % 2 == 0 ? basprintf(&expr, "a = %zu", i % COUNT)
+                                     : basprintf(&expr, "s in (\"s%zu\", \"s%zu\")", i % COUNT, (i + 1) % COUNT);
+            if(written < 0) {
+                abort();
+            }
+            betree_insert(tree, i, expr);
+            free(expr);
+        }
+
+        struct betree_event* events[COUNT];
+        for(size_t i = 0; i < COUNT; i++) {
+            char name[32];
+            snprintf(name, sizeof(name), "s%zu", (i * 7) % COUNT);
+            events[i] = betree_make_event(tree);
+            betree_set_variable(events[i], 0, betree_make_integer_variable("a", (i * 7919) % COUNT));
+            betree_set_variable(events[i], 1, betree_make_string_variable("s", name));
+        }
+        betree_use_epoch_memoize(tree, true);
+        struct betree_search_context* context = betree_make_search_context(tree);
+        struct report* report = make_report();
+        struct timespec start, done;
+        clock_gettime(CLOCK_MONOTONIC_RAW, &start);
+        for(size_t r = 0; r < 10; r++) {
+            for(size_t i = 0; i < COUNT; i++) {
+                betree_report_reset(report);
+                betree_search_with_context(tree, events[i], context, report);
+            }
+        }
+        clock_gettime(CLOCK_MONOTONIC_RAW, &done);
+        uint64_t took = (done.tv_sec - start.tv_sec) * 1000000 + (done.tv_nsec - start.tv_nsec) / 1000;
+        mu_assert(report->matched != 0, "found the subs");
+        matched[t] = report->matched;
+        printf("    %s equality search took %" PRIu64 "\n", names[t], took);
+
+        free_report(report);
+        betree_free_search_context(context);
+        for(size_t i = 0; i < COUNT; i++) {
+            betree_free_event(events[i]);
+        }
+        betree_free(tree);
+    }
+    mu_assert(matched[0] == matched[1], "same subs found");
+    return 0;
+}
+
+int test_list_index_search()
+{
+    // Lists spread over the whole domain, half of them with an extra term
+    size_t sub_count = COUNT * 10;
+    const char* names[2] = { "Tree", "Indexed" };
+    size_t matched[2];
+    for(size_t t = 0; t < 2; t++) {
+        struct betree* tree = betree_make();
+        betree_add_integer_variable(tree, "a", false, 0, COUNT - 1);
+        betree_add_integer_list_variable(tree, "l", false, 0, COUNT - 1);
+        betree_use_eq_index(tree, t == 1);
+        for(size_t i = 0; i < sub_count; i++) {
+            char* expr;
+            int written = basprintf(&expr, "l one of (%zu, %zu, %zu)%s",
+                i % COUNT, (i * 7 + COUNT / 2) % COUNT, (COUNT - 1) - i % COUNT, i % 2 == 0 ? "" : " and a > 10");
+            if(written < 0) {
+                abort();
+            }
+            betree_insert(tree, i, expr);
+            free(expr);
+        }
+
+        struct betree_event* events[COUNT];
+        for(size_t i = 0; i < COUNT; i++) {
+            struct betree_integer_list* list = betree_make_integer_list(3);
+            for(size_t j = 0; j < 3; j++) {
+                betree_add_integer(list, j, (i * 31 + j * 97) % COUNT);
+            }
+            events[i] = betree_make_event(tree);
+            betree_set_variable(events[i], 0, betree_make_integer_variable("a", i % 20));
+            betree_set_variable(events[i], 1, betree_make_integer_list_variable("l", list));
+        }
+        betree_use_epoch_memoize(tree, true);
+        struct betree_search_context* context = betree_make_search_context(tree);
+        struct report* report = make_report();
+        matched[t] = 0;
+        struct timespec start, done;
+        clock_gettime(CLOCK_MONOTONIC_RAW, &start);
+        for(size_t i = 0; i < COUNT; i++) {
+            betree_report_reset(report);
+            betree_search_with_context(tree, events[i], context, report);
+            matched[t] += report->matched;
+        }
+        clock_gettime(CLOCK_MONOTONIC_RAW, &done);
+        uint64_t took = (done.tv_sec - start.tv_sec) * 1000000 + (done.tv_nsec - start.tv_nsec) / 1000;
+        printf("    %s one of search took %" PRIu64 "\n", names[t], took);
+
+        free_report(report);
+        betree_free_search_context(context);
+        for(size_t i = 0; i < COUNT; i++) {
+            betree_free_event(events[i]);
+        }
+        betree_free(tree);
+    }
+    mu_assert(matched[0] != 0 && matched[0] == matched[1], "same subs found");
+    return 0;
+}
+
+int test_string_pattern_search()
+{
+    // Distinct patterns over one attribute, every sub is evaluated
+    size_t sub_count = COUNT * 10;
+    const char* names[2] = { "Linked", "Compiled" };
+    const char* formats[3] = { "contains(s, \"-%zu-\")", "starts_with(s, \"%zu-\")", "ends_with(s, \"-%zu\")" };
+    size_t matched[2];
+    for(size_t t = 0; t < 2; t++) {
+        struct betree* tree = betree_make();
+        betree_add_string_variable(tree, "s", false, COUNT);
+        for(size_t i = 0; i < sub_count; i++) {
+            char* expr;
+            if(basprintf(&expr, formats[i % 3], i) < 0) {
+                abort();
+            }
+            betree_insert(tree, i, expr);
+            free(expr);
+        }
+        if(t == 1) {
+            betree_freeze(tree);
+        }
+
+        struct betree_event* events[COUNT];
+        for(size_t i = 0; i < COUNT; i++) {
+            // Sixteen numbers, about a hundred bytes
+            char string[128];
+            size_t length = 0;
+            for(size_t j = 0; j < 16; j++) {
+                length += snprintf(string + length, sizeof(string) - length, j == 0 ? "%zu" : "-%zu",
+                    (i * 31 + j * 613) % sub_count);
+            }
+            events[i] = betree_make_event(tree);
+            betree_set_variable(events[i], 0, betree_make_string_variable("s", string));
+        }
+        struct betree_search_context* context = betree_make_search_context(tree);
+        struct report* report = make_report();
+        matched[t] = 0;
+        struct timespec start, done;
+        clock_gettime(CLOCK_MONOTONIC_RAW, &start);
+        for(size_t i = 0; i < COUNT; i++) {
+            betree_report_reset(report);
+            betree_search_with_context(tree, events[i], context, report);
+            matched[t] += report->matched;
+        }
+        clock_gettime(CLOCK_MONOTONIC_RAW, &done);
+        uint64_t took = (done.tv_sec - start.tv_sec) * 1000000 + (done.tv_nsec - start.tv_nsec) / 1000;
+        printf("    %s string pattern search took %" PRIu64 "\n", names[t], took);
+
+        free_report(report);
+        betree_free_search_context(context);
+        for(size_t i = 0; i < COUNT; i++) {
+            betree_free_event(events[i]);
+        }
+        betree_free(tree);
+    }
+    mu_assert(matched[0] != 0 && matched[0] == matched[1], "same subs found");
+    return 0;
+}
+
+int test_geo_search()
+{
+    // Small fences spread over a continent, most events are outside of them
+    size_t sub_count = COUNT * 10;
+    struct betree* tree = betree_make();
+    betree_add_float_variable(tree, "latitude", false, -90.0, 90.0);
+    betree_add_float_variable(tree, "longitude", false, -180.0, 180.0);
+    for(size_t i = 0; i < sub_count; i++) {
+        char* expr;
+        if(basprintf(&expr, "geo_within_radius(%.3f, %.3f, 5.0)", 25.0 + (i % 100) * 0.25, -125.0 + (i / 100) * 0.6) < 0) {
+            abort();
+        }
+        betree_insert(tree, i, expr);
+        free(expr);
+    }
+
+    struct betree_event* events[COUNT];
+    for(size_t i = 0; i < COUNT; i++) {
+        // Every tenth event is on the center of a fence
+        size_t fence = (i * 37) % sub_count;
+        double latitude = 25.0 + (fence % 100) * 0.25 + (i % 10 == 0 ? 0 : 0.1);
+        double longitude = -125.0 + (fence / 100) * 0.6;
+        events[i] = betree_make_event(tree);
+        betree_set_variable(events[i], 0, betree_make_float_variable("latitude", latitude));
+        betree_set_variable(events[i], 1, betree_make_float_variable("longitude", longitude));
+    }
+    struct betree_search_context* context = betree_make_search_context(tree);
+    struct report* report = make_report();
+    size_t matched = 0;
+    struct timespec start, done;
+    clock_gettime(CLOCK_MONOTONIC_RAW, &start);
+    for(size_t i = 0; i < COUNT; i++) {
+        betree_report_reset(report);
+        betree_search_with_context(tree, events[i], context, report);
+        matched += report->matched;
+    }
+    clock_gettime(CLOCK_MONOTONIC_RAW, &done);
+    uint64_t took = (done.tv_sec - start.tv_sec) * 1000000 + (done.tv_nsec - start.tv_nsec) / 1000;
+    printf("    Geo search took %" PRIu64 "\n", took);
+
+    free_report(report);
+    betree_free_search_context(context);
+    for(size_t i = 0; i < COUNT; i++) {
+        betree_free_event(events[i]);
+    }
+    betree_free(tree);
+    mu_assert(matched == COUNT / 10, "one fence per centered event");
+    return 0;
+}
+
+int test_prefilter_stage()
+{
+    enum prefilter_e prefilters[3] = { PREFILTER_SCALAR, PREFILTER_SSE2, PREFILTER_AVX2 };
+    const char* names[3] = { "Scalar", "SSE2", "AVX2" };
+    size_t sub_count = COUNT * 100;
+    struct betree_sub sub = { .id = 0 };
+    struct betree_sub** subs = malloc(sub_count * sizeof(*subs));
+    struct betree_sub** survivors = malloc(sub_count * sizeof(*survivors));
+    struct betree_sub** passed = malloc(sub_count * sizeof(*passed));
+    for(size_t word_count = 1; word_count <= 2; word_count++) {
+        uint64_t* pass = calloc(sub_count * word_count, sizeof(*pass));
+        uint64_t* fail = calloc(sub_count * word_count, sizeof(*fail));
+        uint64_t undefined[word_count];
+        for(size_t w = 0; w < word_count; w++) {
+            undefined[w] = ~0ULL << 8;
+        }
+        // One sub in 16 is not short circuited
+        for(size_t i = 0; i < sub_count; i++) {
+            subs[i] = &sub;
+            fail[i * word_count + word_count - 1] = i % 16 == 0 ? 1ULL : 1ULL << (i % 56 + 8);
+        }
+        size_t survivor_count = 0;
+        for(size_t p = 0; p < 3; p++) {
+            if(!is_prefilter_supported(prefilters[p])) {
+                continue;
+            }
+            struct timespec start, done;
+            clock_gettime(CLOCK_MONOTONIC_RAW, &start);
+            for(size_t i = 0; i < COUNT; i++) {
+                struct prefilter_result result = prefilter_short_circuit_with(
+                    prefilters[p], sub_count, word_count, subs, pass, fail, undefined, survivors, passed);
+                survivor_count = result.survivor_count;
+            }
+            clock_gettime(CLOCK_MONOTONIC_RAW, &done);
+            uint64_t took = (done.tv_sec - start.tv_sec) * 1000000 + (done.tv_nsec - start.tv_nsec) / 1000;
+            mu_assert(survivor_count == sub_count / 16, "survivors");
+            printf("    %s prefilter with %zu words took %" PRIu64 "\n", names[p], word_count, took);
+        }
+        free(pass);
+        free(fail);
+    }
+    free(subs);
+    free(survivors);
+    free(passed);
+    return 0;
+}
+
+int test_pred_map_insert()
+{
+    struct betree* tree = betree_make();
+    betree_add_integer_variable(tree, "a", false, 0, COUNT);
+    betree_add_integer_variable(tree, "b", false, 0, COUNT);
+    betree_add_float_variable(tree, "c", false, 0., COUNT);
+
+    // Half of the exprs repeat an earlier one, every one has 5 nodes
+    size_t count = COUNT * 200;
+    struct ast_node** nodes = malloc(sizeof(*nodes) * count);
+    for(size_t i = 0; i < count; i++) {
+        char* expr;
+        size_t n = i % (count / 2);
+        if(basprintf(&expr, "a = %zu and (b > %zu or c < %zu.5)", n % COUNT, n / COUNT, n % 7) < 0) {
+            abort();
+        }
+        if(parse(expr, &nodes[i]) != 0) {
+            abort();
+        }
+        assign_variable_id(tree->config, nodes[i]);
+        free(expr);
+    }
+
+    struct timespec start, done;
+
+    clock_gettime(CLOCK_MONOTONIC_RAW, &start);
+
+    for(size_t i = 0; i < count; i++) {
+        assign_pred_id(tree->config, nodes[i]);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC_RAW, &done);
+
+    mu_assert(tree->config->pred_map->memoize_count != 0, "shared preds");
+
+    uint64_t assign_us = (done.tv_sec - start.tv_sec) * 1000000 + (done.tv_nsec - start.tv_nsec) / 1000;
+
+    printf("    Pred map insert took %" PRIu64 "\n", assign_us);
+
+    for(size_t i = 0; i < count; i++) {
+        free_ast_node(nodes[i]);
+    }
+    free(nodes);
+    betree_free(tree);
+    return 0;
+}
+
 int all_tests()
 {
     mu_run_test(test_cdir_split);
     printf("\n");
     mu_run_test(test_pdir_split);
     printf("\n");
+    mu_run_test(test_batch_search);
+    printf("\n");
+    mu_run_test(test_parallel_search);
+    printf("\n");
+    mu_run_test(test_bulk_load);
+    printf("\n");
+    mu_run_test(test_bytecode_search);
+    printf("\n");
+    mu_run_test(test_pred_map_insert);
+    printf("\n");
+    mu_run_test(test_short_circuit_search);
+    printf("\n");
+    mu_run_test(test_prefilter_stage);
+    printf("\n");
+    mu_run_test(test_insert_throughput);
+    printf("\n");
+    mu_run_test(test_delete_churn);
+    printf("\n");
+    mu_run_test(test_sparse_event_search);
+    printf("\n");
+    mu_run_test(test_frozen_search);
+    printf("\n");
+    mu_run_test(test_eq_index_search);
+    printf("\n");
+    mu_run_test(test_list_index_search);
+    printf("\n");
+    mu_run_test(test_string_pattern_search);
+    printf("\n");
+    mu_run_test(test_geo_search);
+    printf("\n");
 
     return 0;
 }
@@ -66,11 +66,66 @@ int test_string()
     return 0;
 }
 
+int test_reset()
+{
+    struct betree* tree = betree_make();
+    add_attr_domain_bounded_i(tree->config, "a", false, 0, 100);
+
+    for(size_t i = 0; i < 20; i++) {
+        mu_assert(betree_insert(tree, i, "a > 6"), "");
+    }
+
+    struct report* report = make_report();
+    mu_assert(betree_search(tree, "{\"a\":7}", report), "");
+    mu_assert(report->matched == 20, "");
+    mu_assert(report->capacity >= 20, "");
+    betree_sub_t* subs = report->subs;
+    size_t capacity = report->capacity;
+
+    betree_report_reset(report);
+    mu_assert(report->evaluated == 0 && report->matched == 0, "");
+    mu_assert(betree_search(tree, "{\"a\":8}", report), "");
+    mu_assert(report->matched == 20, "");
+    mu_assert(report->subs == subs && report->capacity == capacity, "buffer kept");
+    free_report(report);
+
+    betree_free(tree);
+
+    return 0;
+}
+
+int test_buffer()
+{
+    struct betree* tree = betree_make();
+    add_attr_domain_bounded_i(tree->config, "a", false, 0, 100);
+
+    for(size_t i = 0; i < 20; i++) {
+        mu_assert(betree_insert(tree, i, "a > 6"), "");
+    }
+
+    betree_sub_t subs[16];
+    struct report* report = make_report_with_buffer(16, subs);
+    mu_assert(betree_search(tree, "{\"a\":7}", report), "");
+    mu_assert(report->matched == 16 && report->dropped == 4, "");
+    mu_assert(report->subs == subs && report->capacity == 16, "buffer untouched");
+
+    betree_report_reset(report);
+    mu_assert(betree_search(tree, "{\"a\":2}", report), "");
+    mu_assert(report->matched == 0 && report->dropped == 0, "");
+    free_report(report);
+
+    betree_free(tree);
+
+    return 0;
+}
+
 int all_tests()
 {
     mu_run_test(test_integer);
     mu_run_test(test_float);
     mu_run_test(test_string);
+    mu_run_test(test_reset);
+    mu_run_test(test_buffer);
 
     return 0;
 }
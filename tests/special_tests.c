@@ -1,4 +1,5 @@
 #include <inttypes.h>
+#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -359,6 +360,76 @@ int test_geo()
     return 0;
 }
 
+// Distance as computed before the bounds
+static bool geo_reference(double lat1, double lon1, double lat2, double lon2, double distance)
+{
+    double dx, dy, dz;
+    lon1 -= lon2;
+    lon1 *= 3.1415926536 / 180, lat1 *= 3.1415926536 / 180, lat2 *= 3.1415926536 / 180;
+
+    dz = sin(lat1) - sin(lat2);
+    dx = cos(lon1) * cos(lat1) - cos(lat2);
+    dy = sin(lon1) * cos(lat1);
+
+    return (asin(sqrt(dx * dx + dy * dy + dz * dz) / 2) * 2 * 6372.8) <= distance;
+}
+
+int test_geo_bounds()
+{
+    // Centers near the poles and the antimeridian, radii up to past the antipode
+    const double centers[][3] = {
+        { 45.5, -73.6, 10 },
+        { 45.5, -73.6, 800 },
+        { 0, 179.9, 50 },
+        { -10, -179.5, 300 },
+        { 89.9, 12, 30 },
+        { -88, 0, 500 },
+        { 60, 30, 3000 },
+        { 0, 0, 19000 },
+        { 0, 0, 25000 },
+        { 100, 100, 10 },
+    };
+    size_t center_count = sizeof(centers) / sizeof(*centers);
+    struct betree* tree = betree_make();
+    add_attr_domain_bounded_f(tree->config, "latitude", false, -200.0, 200.0);
+    add_attr_domain_bounded_f(tree->config, "longitude", false, -400.0, 400.0);
+    for(size_t i = 0; i < center_count; i++) {
+        char* expr;
+        if(basprintf(&expr, "geo_within_radius(%.1f, %.1f, %.1f)", centers[i][0], centers[i][1], centers[i][2]) < 0) {
+            abort();
+        }
+        mu_assert(betree_insert(tree, i, expr), "inserted");
+        free(expr);
+    }
+    struct report* report = make_report();
+    for(int latitude = -90; latitude <= 100; latitude += 2) {
+        for(int longitude = -360; longitude <= 370; longitude += 5) {
+            // Off the grid as well, floats only, integers would leave them undefined
+            for(size_t k = 0; k < 2; k++) {
+                double lat = latitude + (k == 0 ? 0 : 0.25);
+                double lon = longitude + (k == 0 ? 0 : 0.5);
+                char* event;
+                if(basprintf(&event, "{\"latitude\": %.2f, \"longitude\": %.2f}", lat, lon) < 0) {
+                    abort();
+                }
+                betree_report_reset(report);
+                mu_assert(betree_search(tree, event, report), "");
+                size_t expected = 0;
+                for(size_t i = 0; i < center_count; i++) {
+                    if(geo_reference(centers[i][0], centers[i][1], lat, lon, centers[i][2])) {
+                        expected++;
+                    }
+                }
+                mu_assert(report->matched == expected, "same as without the bounds");
+                free(event);
+            }
+        }
+    }
+    free_report(report);
+    betree_free(tree);
+    return 0;
+}
+
 static bool contains(bool has_not, const char* attr, bool allow_undefined, const char* pattern, const char* value)
 {
     struct betree* tree = betree_make();
@@ -533,6 +604,7 @@ int all_tests()
     mu_run_test(test_frequency);
     mu_run_test(test_segment);
     mu_run_test(test_geo);
+    mu_run_test(test_geo_bounds);
     mu_run_test(test_contains);
     mu_run_test(test_starts_with);
     mu_run_test(test_ends_with);